@@ -0,0 +1,414 @@
+/****************************************************/
+/* File: cfg.c                                      */
+/* Control-flow graph of an IR function: basic     */
+/* blocks, dominator tree, natural loops and the   */
+/* liveness of temps                                */
+/****************************************************/
+
+#include "globals.h"
+#include "ir.h"
+#include "cfg.h"
+
+#define WORD_BITS (8 * sizeof(unsigned))
+
+static void addEdge(IrCfg *cfg, int from, int to)
+{
+  IrBlock *b = &cfg->blocks[to];
+  /* a branch to the next block is a single edge */
+  if (cfg->blocks[from].nsucc > 0 && cfg->blocks[from].succ[0] == to)
+    return;
+  cfg->blocks[from].succ[cfg->blocks[from].nsucc++] = to;
+  if (b->npred == b->maxPred)
+  {
+    b->maxPred = b->maxPred ? 2 * b->maxPred : 4;
+    b->pred = (int *)realloc(b->pred, b->maxPred * sizeof(int));
+  }
+  b->pred[b->npred++] = from;
+}
+
+/* Procedure split makes the blocks: a block starts
+ * at the first instruction, at a label that does not
+ * follow another label and after a branch
+ */
+static void split(IrCfg *cfg)
+{
+  IrFunc *f = cfg->func;
+  IrIns *ins;
+  int n = 0, max = 8, i;
+  IrBlock *b;
+  cfg->blocks = (IrBlock *)calloc(max, sizeof(IrBlock));
+  cfg->labelBlock = (int *)malloc((f->nlabels + 1) * sizeof(int));
+  for (i = 0; i < f->nlabels; i++)
+    cfg->labelBlock[i] = -1;
+  for (ins = f->first; ins != NULL; ins = ins->next)
+  {
+    if (ins == f->first || (ins->op == irLABEL && ins->prev->op != irLABEL) || irIsBranch(ins->prev))
+    {
+      if (n == max)
+      {
+        max *= 2;
+        cfg->blocks = (IrBlock *)realloc(cfg->blocks, max * sizeof(IrBlock));
+        memset(&cfg->blocks[n], 0, (max - n) * sizeof(IrBlock));
+      }
+      cfg->blocks[n++].first = ins;
+    }
+    cfg->blocks[n - 1].last = ins;
+    if (ins->op == irLABEL)
+      cfg->labelBlock[ins->label] = n - 1;
+  }
+  cfg->nblocks = n;
+  for (i = 0; i < n; i++)
+  {
+    b = &cfg->blocks[i];
+    b->idom = -1;
+    b->rpo = -1;
+    b->loop = -1;
+    if (b->last->op == irJUMP || b->last->op == irBR)
+      addEdge(cfg, i, cfg->labelBlock[b->last->label]);
+    if (b->last->op != irJUMP && b->last->op != irRET && i + 1 < n)
+      addEdge(cfg, i, i + 1);
+  }
+}
+
+/* depth-first search for the reverse postorder */
+static void number(IrCfg *cfg, int b, int *next)
+{
+  int i;
+  cfg->blocks[b].rpo = 0;
+  for (i = 0; i < cfg->blocks[b].nsucc; i++)
+    if (cfg->blocks[cfg->blocks[b].succ[i]].rpo < 0)
+      number(cfg, cfg->blocks[b].succ[i], next);
+  cfg->order[--*next] = b;
+}
+
+static int intersect(IrCfg *cfg, int a, int b)
+{
+  while (a != b)
+  {
+    while (cfg->blocks[a].rpo > cfg->blocks[b].rpo)
+      a = cfg->blocks[a].idom;
+    while (cfg->blocks[b].rpo > cfg->blocks[a].rpo)
+      b = cfg->blocks[b].idom;
+  }
+  return a;
+}
+
+static void numberTree(IrCfg *cfg, int b, int *count)
+{
+  int i;
+  cfg->blocks[b].pre = (*count)++;
+  for (i = 0; i < cfg->blocks[b].nkids; i++)
+    numberTree(cfg, cfg->blocks[b].kids[i], count);
+  cfg->blocks[b].post = (*count)++;
+}
+
+/* Procedure dominators is the iterative algorithm
+ * of Cooper, Harvey and Kennedy over the reverse
+ * postorder; the entry is its own idom while it runs
+ */
+static void dominators(IrCfg *cfg)
+{
+  int next = cfg->nblocks, changed = TRUE, i, j, b, d, count = 0;
+  IrBlock *blk;
+  cfg->order = (int *)malloc(cfg->nblocks * sizeof(int));
+  number(cfg, 0, &next);
+  cfg->norder = cfg->nblocks - next;
+  memmove(cfg->order, cfg->order + next, cfg->norder * sizeof(int));
+  for (i = 0; i < cfg->norder; i++)
+    cfg->blocks[cfg->order[i]].rpo = i;
+  cfg->blocks[0].idom = 0;
+  while (changed)
+  {
+    changed = FALSE;
+    for (i = 1; i < cfg->norder; i++)
+    {
+      blk = &cfg->blocks[b = cfg->order[i]];
+      d = -1;
+      for (j = 0; j < blk->npred; j++)
+        if (cfg->blocks[blk->pred[j]].idom >= 0)
+          d = d < 0 ? blk->pred[j] : intersect(cfg, blk->pred[j], d);
+      if (d != blk->idom)
+      {
+        blk->idom = d;
+        changed = TRUE;
+      }
+    }
+  }
+  cfg->blocks[0].idom = -1;
+  for (i = 1; i < cfg->norder; i++)
+  {
+    blk = &cfg->blocks[cfg->blocks[cfg->order[i]].idom];
+    blk->kids = (int *)realloc(blk->kids, (blk->nkids + 1) * sizeof(int));
+    blk->kids[blk->nkids++] = cfg->order[i];
+  }
+  numberTree(cfg, 0, &count);
+}
+
+int cfgDominates(IrCfg *cfg, int a, int b)
+{
+  if (cfg->blocks[a].rpo < 0 || cfg->blocks[b].rpo < 0)
+    return FALSE;
+  return cfg->blocks[a].pre <= cfg->blocks[b].pre && cfg->blocks[b].post <= cfg->blocks[a].post;
+}
+
+/* Procedure loops finds the natural loop of every
+ * back edge, merging the loops of a shared header,
+ * and nests them
+ */
+static void loops(IrCfg *cfg)
+{
+  int n = cfg->nblocks, i, j, k, h, b, top;
+  int *stack = (int *)malloc((n + 1) * sizeof(int));
+  IrLoop *l;
+  /* headers in reverse postorder put outer loops first */
+  for (i = 0; i < cfg->norder; i++)
+  {
+    h = cfg->order[i];
+    l = NULL;
+    for (j = 0; j < cfg->blocks[h].npred; j++)
+    {
+      b = cfg->blocks[h].pred[j];
+      if (!cfgDominates(cfg, h, b))
+        continue;
+      if (l == NULL)
+      {
+        cfg->loops = (IrLoop *)realloc(cfg->loops, (cfg->nloops + 1) * sizeof(IrLoop));
+        l = &cfg->loops[cfg->nloops++];
+        l->header = h;
+        l->parent = -1;
+        l->depth = 1;
+        l->body = (char *)calloc(n, 1);
+        l->body[h] = TRUE;
+        l->nblocks = 1;
+      }
+      top = 0;
+      if (!l->body[b])
+      {
+        l->body[b] = TRUE;
+        l->nblocks++;
+        stack[top++] = b;
+      }
+      while (top > 0)
+      {
+        b = stack[--top];
+        for (k = 0; k < cfg->blocks[b].npred; k++)
+        {
+          int p = cfg->blocks[b].pred[k];
+          if (cfg->blocks[p].rpo >= 0 && !l->body[p])
+          {
+            l->body[p] = TRUE;
+            l->nblocks++;
+            stack[top++] = p;
+          }
+        }
+      }
+    }
+  }
+  /* the parent is the innermost earlier loop holding the header */
+  for (i = 0; i < cfg->nloops; i++)
+  {
+    for (j = i - 1; j >= 0; j--)
+      if (cfg->loops[j].body[cfg->loops[i].header])
+        break;
+    if (j >= 0)
+    {
+      cfg->loops[i].parent = j;
+      cfg->loops[i].depth = cfg->loops[j].depth + 1;
+    }
+    for (b = 0; b < n; b++)
+      if (cfg->loops[i].body[b])
+      {
+        cfg->blocks[b].loop = i;
+        cfg->blocks[b].depth = cfg->loops[i].depth;
+      }
+  }
+  free(stack);
+}
+
+IrCfg *cfgBuild(IrFunc *f)
+{
+  IrCfg *cfg = (IrCfg *)calloc(1, sizeof(IrCfg));
+  cfg->func = f;
+  split(cfg);
+  dominators(cfg);
+  loops(cfg);
+  return cfg;
+}
+
+void cfgFree(IrCfg *cfg)
+{
+  int i;
+  if (cfg == NULL)
+    return;
+  for (i = 0; i < cfg->nblocks; i++)
+  {
+    free(cfg->blocks[i].pred);
+    free(cfg->blocks[i].kids);
+    free(cfg->blocks[i].liveIn);
+    free(cfg->blocks[i].liveOut);
+  }
+  for (i = 0; i < cfg->nloops; i++)
+    free(cfg->loops[i].body);
+  free(cfg->loops);
+  free(cfg->blocks);
+  free(cfg->order);
+  free(cfg->labelBlock);
+  free(cfg);
+}
+
+int cfgBlockOf(IrCfg *cfg, IrIns *ins)
+{
+  int i;
+  IrIns *p;
+  for (i = 0; i < cfg->nblocks; i++)
+    for (p = cfg->blocks[i].first;; p = p->next)
+    {
+      if (p == ins)
+        return i;
+      if (p == cfg->blocks[i].last)
+        break;
+    }
+  return -1;
+}
+
+int cfgPreheader(IrCfg *cfg, IrLoop *l)
+{
+  IrBlock *h = &cfg->blocks[l->header];
+  int j, p = -1;
+  for (j = 0; j < h->npred; j++)
+    if (!l->body[h->pred[j]])
+    {
+      if (p >= 0)
+        return -1;
+      p = h->pred[j];
+    }
+  if (p < 0 || cfg->blocks[p].nsucc != 1)
+    return -1;
+  return p;
+}
+
+/**************************************************/
+/***********   Liveness                ************/
+/**************************************************/
+
+int cfgLive(unsigned *set, int t)
+{
+  return (set[t / WORD_BITS] >> (t % WORD_BITS)) & 1;
+}
+
+void cfgSetLive(unsigned *set, int t, int live)
+{
+  if (live)
+    set[t / WORD_BITS] |= 1u << (t % WORD_BITS);
+  else
+    set[t / WORD_BITS] &= ~(1u << (t % WORD_BITS));
+}
+
+/* Procedure cfgLiveness solves the backward
+ * dataflow problem in postorder until nothing
+ * changes; liveIn is rebuilt from liveOut by a
+ * walk over the block
+ */
+void cfgLiveness(IrCfg *cfg)
+{
+  int w = (cfg->func->ntemps + WORD_BITS) / WORD_BITS;
+  int changed = TRUE, i, j, k;
+  unsigned *in = (unsigned *)malloc(w * sizeof(unsigned));
+  IrBlock *b;
+  IrIns *ins;
+  IrArg *arg;
+  cfg->words = w;
+  for (i = 0; i < cfg->nblocks; i++)
+  {
+    b = &cfg->blocks[i];
+    free(b->liveIn);
+    free(b->liveOut);
+    b->liveIn = (unsigned *)calloc(w, sizeof(unsigned));
+    b->liveOut = (unsigned *)calloc(w, sizeof(unsigned));
+  }
+  while (changed)
+  {
+    changed = FALSE;
+    for (i = cfg->norder - 1; i >= 0; i--)
+    {
+      b = &cfg->blocks[cfg->order[i]];
+      for (j = 0; j < b->nsucc; j++)
+        for (k = 0; k < w; k++)
+          b->liveOut[k] |= cfg->blocks[b->succ[j]].liveIn[k];
+      memcpy(in, b->liveOut, w * sizeof(unsigned));
+      for (ins = b->last;; ins = ins->prev)
+      {
+        if (ins->dst >= 0)
+          cfgSetLive(in, ins->dst, FALSE);
+        for (j = 0; (arg = irOperand(ins, j)) != NULL; j++)
+          if (arg->kind == argTEMP)
+            cfgSetLive(in, arg->val, TRUE);
+        if (ins == b->first)
+          break;
+      }
+      if (memcmp(in, b->liveIn, w * sizeof(unsigned)))
+      {
+        memcpy(b->liveIn, in, w * sizeof(unsigned));
+        changed = TRUE;
+      }
+    }
+  }
+  free(in);
+}
+
+/**************************************************/
+/***********   Printing                ************/
+/**************************************************/
+
+static void printList(char *title, int *list, int n)
+{
+  int i;
+  pc(" %s", title);
+  for (i = 0; i < n; i++)
+    pc("%s%d", i ? "," : "", list[i]);
+  if (n == 0)
+    pc("-");
+}
+
+void cfgPrint(IrCfg *cfg)
+{
+  int i, b, first;
+  IrBlock *blk;
+  IrLoop *l;
+  pc("* cfg of %s: %d blocks, %d loops\n", cfg->func->name, cfg->nblocks, cfg->nloops);
+  for (i = 0; i < cfg->nblocks; i++)
+  {
+    blk = &cfg->blocks[i];
+    pc("*   B%d", i);
+    if (blk->first->op == irLABEL)
+      pc(" (L%d)", blk->first->label);
+    if (blk->rpo < 0)
+    {
+      pc(" unreachable\n");
+      continue;
+    }
+    printList("pred", blk->pred, blk->npred);
+    printList(" succ", blk->succ, blk->nsucc);
+    if (blk->idom >= 0)
+      pc("  idom %d", blk->idom);
+    if (blk->loop >= 0)
+      pc("  loop %d depth %d", blk->loop, blk->depth);
+    pc("\n");
+  }
+  for (i = 0; i < cfg->nloops; i++)
+  {
+    l = &cfg->loops[i];
+    pc("*   loop %d: header B%d depth %d", i, l->header, l->depth);
+    if (l->parent >= 0)
+      pc(" in loop %d", l->parent);
+    pc(" blocks");
+    first = TRUE;
+    for (b = 0; b < cfg->nblocks; b++)
+      if (l->body[b])
+      {
+        pc("%s%d", first ? " " : ",", b);
+        first = FALSE;
+      }
+    pc("\n");
+  }
+}
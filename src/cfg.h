@@ -0,0 +1,88 @@
+/****************************************************/
+/* File: cfg.h                                      */
+/* Control-flow graph of an IR function: basic     */
+/* blocks, dominator tree, natural loops and the   */
+/* liveness of temps                                */
+/****************************************************/
+
+#ifndef _CFG_H_
+#define _CFG_H_
+
+#include "ir.h"
+
+/* a straight run of IR instructions; control only
+ * enters at first (the labels, if any) and only
+ * leaves after last
+ */
+typedef struct
+{
+  IrIns *first, *last;
+  int succ[2];
+  int nsucc;
+  int *pred;
+  int npred, maxPred;
+  int idom;     /* immediate dominator, -1 for the entry and unreachable blocks */
+  int *kids;    /* children in the dominator tree */
+  int nkids;
+  int rpo;      /* position in reverse postorder, -1 if unreachable */
+  int pre, post; /* dominator tree numbering, see cfgDominates */
+  int loop;     /* innermost loop holding the block, -1 for none */
+  int depth;    /* loops holding the block */
+  unsigned *liveIn, *liveOut; /* temps, after cfgLiveness */
+} IrBlock;
+
+/* natural loop: header plus every block that reaches
+ * a back edge into header without passing it
+ */
+typedef struct
+{
+  int header;
+  int parent;  /* enclosing loop, -1 for none */
+  int depth;   /* 1 for outermost loops */
+  char *body;  /* body[b] is TRUE for the blocks of the loop */
+  int nblocks;
+} IrLoop;
+
+typedef struct
+{
+  IrFunc *func;
+  IrBlock *blocks; /* in code order, blocks[0] is the entry */
+  int nblocks;
+  int *order;      /* reachable blocks in reverse postorder */
+  int norder;
+  int *labelBlock; /* block of each label */
+  IrLoop *loops;   /* outer loops before the loops they hold */
+  int nloops;
+  int words;       /* size of the liveness bit sets */
+} IrCfg;
+
+/* Function cfgBuild splits f into blocks and
+ * finds its dominators and loops; the CFG is
+ * stale as soon as f changes
+ */
+IrCfg *cfgBuild(IrFunc *f);
+void cfgFree(IrCfg *cfg);
+/* TRUE if every path from the entry to b goes through a */
+int cfgDominates(IrCfg *cfg, int a, int b);
+/* block holding ins, -1 if none */
+int cfgBlockOf(IrCfg *cfg, IrIns *ins);
+/* the only block that enters loop l from outside
+ * and goes nowhere else, -1 if there is none
+ */
+int cfgPreheader(IrCfg *cfg, IrLoop *l);
+
+/* Procedure cfgLiveness fills in liveIn and
+ * liveOut of every block; phis are taken as
+ * ordinary uses, so it is not meant for SSA form
+ */
+void cfgLiveness(IrCfg *cfg);
+/* TRUE if temp t is in the bit set */
+int cfgLive(unsigned *set, int t);
+void cfgSetLive(unsigned *set, int t, int live);
+
+/* Procedure cfgPrint writes the blocks, edges,
+ * dominators and loop nest as TM comments
+ */
+void cfgPrint(IrCfg *cfg);
+
+#endif
@@ -67,23 +67,68 @@ int getSizeOfVarsByName(char *name) {
 #define INITIAL_SP 100
 #define FP_LOCALS_OFFSET -2
 #define PROLOGUE_CODE_LEN 5
+#define MAX_RETURNS 64
 /* prototype for internal recursive code generator */
 static void cGen(TreeNode *tree);
 
-static void genMainPrologue(TreeNode *tree) {
-   // store current fp value in address pointed by sp. doesn't matter since is main
-   // decrement sp
-   emitRM("ST", fp, 0, sp, "Prologue: Storing FP on stack");
-   emitRM("LDA", fp, 0, sp, "Prologue: FP now points to current frame");
-   emitRM("LDA", sp, -1, sp, "Decrementing SP");
-   // store return address (pc+1). does not matter for main
-   //emitRM("ST", PC+1, 0, sp, "Storing return address on stack");
-   // decrement sp
-   emitRM("LDA", sp, -1, sp, "Decrementing SP");
-   //A main não tem argumentos. Pular para variáveis locais
-   //int len = st_scope_lookup("main")->sizeOfVariables;
-   int len = getSizeOfVarsByName("main");
-   emitRM("LDA", sp, -len, sp, "Decrementing SP");
+/* the function being generated */
+static int isMainFunction = 0;
+static int leafFunction = 0; // calls nothing, so its frame is addressed from sp and fp is left alone
+static int frameSize = 0;
+static TreeNode * lastStmt = NULL; // a return here falls into the epilogue
+static int returnLocs[MAX_RETURNS]; // jumps to the epilogue, patched at the end of the function
+static int numReturns = 0;
+
+/* Function callsFunction tells if the tree calls
+ * a declared function. input and output are
+ * instructions, not calls.
+ */
+static int callsFunction(TreeNode *tree) {
+   int i;
+   for (; tree != NULL; tree = tree->sibling) {
+      if (tree->nodekind == ExpK && tree->kind.exp == ActvK &&
+          strcmp(tree->attr.name, "input") && strcmp(tree->attr.name, "output"))
+         return 1;
+      for (i = 0; i < MAXCHILDREN; i++)
+         if (callsFunction(tree->child[i])) return 1;
+   }
+   return 0;
+}
+
+/* Function frameReg returns the register the frame
+ * of the current function is addressed from
+ */
+static int frameReg(void) {
+   return leafFunction ? sp : fp;
+}
+
+/* Function frameOffset turns an offset from fp into
+ * one from frameReg. In a leaf function sp stays
+ * 2 + frameSize words below where fp would point,
+ * plus one word per temporary pushed.
+ */
+static int frameOffset(int offset) {
+   if (!leafFunction) return offset;
+   return offset - FP_LOCALS_OFFSET + frameSize - tmpOffset;
+}
+
+/* Procedure genEntry completes the frame built by
+ * the caller. Main allocates its own frame; any
+ * function that calls others saves the FP of its
+ * caller in the frame and points FP to it.
+ */
+static void genEntry(void) {
+   if (leafFunction && !isMainFunction) return;
+   if (TraceCode) emitComment("-> Function Entry");
+   if (isMainFunction) {
+      // main has no caller, so nothing to save. One adjustment allocates its frame
+      emitRM("LDA", sp, FP_LOCALS_OFFSET - frameSize, sp, "Prologue: Allocating the frame of main");
+      if (!leafFunction) emitRM("LDA", fp, -FP_LOCALS_OFFSET + frameSize, sp, "Prologue: FP now points to current frame");
+   } else if (!leafFunction) {
+      emitRM("ST", fp, -FP_LOCALS_OFFSET + frameSize, sp, "Prologue: Storing FP on stack");
+      emitRM("LDA", fp, -FP_LOCALS_OFFSET + frameSize, sp, "Prologue: FP now points to current frame");
+   }
+   if (TraceCode) emitComment("<- Function Entry");
 }
 static void genPrologue(TreeNode * tree, char* funcName) {
    int jmpAddr = 0;
@@ -93,14 +138,14 @@ static void genPrologue(TreeNode * tree, char* funcName) {
    ScopeMemLock loc;
    TreeNode * currentArg;
    if (TraceCode) emitComment("-> Function Prologue");
-   emitRM("ST", fp, 0, sp, "Prologue: Storing FP on stack");
-   emitRM("LDA", sp, -1, sp, "Prologue: Decrementing SP");
-   emitRM("LDA", sp, -1, sp, "Prologue: Decrementing SP");   
    //int len = st_scope_lookup(funcName)->sizeOfVariables;
    int len = getSizeOfVarsByName(funcName);
    if (st_scope_lookup(funcName) == NULL) {
       emitComment("WARN: NULL POINTER TO SCOPE");
    }
+   // One adjustment builds the whole frame: saved FP, return address and variables, arguments included.
+   // The args are then evaluated below it, and each goes to its word in the frame
+   emitRM("LDA", sp, FP_LOCALS_OFFSET - len, sp, "Prologue: Allocating the frame");
    // Now we populate the args. they are siblings, so we dont call cGen
    currentArg = tree->child[0];
    // calculate them and store in the correct position on the new frame.
@@ -128,20 +173,15 @@ static void genPrologue(TreeNode * tree, char* funcName) {
       } else {
          genExp(currentArg, 0);
       }
-      //emitRM("ST",ac, -(argCount++), sp, "Storing arg value after new stack pointer");
-      // INSTEAD, DECREMENT SP BY 1 and put the value there, but keep track of argCount
-      emitRM("ST", ac, 0, sp, "Storing arg value after new stack pointer");
-      emitRM("LDA", sp, -1, sp, "Decrementing sp");
+      // arg i lives at FP_LOCALS_OFFSET - i from the new FP, which is 2 + len words above sp
+      emitRM("ST", ac, len - argCount, sp, "Storing arg value in the new frame");
       argCount++;
       currentArg = currentArg->sibling;
    }
-   // Args stored. Now we can abandon the previous frame
-   emitRM("LDA", fp, 2 + argCount, sp, "Prologue: FP now points to current frame");
-   // populate return address. we add 4 because of the 4 other instructions below
-   returnPC = emitSkip(0) + 4;
+   // populate return address. we add 3 because of the 3 instructions below
+   returnPC = emitSkip(0) + 3;
    emitRM("LDC",ac, returnPC, ac, "Storing return address on ac");
-   emitRM("ST", ac, -1, fp, "Store return address on stack" ); /* RM     mem(d+reg(s)) = reg(r) */
-   emitRM("LDA", sp, -len + argCount, sp, "Prologue: Allocating memory for variables and arguments");
+   emitRM("ST", ac, len + 1, sp, "Store return address on stack" ); /* RM     mem(d+reg(s)) = reg(r) */
    // NOW JUMP TO THE FUNCTION THAT WAS JUST CALLED
    for (int i = 0; i < numFunctions; i++) {
       if (!strcmp(funcMap[i].funcName, tree->attr.name)) { 
@@ -155,23 +195,22 @@ static void genPrologue(TreeNode * tree, char* funcName) {
    if (TraceCode) emitComment("<- Function Prologue");  
 }
 
-// We use epilogue on 2 locations. One is on return nodes. Other is on end of function
-static void genEpilogue(TreeNode * tree) {
-   ScopeMemLock loc;
+// Every return of a function jumps to its one epilogue, at the end of the function
+static void genEpilogue(void) {
+   if (isMainFunction) {
+      // main ends the program
+      emitRO("HALT", 0, 0, 0, "return from main");
+      return;
+   }
    if (TraceCode) emitComment("-> Function Epilogue");
-   char* scopeName = contextStack[contextLevel]->scopeName; // should be my function right now
-   //int len = st_scope_lookup(scopeName)->sizeOfVariables;
-   int len = getSizeOfVarsByName(scopeName);
-   // Start epilogue
-   emitRM("LDA", sp, len, sp, "Removing local variables");
-   emitRM("LD",fp, 2, sp, "Restoring previous FP"); //reg(fp) = mem[reg(sp)+2]
-   emitRM("LDA", sp, 2, sp, "Completely destroying the frame");
-   //emitRM_Abs("LDA", PC, currentLoc, "jmp to end");
+   if (leafFunction) {
+      emitRM("LDA", sp, -FP_LOCALS_OFFSET + frameSize, sp, "Epilogue: Destroying the frame");
+   } else {
+      emitRM("LDA", sp, 0, fp, "Epilogue: Destroying the frame");
+      emitRM("LD", fp, 0, sp, "Restoring previous FP");
+   }
    // retPC = mem[reg(sp)-1]
-   emitRM("LD", ac1, -1, sp, "Loading return address in ac1");
-   // here we do an absolute jump
-   // TODO: make it relative
-   emitRM("LDA", PC, 0, ac1, "RETURNINNNG");
+   emitRM("LD", PC, -1, sp, "RETURNINNNG");
 
    if (TraceCode) emitComment("<- Function Epilogue");
 }
@@ -249,7 +288,7 @@ static void genStmt(TreeNode *tree)
          if (!strcmp(loc.scopeName, GLOBAL_SCOPE)) {
             emitRM("ST", ac, loc.memloc, gp, "assign: store to global variable");
          } else {
-            emitRM("ST", ac, -loc.memloc + FP_LOCALS_OFFSET, fp, "assign: store to local variable");
+            emitRM("ST", ac, frameOffset(-loc.memloc + FP_LOCALS_OFFSET), frameReg(), "assign: store to local variable");
          }
       } else { // assign to array
          cGen(tree->child[1]);
@@ -277,7 +316,7 @@ static void genStmt(TreeNode *tree)
             // TODO: IT COULD BE + index or - index. Depends if the passed array was local or global
             if (loc.isParam) {
                // ac2 = fp + LOCALS_OFFSET - loc
-               emitRM("LDA", ac2, FP_LOCALS_OFFSET - loc.memloc, fp, "loading param address on ac2");
+               emitRM("LDA", ac2, frameOffset(FP_LOCALS_OFFSET - loc.memloc), frameReg(), "loading param address on ac2");
                emitRM("LD", ac2,0,ac2, "ac2 = mem[ac2]"); //ac2 now has the true array base address
                emitRO("ADD", ac, ac, ac2, "ac = ac2 + ac (base_Addr + index)"); // TODO: its actually a sub if array is not global
                //emitRM("LDC", ac2, -loc.memloc, ac2, "loading array memloc on ac2");
@@ -285,8 +324,8 @@ static void genStmt(TreeNode *tree)
             } else {
                emitRM("LDC", ac2, -loc.memloc, ac2, "loading array memloc on ac2");
                emitRO("SUB",ac,ac2,ac, "loading array index location on ac (relative to local_variables)");
-               emitRO("ADD",ac,fp,ac, "adding fp to get index location on frame (except for FP_LOCALS_OFFSET)");
-               emitRM("ST", ac1, FP_LOCALS_OFFSET, ac, "adding FP_LOCALS_OFFSET to get abslute index location");
+               emitRO("ADD",ac,frameReg(),ac, "adding fp to get index location on frame (except for FP_LOCALS_OFFSET)");
+               emitRM("ST", ac1, frameOffset(FP_LOCALS_OFFSET), ac, "adding FP_LOCALS_OFFSET to get abslute index location");
             }
          }
       }
@@ -295,14 +334,13 @@ static void genStmt(TreeNode *tree)
       break; /* assign_k */
 
    case ReturnK:
-      if (tree->child[0] != NULL)
-      {
-         // If has an expression, hopefully the result will be in ac
-         cGen(tree->child[0]);
-         // Now we add code to destroy the current frame. The results will be in ac.
-         genEpilogue(tree);
+      // If has an expression, hopefully the result will be in ac
+      cGen(tree->child[0]);
+      // Now we jump to the epilogue, unless it comes next. The results will be in ac.
+      if (tree != lastStmt) {
+         if (numReturns < MAX_RETURNS) returnLocs[numReturns++] = emitSkip(1);
+         else genEpilogue();
       }
-      // Execute epilogue
       break;
 
    case BlockK:
@@ -343,14 +381,14 @@ void genExp(TreeNode *tree, int useAddress) // useAddress is used on activation
             emitRM("LD", ac, loc.memloc, gp, "load id value");
          } else {
             // escopo local, offset de fp
-            emitRM("LD", ac, -loc.memloc + FP_LOCALS_OFFSET, fp, "load local id value");
+            emitRM("LD", ac, frameOffset(-loc.memloc + FP_LOCALS_OFFSET), frameReg(), "load local id value");
          }
       } else {
          if (!strcmp(loc.scopeName, GLOBAL_SCOPE)) {
             // i want to return gp + memloc
             emitRM("LDA", ac, loc.memloc, gp, "load global id address");
          } else {
-            emitRM("LDA", ac, FP_LOCALS_OFFSET - loc.memloc, fp, "load local id address");
+            emitRM("LDA", ac, frameOffset(FP_LOCALS_OFFSET - loc.memloc), frameReg(), "load local id address");
          }
       }
       if (TraceCode)
@@ -369,9 +407,11 @@ void genExp(TreeNode *tree, int useAddress) // useAddress is used on activation
       emitRM("LDA",ac1,0,ac,"Saving temporary value on ac1");
       emitRM("ST", ac1, 0, sp, "Temporary store on stack"); // now we can use ac1 again
       emitRM("LDA", sp, -1, sp, "Decrement sp");
+      tmpOffset--;
       /* gen code for ac = right operand */
       cGen(p2);
       emitRM("LDA", sp, +1, sp, "Increment sp again");
+      tmpOffset++;
       emitRM("LD", ac1,0,sp, "Recovering value on ac1"); // Retrieve the value on ac1
       /* now load left operand */
       //emitRM("LD", ac1, ++tmpOffset, mp, "op: load left");
@@ -457,7 +497,7 @@ void genExp(TreeNode *tree, int useAddress) // useAddress is used on activation
       } else {
          // CAREFUL: It could be a param, so we need to access the true location before retrieving its value
          if (loc.isParam) {
-            emitRM("LD", ac1, FP_LOCALS_OFFSET - loc.memloc ,fp, "ac1 = mem[reg(fp) + FP_LOCALS_OFFSET - loc]");
+            emitRM("LD", ac1, frameOffset(FP_LOCALS_OFFSET - loc.memloc), frameReg(), "ac1 = mem[reg(fp) + FP_LOCALS_OFFSET - loc]");
             // now ac1 has the base address of array
             // TODO: plus or minus index. depends if the array is global or local in some other function
             // ac = mem[ac1 + index]
@@ -465,8 +505,8 @@ void genExp(TreeNode *tree, int useAddress) // useAddress is used on activation
             emitRM("LD", ac, 0, ac, "ac = mem[ac]");
          } else {
             // local array. we want reg(ac) = mem[fp + LOCALS_FP_OFFSET - loc - index]. index is on ac
-            emitRO("SUB", ac, fp, ac, "ac = fp - index"); // ac = fp - index
-            emitRM("LD", ac, -loc.memloc + FP_LOCALS_OFFSET, ac, "ac = mem[fp + FP_LOCALS_OFFSET - loc - index]");
+            emitRO("SUB", ac, frameReg(), ac, "ac = fp - index"); // ac = fp - index
+            emitRM("LD", ac, frameOffset(-loc.memloc + FP_LOCALS_OFFSET), ac, "ac = mem[fp + FP_LOCALS_OFFSET - loc - index]");
          }
       }
 
@@ -513,12 +553,18 @@ static void genDecl(TreeNode *tree)
       if (isFirstFunction) funcMap[numFunctions-1].startAddr = emitSkip(0) + 1; 
       else funcMap[numFunctions-1].startAddr = emitSkip(0); 
       funcMap[numFunctions-1].sizeOfVars = st_scope_lookup(tree->attr.name)->sizeOfVariables;
+      isMainFunction = !strcmp(tree->attr.name, "main");
+      leafFunction = !callsFunction(tree->child[1]);
+      frameSize = funcMap[numFunctions-1].sizeOfVars;
+      tmpOffset = 0;
+      numReturns = 0;
+      // the last statement that runs: the first return of the body, or its end
+      for (lastStmt = tree->child[1]; lastStmt != NULL && lastStmt->sibling != NULL; lastStmt = lastStmt->sibling)
+         if (lastStmt->nodekind == StmtK && lastStmt->kind.stmt == ReturnK) break;
       if (isFirstFunction)
       {
          if (!strcmp(tree->attr.name, "main"))
          { // main is first function
-            // gen main prologue
-            genMainPrologue(tree);
          }
          else
          { // regular function is first
@@ -535,19 +581,23 @@ static void genDecl(TreeNode *tree)
             emitBackup(savedMainJumpLoc);
             emitRM_Abs("LDA", PC, savedLoc, "Unconditional relative jmp to main");
             emitRestore();
-            // gen main prologue
-            genMainPrologue(tree);
-
          }
          else
          { // regular function
             // do something if needed
          }
       }
+      genEntry();
       // gen code
       cGen(tree->child[1]);
-      // write epilogue to end. Main doesn't need it
-      if (strcmp(tree->attr.name, "main")) genEpilogue(tree);
+      // the returns jump to the end. Main doesn't need an epilogue, the HALT comes next
+      savedLoc = emitSkip(0);
+      for (int i = 0; i < numReturns; i++) {
+         emitBackup(returnLocs[i]);
+         emitRM_Abs("LDA", PC, savedLoc, "return: jmp to epilogue");
+      }
+      if (numReturns > 0) emitRestore();
+      if (!isMainFunction) genEpilogue();
        if (TraceCode)
          emitComment("<- FunK");
       break;
@@ -556,6 +606,22 @@ static void genDecl(TreeNode *tree)
    }
 }
 
+/* Procedure skipScopes walks the scopes of a tree
+ * that generates no code, so the scopes after it
+ * keep the names the analyzer gave them
+ */
+static void skipScopes(TreeNode *tree)
+{
+   int i;
+   for (; tree != NULL; tree = tree->sibling)
+   {
+      preProcScope(tree, 0);
+      for (i = 0; i < MAXCHILDREN; i++)
+         skipScopes(tree->child[i]);
+      postProcScope(tree);
+   }
+}
+
 /* Procedure cGen recursively generates code by
  * tree traversal
  */
@@ -579,7 +645,11 @@ static void cGen(TreeNode *tree)
          break;
       }
       postProcScope(tree);
-      cGen(tree->sibling);
+      // nothing after a return runs
+      if (tree->nodekind == StmtK && tree->kind.stmt == ReturnK)
+         skipScopes(tree->sibling);
+      else
+         cGen(tree->sibling);
    }
 }
 
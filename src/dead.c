@@ -0,0 +1,452 @@
+/****************************************************/
+/* File: dead.c                                     */
+/* Dead stores and dead loops of SSA form: stores  */
+/* that no load reads, and counted loops whose     */
+/* work nothing after them uses; dead definitions  */
+/* of temps once out of SSA form                    */
+/****************************************************/
+
+#include <limits.h>
+#include "globals.h"
+#include "ir.h"
+#include "cfg.h"
+#include "opt.h"
+
+static IrCfg *cfg;
+static IrFunc *fn;
+static IrIns **defOf;  /* by temp, NULL for none */
+static int *defBlock; /* by temp, -1 for none */
+static char *reached; /* by block, through the branches not decided against */
+
+static void findDefs(void)
+{
+  IrIns *ins;
+  int t, b;
+  defOf = (IrIns **)malloc((fn->ntemps + 1) * sizeof(IrIns *));
+  defBlock = (int *)malloc((fn->ntemps + 1) * sizeof(int));
+  for (t = 0; t < fn->ntemps; t++)
+  {
+    defOf[t] = NULL;
+    defBlock[t] = -1;
+  }
+  for (b = 0; b < cfg->nblocks; b++)
+    for (ins = cfg->blocks[b].first;; ins = ins->next)
+    {
+      if (ins->dst >= 0)
+      {
+        defOf[ins->dst] = ins;
+        defBlock[ins->dst] = b;
+      }
+      if (ins == cfg->blocks[b].last)
+        break;
+    }
+}
+
+/**************************************************/
+/***********   Dead stores             ************/
+/**************************************************/
+
+/* Procedure transfer takes the words that are
+ * live after ins to the ones live before it. A
+ * call may read every global and so may whoever
+ * a function returns to, but main, whose return
+ * stops TM. With kill set, stores to dead words
+ * become irNOPs on the way.
+ */
+static void transfer(IrIns *ins, char *live, int kill)
+{
+  int s;
+  switch (ins->op)
+  {
+  case irLOAD:
+    live[ins->slot] = TRUE;
+    break;
+  case irSTORE:
+    if (!live[ins->slot] && kill)
+      irNop(ins);
+    live[ins->slot] = FALSE;
+    break;
+  case irCALL:
+    for (s = 0; s < fn->nslots; s++)
+      if (fn->slots[s].kind == slGLOBAL)
+        live[s] = TRUE;
+    break;
+  case irRET:
+    for (s = 0; s < fn->nslots; s++)
+      live[s] = fn->slots[s].kind == slGLOBAL && !fn->isMain;
+    break;
+  default:
+    break;
+  }
+}
+
+/* Procedure scalarStores runs the liveness of the
+ * words read by irLOAD backwards over the CFG and
+ * removes the stores to words dead after them
+ */
+static void scalarStores(void)
+{
+  int n = fn->nslots + 1, changed = TRUE, b, i, j, s;
+  char *liveIn = (char *)calloc(cfg->nblocks * n, 1);
+  char *live = (char *)malloc(n);
+  IrBlock *blk;
+  IrIns *ins;
+  while (changed)
+  {
+    changed = FALSE;
+    for (i = cfg->norder - 1; i >= 0; i--)
+    {
+      b = cfg->order[i];
+      blk = &cfg->blocks[b];
+      memset(live, 0, n);
+      for (j = 0; j < blk->nsucc; j++)
+        for (s = 0; s < fn->nslots; s++)
+          live[s] |= liveIn[blk->succ[j] * n + s];
+      for (ins = blk->last;; ins = ins->prev)
+      {
+        transfer(ins, live, FALSE);
+        if (ins == blk->first)
+          break;
+      }
+      if (memcmp(live, &liveIn[b * n], fn->nslots) != 0)
+      {
+        memcpy(&liveIn[b * n], live, fn->nslots);
+        changed = TRUE;
+      }
+    }
+  }
+  for (i = 0; i < cfg->norder; i++)
+  {
+    blk = &cfg->blocks[cfg->order[i]];
+    memset(live, 0, n);
+    for (j = 0; j < blk->nsucc; j++)
+      for (s = 0; s < fn->nslots; s++)
+        live[s] |= liveIn[blk->succ[j] * n + s];
+    for (ins = blk->last;; ins = ins->prev)
+    {
+      transfer(ins, live, TRUE);
+      if (ins == blk->first)
+        break;
+    }
+  }
+  free(liveIn);
+  free(live);
+}
+
+/* Function writeOnly tells if the local array s
+ * is only ever written: every temp holding an
+ * address in it, the address itself, the same
+ * plus an offset or merged by a phi, is only
+ * stepped, compared or the base of irSTI.
+ * Marked temps are those addresses.
+ */
+static int writeOnly(int s, char *marked)
+{
+  IrIns *ins;
+  IrArg *arg;
+  int changed = TRUE, i, from;
+  memset(marked, 0, fn->ntemps + 1);
+  while (changed)
+  {
+    changed = FALSE;
+    for (ins = fn->first; ins != NULL; ins = ins->next)
+    {
+      if (ins->dst < 0 || marked[ins->dst])
+        continue;
+      from = ins->op == irADDR && ins->slot == s;
+      if (ins->op == irADD || ins->op == irSUB || ins->op == irMOVE || ins->op == irPHI)
+        for (i = 0; (arg = irOperand(ins, i)) != NULL; i++)
+          if (arg->kind == argTEMP && marked[arg->val])
+            from = TRUE;
+      if (from)
+        marked[ins->dst] = changed = TRUE;
+    }
+  }
+  for (ins = fn->first; ins != NULL; ins = ins->next)
+    for (i = 0; (arg = irOperand(ins, i)) != NULL; i++)
+    {
+      if (arg->kind != argTEMP || !marked[arg->val])
+        continue;
+      if ((ins->op == irSTI && arg == &ins->a) || ins->op == irBR || irIsRelation(ins->op) ||
+          ins->op == irADD || ins->op == irSUB || ins->op == irMOVE || ins->op == irPHI)
+        continue;
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/* Procedure arrayStores removes the stores to the
+ * local arrays that nothing reads
+ */
+static void arrayStores(void)
+{
+  char *marked = (char *)malloc(fn->ntemps + 1);
+  IrIns *ins;
+  int s;
+  for (s = 0; s < fn->nslots; s++)
+  {
+    if (fn->slots[s].kind != slLOCAL || !fn->slots[s].isArray || !writeOnly(s, marked))
+      continue;
+    for (ins = fn->first; ins != NULL; ins = ins->next)
+      if (ins->op == irSTI && ins->a.kind == argTEMP && marked[ins->a.val])
+        irNop(ins);
+  }
+  free(marked);
+}
+
+void deadStores(IrCfg *g)
+{
+  cfg = g;
+  fn = g->func;
+  scalarStores();
+  arrayStores();
+}
+
+/**************************************************/
+/***********   Dead loops              ************/
+/**************************************************/
+
+/* TRUE if ins is t plus or minus a constant */
+static int stepsFrom(IrIns *ins, int t)
+{
+  return ins != NULL && (ins->op == irADD || ins->op == irSUB) && ins->a.kind == argTEMP &&
+         ins->a.val == t && ins->b.kind == argCONST && ins->b.val != 0;
+}
+
+/* Function follows tells if control can go from
+ * block b to its successor s: b is reached and no
+ * decided branch rules the edge out
+ */
+static int follows(int b, int s)
+{
+  IrIns *br = cfg->blocks[b].last;
+  int value;
+  if (!reached[b])
+    return FALSE;
+  if (cfg->blocks[b].nsucc < 2 || br->op != irBR || br->a.kind != argCONST ||
+      br->b.kind != argCONST || !irFold(br->rel, br->a.val, br->b.val, &value))
+    return TRUE;
+  return value ? s == cfg->labelBlock[br->label] : s != cfg->labelBlock[br->label];
+}
+
+static void findReached(void)
+{
+  int changed = TRUE, i, j, b, s;
+  memset(reached, 0, cfg->nblocks + 1);
+  reached[0] = TRUE;
+  while (changed)
+  {
+    changed = FALSE;
+    for (i = 0; i < cfg->norder; i++)
+    {
+      b = cfg->order[i];
+      for (j = 0; j < cfg->blocks[b].nsucc; j++)
+      {
+        s = cfg->blocks[b].succ[j];
+        if (!reached[s] && follows(b, s))
+          reached[s] = changed = TRUE;
+      }
+    }
+  }
+}
+
+/* Function stepOf tells if x is a counter of loop
+ * l, a header phi stepped by a constant on every
+ * back edge, or its stepped value; the step goes
+ * to step
+ */
+
+static int stepOf(IrLoop *l, IrArg x, int *step)
+{
+  IrBlock *h = &cfg->blocks[l->header];
+  IrIns *phi, *inc = NULL;
+  int j;
+  if (x.kind != argTEMP || defOf[x.val] == NULL)
+    return FALSE;
+  phi = defOf[x.val];
+  if (phi->op != irPHI && phi->a.kind == argTEMP && stepsFrom(phi, phi->a.val))
+    phi = defOf[phi->a.val];
+  if (phi == NULL || phi->op != irPHI || defBlock[phi->dst] != l->header)
+    return FALSE;
+  for (j = 0; j < phi->nargs; j++)
+  {
+    if (!l->body[h->pred[j]])
+      continue;
+    if (phi->args[j].kind != argTEMP || (inc != NULL && inc->dst != phi->args[j].val))
+      return FALSE;
+    inc = defOf[phi->args[j].val];
+    if (!stepsFrom(inc, phi->dst))
+      return FALSE;
+  }
+  if (inc == NULL || (x.val != phi->dst && x.val != inc->dst))
+    return FALSE;
+  *step = inc->op == irADD ? inc->b.val : -inc->b.val;
+  return TRUE;
+}
+
+/* Function ends tells if a counter stepping by
+ * step from anywhere reaches a value where rel
+ * bound holds, wrapping around as TM does
+ */
+static int ends(IrOp rel, IrArg bound, int step)
+{
+  long b = bound.val, room;
+  if (rel == irEQ)
+    return step == 1 || step == -1;
+  /* going down is going up with the signs turned */
+  if (step < 0)
+  {
+    rel = rel == irLT ? irGT : rel == irLE ? irGE : irEQ;
+    b = -b;
+    step = -step;
+  }
+  if (rel != irGT && rel != irGE)
+    return FALSE;
+  if (bound.kind != argCONST)
+    return step == 1 && rel == irGE;
+  /* the values it holds for, from b up: a counter
+   * stepping past the top passes one of them
+   */
+  room = (long)INT_MAX - b + (rel == irGE);
+  return room >= step;
+}
+
+/* Function deadLoop tells if loop l does nothing
+ * that can be seen: no effects, no value used after
+ * it, and a single way out, on a counter test that
+ * is sure to come true and that every trip passes.
+ * The loops l holds must be dead already, and the
+ * blocks that decided branches cut off do not
+ * count. The test is then decided.
+ */
+static int deadLoop(int i, char *dead)
+{
+  IrLoop *l = &cfg->loops[i];
+  IrBlock *h = &cfg->blocks[l->header];
+  IrIns *ins, *br = NULL;
+  IrArg *arg, counter, bound;
+  IrOp rel;
+  int b, j, exits = 0, out = -1, step;
+  for (j = 0; j < cfg->nloops; j++)
+    if (cfg->loops[j].parent == i && !dead[j])
+      return FALSE;
+  for (b = 0; b < cfg->nblocks; b++)
+  {
+    if (!reached[b])
+      continue;
+    for (ins = cfg->blocks[b].first;; ins = ins->next)
+    {
+      if (l->body[b] && irHasEffect(ins) && ins->op != irLABEL && ins->op != irJUMP && ins->op != irBR)
+        return FALSE;
+      if (!l->body[b])
+        for (j = 0; (arg = irOperand(ins, j)) != NULL; j++)
+          if (arg->kind == argTEMP && defBlock[arg->val] >= 0 && l->body[defBlock[arg->val]])
+            return FALSE;
+      if (ins == cfg->blocks[b].last)
+        break;
+    }
+    if (l->body[b])
+      for (j = 0; j < cfg->blocks[b].nsucc; j++)
+        if (!l->body[cfg->blocks[b].succ[j]] && follows(b, cfg->blocks[b].succ[j]))
+        {
+          exits++;
+          out = b;
+          br = cfg->blocks[b].last;
+        }
+  }
+  if (exits != 1 || br->op != irBR)
+    return FALSE;
+  for (j = 0; j < h->npred; j++)
+    if (l->body[h->pred[j]] && follows(h->pred[j], l->header) && !cfgDominates(cfg, out, h->pred[j]))
+      return FALSE;
+  counter = br->a;
+  bound = br->b;
+  rel = br->rel;
+  if (!stepOf(l, counter, &step))
+  {
+    counter = br->b;
+    bound = br->a;
+    rel = irSwap(rel);
+    if (!stepOf(l, counter, &step))
+      return FALSE;
+  }
+  if (bound.kind == argTEMP && defBlock[bound.val] >= 0 && l->body[defBlock[bound.val]])
+    return FALSE;
+  /* the relation that holds on the way out */
+  if (l->body[cfg->labelBlock[br->label]])
+    rel = irNegate(rel);
+  if (!ends(rel, bound, step))
+    return FALSE;
+  br->a = br->b = irConst(0);
+  br->rel = l->body[cfg->labelBlock[br->label]] ? irNE : irEQ;
+  return TRUE;
+}
+
+void deadLoops(IrCfg *g)
+{
+  char *dead = (char *)calloc(g->nloops + 1, 1);
+  int i;
+  cfg = g;
+  fn = g->func;
+  findDefs();
+  reached = (char *)malloc(g->nblocks + 1);
+  findReached();
+  /* inner loops first: an outer loop holding only dead ones may die too */
+  for (i = g->nloops - 1; i >= 0; i--)
+    if ((dead[i] = deadLoop(i, dead)))
+      findReached();
+  free(defOf);
+  free(defBlock);
+  free(reached);
+  free(dead);
+}
+
+/**************************************************/
+/***********   Dead definitions        ************/
+/**************************************************/
+
+/* Function deadDefsOnce removes the definitions
+ * of temps dead right after them, block by block
+ * from the liveness of the temps
+ */
+static int deadDefsOnce(IrFunc *f)
+{
+  IrCfg *g = cfgBuild(f);
+  unsigned *live;
+  IrIns *ins;
+  IrArg *arg;
+  int b, j, changed = FALSE;
+  cfgLiveness(g);
+  live = (unsigned *)malloc((g->words + 1) * sizeof(unsigned));
+  for (b = 0; b < g->nblocks; b++)
+  {
+    memcpy(live, g->blocks[b].liveOut, g->words * sizeof(unsigned));
+    for (ins = g->blocks[b].last;; ins = ins->prev)
+    {
+      if (ins->dst >= 0 && !irHasEffect(ins) && !cfgLive(live, ins->dst))
+      {
+        irNop(ins);
+        changed = TRUE;
+      }
+      else
+      {
+        if (ins->dst >= 0)
+          cfgSetLive(live, ins->dst, FALSE);
+        for (j = 0; (arg = irOperand(ins, j)) != NULL; j++)
+          if (arg->kind == argTEMP)
+            cfgSetLive(live, arg->val, TRUE);
+      }
+      if (ins == g->blocks[b].first)
+        break;
+    }
+  }
+  free(live);
+  cfgFree(g);
+  return changed;
+}
+
+void deadDefs(IrFunc *f)
+{
+  while (f->first != NULL && deadDefsOnce(f))
+    ;
+}
@@ -151,6 +151,18 @@ extern int TraceAnalyze;
  */
 extern int TraceCode;
 
+/* TraceIR = TRUE causes the three-address IR to be
+ * written to the TM code file as comments
+ */
+extern int TraceIR;
+
+/* OptLevel selects the code generator: below 0 it
+ * works straight from the syntax tree (cgen.c), 0
+ * goes through the IR (ir.c, lower.c) and 1 also
+ * runs the IR optimization passes
+ */
+extern int OptLevel;
+
 /* Error = TRUE prevents further passes if an error occurs */
 extern int Error;
 #endif
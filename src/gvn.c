@@ -0,0 +1,368 @@
+/****************************************************/
+/* File: gvn.c                                      */
+/* Value numbering over the dominator tree of an   */
+/* IR function in SSA form: redundant arithmetic,  */
+/* addresses and loads are replaced by the value   */
+/* computed before                                  */
+/****************************************************/
+
+#include "globals.h"
+#include "ir.h"
+#include "cfg.h"
+#include "opt.h"
+
+#define BUCKETS 211
+
+/* an expression and the value that holds it */
+typedef struct
+{
+  IrOp op;
+  IrArg a, b;
+  int slot, off;
+  int epoch; /* state of memory, for loads */
+  IrArg value;
+  int next;  /* in the bucket */
+} Entry;
+
+static IrCfg *cfg;
+static IrArg *repl;   /* value of each removed temp */
+static IrArg *addBase; /* temp t is addBase[t] + addOff[t] */
+static int *addOff;
+static int bucket[BUCKETS];
+static Entry *table;
+static int nEntries, maxEntries;
+static int *endEpoch; /* by block */
+static int nextEpoch;
+
+static IrArg resolve(IrArg a)
+{
+  while (a.kind == argTEMP && repl[a.val].kind != argNONE)
+    a = repl[a.val];
+  return a;
+}
+
+static int sameArg(IrArg x, IrArg y)
+{
+  return x.kind == y.kind && x.val == y.val;
+}
+
+/* Function before orders operands: temps first,
+ * then by number
+ */
+static int before(IrArg x, IrArg y)
+{
+  if (x.kind != y.kind)
+    return x.kind == argTEMP;
+  return x.val < y.val;
+}
+
+/* Procedure normalize puts commutative operations
+ * and relations in one form, so that a + b meets
+ * b + a and a < b meets b > a
+ */
+static void normalize(Entry *e)
+{
+  IrArg t;
+  if (!before(e->b, e->a))
+    return;
+  switch (e->op)
+  {
+  case irADD:
+  case irMUL:
+  case irEQ:
+  case irNE:
+    break;
+  case irLT:
+  case irLE:
+  case irGT:
+  case irGE:
+    e->op = irSwap(e->op);
+    break;
+  default:
+    return;
+  }
+  t = e->a;
+  e->a = e->b;
+  e->b = t;
+}
+
+static int hash(Entry *e)
+{
+  unsigned h = e->op;
+  h = h * 31 + e->a.kind * 7 + (unsigned)e->a.val;
+  h = h * 31 + e->b.kind * 7 + (unsigned)e->b.val;
+  h = h * 31 + (unsigned)e->slot;
+  h = h * 31 + (unsigned)e->off;
+  h = h * 31 + (unsigned)e->epoch;
+  return h % BUCKETS;
+}
+
+static Entry *lookup(Entry *e)
+{
+  int i;
+  for (i = bucket[hash(e)]; i >= 0; i = table[i].next)
+    if (table[i].op == e->op && sameArg(table[i].a, e->a) && sameArg(table[i].b, e->b) &&
+        table[i].slot == e->slot && table[i].off == e->off && table[i].epoch == e->epoch)
+      return &table[i];
+  return NULL;
+}
+
+static void insert(Entry *e, IrArg value)
+{
+  int h = hash(e);
+  if (nEntries == maxEntries)
+  {
+    maxEntries = maxEntries ? 2 * maxEntries : 64;
+    table = (Entry *)realloc(table, maxEntries * sizeof(Entry));
+  }
+  table[nEntries] = *e;
+  table[nEntries].value = value;
+  table[nEntries].next = bucket[h];
+  bucket[h] = nEntries++;
+}
+
+/* entries are taken out in the reverse order they
+ * went in, so each one is the head of its bucket
+ */
+static void popTo(int n)
+{
+  while (nEntries > n)
+  {
+    nEntries--;
+    bucket[hash(&table[nEntries])] = table[nEntries].next;
+  }
+}
+
+/* Function keyOf builds the expression computed
+ * by ins; FALSE when ins computes no reusable value
+ */
+static int keyOf(IrIns *ins, int epoch, Entry *e)
+{
+  memset(e, 0, sizeof(Entry));
+  e->op = ins->op;
+  e->slot = -1;
+  if (ins->dst < 0)
+    return FALSE;
+  if (irIsBinary(ins->op))
+  {
+    e->a = ins->a;
+    e->b = ins->b;
+    normalize(e);
+    return TRUE;
+  }
+  switch (ins->op)
+  {
+  case irADDR:
+    e->slot = ins->slot;
+    return TRUE;
+  case irLOAD:
+    e->slot = ins->slot;
+    e->epoch = epoch;
+    return TRUE;
+  case irLDI:
+    e->a = ins->a;
+    e->off = ins->off;
+    e->epoch = epoch;
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+/* Function identity finds the value of x + 0,
+ * x - 0, x * 1, x * 0 and x / 1
+ */
+static int identity(IrIns *ins, IrArg *v)
+{
+  IrArg x = ins->a, c = ins->b;
+  if ((ins->op == irADD || ins->op == irMUL) && x.kind == argCONST)
+  {
+    x = ins->b;
+    c = ins->a;
+  }
+  if (c.kind != argCONST)
+    return FALSE;
+  if (((ins->op == irADD || ins->op == irSUB) && c.val == 0) ||
+      ((ins->op == irMUL || ins->op == irDIV) && c.val == 1))
+  {
+    *v = x;
+    return TRUE;
+  }
+  if (ins->op == irMUL && c.val == 0)
+  {
+    *v = irConst(0);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* Procedure offsets records the temps that are a
+ * temp plus a constant, and lets array accesses
+ * through them use the offset of irLDI and irSTI
+ */
+static void offsets(IrIns *ins)
+{
+  if ((ins->op == irLDI || ins->op == irSTI) && ins->a.kind == argTEMP &&
+      addBase[ins->a.val].kind != argNONE)
+  {
+    ins->off += addOff[ins->a.val];
+    ins->a = addBase[ins->a.val];
+  }
+  else if (ins->op == irADD && ins->a.kind == argTEMP && ins->b.kind == argCONST)
+  {
+    addBase[ins->dst] = ins->a;
+    addOff[ins->dst] = ins->b.val;
+  }
+  else if (ins->op == irADD && ins->b.kind == argTEMP && ins->a.kind == argCONST)
+  {
+    addBase[ins->dst] = ins->b;
+    addOff[ins->dst] = ins->a.val;
+  }
+  else if (ins->op == irSUB && ins->a.kind == argTEMP && ins->b.kind == argCONST)
+  {
+    addBase[ins->dst] = ins->a;
+    addOff[ins->dst] = -ins->b.val;
+  }
+  else
+    return;
+  /* a base that is itself a temp plus a constant */
+  if (ins->op != irLDI && ins->op != irSTI && addBase[addBase[ins->dst].val].kind != argNONE)
+  {
+    addOff[ins->dst] += addOff[addBase[ins->dst].val];
+    addBase[ins->dst] = addBase[addBase[ins->dst].val];
+  }
+}
+
+/* Function samePhi gives the value of a phi whose
+ * operands, itself aside, are all one value
+ */
+static IrArg samePhi(IrIns *ins)
+{
+  IrArg v = irNone, x;
+  int j;
+  for (j = 0; j < ins->nargs; j++)
+  {
+    if (ins->args[j].kind == argNONE)
+      continue;
+    x = resolve(ins->args[j]);
+    if (x.kind == argTEMP && x.val == ins->dst)
+      continue;
+    if (v.kind != argNONE && !sameArg(v, x))
+      return irNone;
+    v = x;
+  }
+  return v;
+}
+
+/* Procedure number walks the dominator tree from
+ * block b with the expressions of the blocks that
+ * dominate it in the table. Memory changes at
+ * every store and call; a block entered from more
+ * than one place starts from an unknown state.
+ */
+static void number(int b)
+{
+  IrBlock *blk = &cfg->blocks[b];
+  int saved = nEntries, epoch, i;
+  IrIns *ins;
+  IrArg *arg, v;
+  Entry e, *found;
+  epoch = blk->npred == 1 ? endEpoch[blk->pred[0]] : nextEpoch++;
+  for (ins = blk->first;; ins = ins->next)
+  {
+    if (ins->op == irPHI)
+    {
+      v = samePhi(ins);
+      if (v.kind != argNONE)
+      {
+        repl[ins->dst] = v;
+        irNop(ins);
+      }
+    }
+    else
+    {
+      for (i = 0; (arg = irOperand(ins, i)) != NULL; i++)
+        *arg = resolve(*arg);
+      offsets(ins);
+      if (ins->op == irMOVE && ins->dst >= 0)
+      {
+        repl[ins->dst] = ins->a;
+        irNop(ins);
+      }
+      else if (irIsBinary(ins->op) && identity(ins, &v))
+      {
+        repl[ins->dst] = v;
+        irNop(ins);
+      }
+      else if (keyOf(ins, epoch, &e))
+      {
+        if ((found = lookup(&e)) != NULL)
+        {
+          repl[ins->dst] = found->value;
+          irNop(ins);
+        }
+        else
+          insert(&e, irTemp(ins->dst));
+      }
+      else if (ins->op == irCALL || ins->op == irSTI || ins->op == irSTORE)
+      {
+        epoch = nextEpoch++;
+        /* what was stored is what a load would read */
+        if (ins->op == irSTI)
+        {
+          memset(&e, 0, sizeof(Entry));
+          e.op = irLDI;
+          e.a = ins->a;
+          e.off = ins->off;
+          e.slot = -1;
+          e.epoch = epoch;
+          insert(&e, ins->b);
+        }
+        else if (ins->op == irSTORE)
+        {
+          memset(&e, 0, sizeof(Entry));
+          e.op = irLOAD;
+          e.slot = ins->slot;
+          e.epoch = epoch;
+          insert(&e, ins->a);
+        }
+      }
+    }
+    if (ins == blk->last)
+      break;
+  }
+  endEpoch[b] = epoch;
+  for (i = 0; i < blk->nkids; i++)
+    number(blk->kids[i]);
+  popTo(saved);
+}
+
+void gvn(IrCfg *g)
+{
+  int n = g->func->ntemps, t, i;
+  IrIns *ins;
+  IrArg *arg;
+  cfg = g;
+  repl = (IrArg *)malloc((n + 1) * sizeof(IrArg));
+  addBase = (IrArg *)malloc((n + 1) * sizeof(IrArg));
+  addOff = (int *)calloc(n + 1, sizeof(int));
+  for (t = 0; t < n; t++)
+    repl[t] = addBase[t] = irNone;
+  for (i = 0; i < BUCKETS; i++)
+    bucket[i] = -1;
+  endEpoch = (int *)calloc(cfg->nblocks + 1, sizeof(int));
+  nEntries = 0;
+  nextEpoch = 0;
+  number(0);
+  /* phis read values of blocks walked after them */
+  for (ins = g->func->first; ins != NULL; ins = ins->next)
+    for (i = 0; (arg = irOperand(ins, i)) != NULL; i++)
+      *arg = resolve(*arg);
+  free(repl);
+  free(addBase);
+  free(addOff);
+  free(endEpoch);
+  free(table);
+  table = NULL;
+  maxEntries = 0;
+}
@@ -0,0 +1,227 @@
+/****************************************************/
+/* File: inline.c                                   */
+/* Inlining: the bodies of small functions and of  */
+/* functions called from one place replace their   */
+/* calls, and the functions left without calls go  */
+/****************************************************/
+
+#include "globals.h"
+#include "ir.h"
+#include "opt.h"
+
+/* IR instructions of a function inlined at every call */
+#define INLINE_SMALL 12
+/* IR instructions the program may grow to by inlining;
+ * at two or three TM instructions each, about the
+ * 1024 words of TM instruction memory
+ */
+#define INLINE_BUDGET 400
+
+static IrProgram *prog;
+static int *sites; /* calls of each function */
+
+static int size(IrFunc *f)
+{
+  IrIns *ins;
+  int n = 0;
+  for (ins = f->first; ins != NULL; ins = ins->next)
+    if (ins->op != irLABEL && ins->op != irNOP)
+      n++;
+  return n;
+}
+
+static void countSites(void)
+{
+  IrIns *ins;
+  int i;
+  for (i = 0; i < prog->nfuncs; i++)
+    sites[i] = 0;
+  for (i = 0; i < prog->nfuncs; i++)
+    for (ins = prog->funcs[i]->first; ins != NULL; ins = ins->next)
+      if (ins->op == irCALL && ins->callee >= 0)
+        sites[ins->callee]++;
+}
+
+static int recursive(int i)
+{
+  IrIns *ins;
+  for (ins = prog->funcs[i]->first; ins != NULL; ins = ins->next)
+    if (ins->op == irCALL && ins->callee == i)
+      return TRUE;
+  return FALSE;
+}
+
+/* Function mapSlot gives the slot of the caller f
+ * for slot s of the callee g. The params and locals
+ * of g become locals of f at base onwards; an array
+ * param becomes the word holding the address.
+ */
+static int mapSlot(IrFunc *f, IrFunc *g, int s, int base)
+{
+  IrSlot *slot = &g->slots[s];
+  if (slot->kind == slGLOBAL)
+    return irAddSlot(f, slot->name, slGLOBAL, slot->memloc, slot->size, slot->isArray);
+  return irAddSlot(f, slot->name, slLOCAL, base + slot->memloc, slot->size,
+                   slot->kind == slPARAM ? FALSE : slot->isArray);
+}
+
+static IrArg mapArg(IrArg a, int tbase)
+{
+  if (a.kind == argTEMP)
+    a.val += tbase;
+  return a;
+}
+
+/* Procedure inlineCall replaces call, in f, by a
+ * copy of the body of the callee working on the
+ * frame words of f from base. The arguments are
+ * stored in the params, every return stores its
+ * value in the word after the callee's variables
+ * and jumps past the copy, where the result is
+ * loaded.
+ */
+static void inlineCall(IrFunc *f, IrIns *call, int base)
+{
+  IrFunc *g = prog->funcs[call->callee];
+  int tbase = f->ntemps, lbase = f->nlabels, end, result, i;
+  IrIns *ins, *copy;
+  f->ntemps += g->ntemps;
+  f->nlabels += g->nlabels;
+  end = irNewLabel(f);
+  result = irAddSlot(f, g->name, slLOCAL, base + g->frameSize, 1, FALSE);
+  for (i = 0; i < g->nparams && i < call->nargs; i++)
+  {
+    copy = irNewIns(irSTORE);
+    copy->slot = mapSlot(f, g, i, base);
+    copy->a = call->args[i];
+    copy->lineno = call->lineno;
+    irInsertBefore(f, call, copy);
+  }
+  for (ins = g->first; ins != NULL; ins = ins->next)
+  {
+    if (ins->op == irRET)
+    {
+      if (call->dst >= 0 && ins->a.kind != argNONE)
+      {
+        copy = irNewIns(irSTORE);
+        copy->slot = result;
+        copy->a = mapArg(ins->a, tbase);
+        copy->lineno = ins->lineno;
+        irInsertBefore(f, call, copy);
+      }
+      copy = irNewIns(irJUMP);
+      copy->label = end;
+    }
+    else
+    {
+      copy = irNewIns(ins->op);
+      *copy = *ins;
+      copy->prev = copy->next = NULL;
+      if (copy->dst >= 0)
+        copy->dst += tbase;
+      copy->a = mapArg(ins->a, tbase);
+      copy->b = mapArg(ins->b, tbase);
+      if (ins->nargs > 0)
+      {
+        copy->args = (IrArg *)malloc(ins->nargs * sizeof(IrArg));
+        for (i = 0; i < ins->nargs; i++)
+          copy->args[i] = mapArg(ins->args[i], tbase);
+      }
+      if (ins->slot >= 0)
+        copy->slot = mapSlot(f, g, ins->slot, base);
+      if (ins->op == irLABEL || ins->op == irJUMP || ins->op == irBR)
+        copy->label += lbase;
+    }
+    copy->lineno = ins->lineno;
+    irInsertBefore(f, call, copy);
+  }
+  copy = irNewIns(irLABEL);
+  copy->label = end;
+  irInsertBefore(f, call, copy);
+  if (call->dst >= 0)
+  {
+    copy = irNewIns(irLOAD);
+    copy->dst = call->dst;
+    copy->slot = result;
+    irInsertBefore(f, call, copy);
+  }
+  irRemove(f, call);
+}
+
+/* Procedure inlineInto inlines the calls of f that
+ * pay: to a function called only here, or to a
+ * small one while the program stays in budget. All
+ * the copies of one callee share its frame words,
+ * as none of them runs while another does.
+ */
+static void inlineInto(int i, int *total)
+{
+  IrFunc *f = prog->funcs[i], *g;
+  IrIns *ins, *next;
+  int *base = (int *)malloc((prog->nfuncs + 1) * sizeof(int)), j, n;
+  for (j = 0; j < prog->nfuncs; j++)
+    base[j] = -1;
+  for (ins = f->first; ins != NULL; ins = next)
+  {
+    next = ins->next;
+    if (ins->op != irCALL || ins->callee < 0 || ins->callee == i || recursive(ins->callee))
+      continue;
+    g = prog->funcs[ins->callee];
+    n = size(g);
+    if (sites[ins->callee] != 1 && (n > INLINE_SMALL || *total + n > INLINE_BUDGET))
+      continue;
+    if (sites[ins->callee] != 1)
+      *total += n;
+    if (base[ins->callee] < 0)
+    {
+      base[ins->callee] = f->frameSize;
+      /* the callee's variables and its result */
+      f->frameSize += g->frameSize + 1;
+    }
+    inlineCall(f, ins, base[ins->callee]);
+  }
+  free(base);
+}
+
+/* Procedure removeUncalled drops the functions
+ * other than main that nothing calls any more
+ */
+static void removeUncalled(void)
+{
+  int *index = (int *)malloc((prog->nfuncs + 1) * sizeof(int)), i, n = 0;
+  IrIns *ins;
+  countSites();
+  for (i = 0; i < prog->nfuncs; i++)
+    if (sites[i] > 0 || i == prog->mainIndex)
+    {
+      index[i] = n;
+      prog->funcs[n++] = prog->funcs[i];
+    }
+  for (i = 0; i < n; i++)
+    for (ins = prog->funcs[i]->first; ins != NULL; ins = ins->next)
+      if (ins->op == irCALL && ins->callee >= 0)
+        ins->callee = index[ins->callee];
+  if (prog->mainIndex >= 0)
+    prog->mainIndex = index[prog->mainIndex];
+  prog->nfuncs = n;
+  free(index);
+}
+
+void irInline(IrProgram *p)
+{
+  int i, total = 0;
+  prog = p;
+  sites = (int *)malloc((p->nfuncs + 1) * sizeof(int));
+  for (i = 0; i < p->nfuncs; i++)
+    total += size(p->funcs[i]);
+  /* a function only calls the ones before it, which
+   * have had their own calls inlined by then
+   */
+  for (i = 0; i < p->nfuncs; i++)
+  {
+    countSites();
+    inlineInto(i, &total);
+  }
+  removeUncalled();
+  free(sites);
+}
@@ -0,0 +1,848 @@
+/****************************************************/
+/* File: ir.c                                       */
+/* Three-address IR of the C- compiler: generation */
+/* from the syntax tree, construction helpers and  */
+/* printing                                         */
+/****************************************************/
+
+#include "globals.h"
+#include "symtab.h"
+#include "analyze.h"
+#include "ir.h"
+#include "cfg.h"
+#include "opt.h"
+#include "lower.h"
+
+const IrArg irNone = {argNONE, 0};
+
+/* program and function being generated */
+static IrProgram *prog;
+static IrFunc *cur;
+
+/* global slots seen so far, copied into the
+ * functions that use them
+ */
+static IrSlot globalSlots[SIZE];
+static int nGlobals = 0;
+
+IrArg irTemp(int t)
+{
+  IrArg a;
+  a.kind = argTEMP;
+  a.val = t;
+  return a;
+}
+
+IrArg irConst(int c)
+{
+  IrArg a;
+  a.kind = argCONST;
+  a.val = c;
+  return a;
+}
+
+int irNewTemp(IrFunc *f)
+{
+  return f->ntemps++;
+}
+
+int irNewLabel(IrFunc *f)
+{
+  return f->nlabels++;
+}
+
+IrIns *irNewIns(IrOp op)
+{
+  IrIns *ins = (IrIns *)calloc(1, sizeof(IrIns));
+  ins->op = op;
+  ins->dst = -1;
+  ins->label = -1;
+  ins->slot = -1;
+  ins->callee = -1;
+  ins->lineno = lineno;
+  return ins;
+}
+
+void irInsertBefore(IrFunc *f, IrIns *pos, IrIns *ins)
+{
+  if (pos == NULL)
+  {
+    ins->prev = f->last;
+    ins->next = NULL;
+    if (f->last != NULL)
+      f->last->next = ins;
+    else
+      f->first = ins;
+    f->last = ins;
+    return;
+  }
+  ins->prev = pos->prev;
+  ins->next = pos;
+  if (pos->prev != NULL)
+    pos->prev->next = ins;
+  else
+    f->first = ins;
+  pos->prev = ins;
+}
+
+void irInsertAfter(IrFunc *f, IrIns *pos, IrIns *ins)
+{
+  if (pos == NULL)
+    irInsertBefore(f, f->first, ins);
+  else if (pos->next == NULL)
+    irInsertBefore(f, NULL, ins);
+  else
+    irInsertBefore(f, pos->next, ins);
+}
+
+void irRemove(IrFunc *f, IrIns *ins)
+{
+  if (ins->prev != NULL)
+    ins->prev->next = ins->next;
+  else
+    f->first = ins->next;
+  if (ins->next != NULL)
+    ins->next->prev = ins->prev;
+  else
+    f->last = ins->prev;
+  free(ins->args);
+  free(ins);
+}
+
+void irNop(IrIns *ins)
+{
+  ins->op = irNOP;
+  ins->dst = -1;
+  ins->a = ins->b = irNone;
+  ins->slot = ins->label = ins->callee = -1;
+  free(ins->args);
+  ins->args = NULL;
+  ins->nargs = 0;
+}
+
+int irFindSlot(IrFunc *f, IrSlotKind kind, int memloc)
+{
+  int i;
+  for (i = 0; i < f->nslots; i++)
+    if (f->slots[i].memloc == memloc && (f->slots[i].kind == slGLOBAL) == (kind == slGLOBAL))
+      return i;
+  return -1;
+}
+
+int irAddSlot(IrFunc *f, char *name, IrSlotKind kind, int memloc, int size, int isArray)
+{
+  int i = irFindSlot(f, kind, memloc);
+  if (i >= 0)
+    return i;
+  if (f->nslots == f->maxSlots)
+  {
+    f->maxSlots = f->maxSlots ? 2 * f->maxSlots : 8;
+    f->slots = (IrSlot *)realloc(f->slots, f->maxSlots * sizeof(IrSlot));
+  }
+  f->slots[f->nslots].name = name;
+  f->slots[f->nslots].kind = kind;
+  f->slots[f->nslots].memloc = memloc;
+  f->slots[f->nslots].size = size;
+  f->slots[f->nslots].isArray = isArray;
+  return f->nslots++;
+}
+
+IrArg *irOperand(IrIns *ins, int i)
+{
+  if (ins->op == irCALL || ins->op == irPHI)
+    return i < ins->nargs ? &ins->args[i] : NULL;
+  if (i == 0)
+    return &ins->a;
+  if (i == 1)
+    return &ins->b;
+  return NULL;
+}
+
+int irIsBinary(IrOp op)
+{
+  return op >= irADD && op <= irNE;
+}
+
+int irIsRelation(IrOp op)
+{
+  return op >= irLT && op <= irNE;
+}
+
+IrOp irNegate(IrOp rel)
+{
+  switch (rel)
+  {
+  case irLT:
+    return irGE;
+  case irLE:
+    return irGT;
+  case irGT:
+    return irLE;
+  case irGE:
+    return irLT;
+  case irEQ:
+    return irNE;
+  default:
+    return irEQ;
+  }
+}
+
+IrOp irSwap(IrOp rel)
+{
+  switch (rel)
+  {
+  case irLT:
+    return irGT;
+  case irLE:
+    return irGE;
+  case irGT:
+    return irLT;
+  case irGE:
+    return irLE;
+  default:
+    return rel;
+  }
+}
+
+int irHasEffect(IrIns *ins)
+{
+  switch (ins->op)
+  {
+  case irSTORE:
+  case irSTI:
+  case irIN:
+  case irOUT:
+  case irCALL:
+  case irRET:
+  case irLABEL:
+  case irJUMP:
+  case irBR:
+    return TRUE;
+  case irDIV:
+    /* TM stops on a division by zero */
+    return ins->b.kind != argCONST || ins->b.val == 0;
+  default:
+    return FALSE;
+  }
+}
+
+int irIsBranch(IrIns *ins)
+{
+  return ins->op == irJUMP || ins->op == irBR || ins->op == irRET;
+}
+
+int irJumpsToNext(IrIns *ins)
+{
+  IrIns *p;
+  for (p = ins->next; p != NULL && (p->op == irLABEL || p->op == irNOP); p = p->next)
+    if (p->op == irLABEL && p->label == ins->label)
+      return TRUE;
+  return FALSE;
+}
+
+/* Relations are decided on the wrapped difference,
+ * as the SUB and conditional jump that TM runs do
+ */
+int irFold(IrOp op, int x, int y, int *result)
+{
+  int diff = (int)((unsigned)x - (unsigned)y);
+  switch (op)
+  {
+  case irADD:
+    *result = (int)((unsigned)x + (unsigned)y);
+    return TRUE;
+  case irSUB:
+    *result = diff;
+    return TRUE;
+  case irMUL:
+    *result = (int)((unsigned)x * (unsigned)y);
+    return TRUE;
+  case irDIV:
+    if (y == 0 || (y == -1 && x == (int)0x80000000))
+      return FALSE;
+    *result = x / y;
+    return TRUE;
+  case irLT:
+    *result = diff < 0;
+    return TRUE;
+  case irLE:
+    *result = diff <= 0;
+    return TRUE;
+  case irGT:
+    *result = diff > 0;
+    return TRUE;
+  case irGE:
+    *result = diff >= 0;
+    return TRUE;
+  case irEQ:
+    *result = diff == 0;
+    return TRUE;
+  case irNE:
+    *result = diff != 0;
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+/**************************************************/
+/***********   IR generation           ************/
+/**************************************************/
+
+static IrIns *emit(IrOp op)
+{
+  IrIns *ins = irNewIns(op);
+  irInsertBefore(cur, NULL, ins);
+  return ins;
+}
+
+static IrArg emitDef(IrOp op, IrArg a, IrArg b)
+{
+  IrIns *ins = emit(op);
+  ins->dst = irNewTemp(cur);
+  ins->a = a;
+  ins->b = b;
+  return irTemp(ins->dst);
+}
+
+static void emitLabel(int label)
+{
+  emit(irLABEL)->label = label;
+}
+
+static void emitJump(int label)
+{
+  emit(irJUMP)->label = label;
+}
+
+static int findFunc(char *name)
+{
+  int i;
+  for (i = 0; i < prog->nfuncs; i++)
+    if (!strcmp(prog->funcs[i]->name, name))
+      return i;
+  return -1;
+}
+
+static IrOp binaryOp(TokenType op)
+{
+  switch (op)
+  {
+  case PLUS:
+    return irADD;
+  case MINUS:
+    return irSUB;
+  case TIMES:
+    return irMUL;
+  case OVER:
+    return irDIV;
+  case LT:
+    return irLT;
+  case LTE:
+    return irLE;
+  case GT:
+    return irGT;
+  case GTE:
+    return irGE;
+  case EQ:
+    return irEQ;
+  case DIFF:
+    return irNE;
+  default:
+    return irNOP;
+  }
+}
+
+/* Function lookup returns where name lives as seen
+ * from scope. A name the symbol table cannot place
+ * stops the compiler: as memloc -1 it would share
+ * one slot with every other such name.
+ */
+static ScopeMemLock lookup(char *scope, char *name)
+{
+  ScopeMemLock loc = st_lookup_memloc(scope, name);
+  if (loc.memloc < 0)
+  {
+    pce("Code generation error at line %d: no storage for '%s' in scope %s\n", lineno, name, scope);
+    exit(1);
+  }
+  return loc;
+}
+
+/* Function slotOf returns the slot of the variable
+ * name as seen from the current scope, adding it
+ * to the current function on first use
+ */
+static int slotOf(char *name)
+{
+  ScopeMemLock loc = lookup(contextStack[contextLevel]->scopeName, name);
+  int i;
+  if (!strcmp(loc.scopeName, GLOBAL_SCOPE))
+  {
+    for (i = 0; i < nGlobals; i++)
+      if (globalSlots[i].memloc == loc.memloc && !strcmp(globalSlots[i].name, name))
+        return irAddSlot(cur, globalSlots[i].name, slGLOBAL, loc.memloc,
+                         globalSlots[i].size, globalSlots[i].isArray);
+    return irAddSlot(cur, name, slGLOBAL, loc.memloc, 1, loc.idType == ArrayK);
+  }
+  i = irFindSlot(cur, loc.isParam ? slPARAM : slLOCAL, loc.memloc);
+  if (i < 0)
+    i = irAddSlot(cur, name, loc.isParam ? slPARAM : slLOCAL, loc.memloc, 1, loc.idType == ArrayK);
+  return i;
+}
+
+/* address of word 0 of the array slot s */
+static IrArg arrayBase(int s)
+{
+  IrIns *ins;
+  if (cur->slots[s].kind == slPARAM)
+    ins = emit(irLOAD);
+  else
+    ins = emit(irADDR);
+  ins->dst = irNewTemp(cur);
+  ins->slot = s;
+  return irTemp(ins->dst);
+}
+
+static IrArg genValue(TreeNode *tree);
+
+static IrArg genAssign(TreeNode *tree)
+{
+  IrArg value = genValue(tree->child[1]);
+  int s = slotOf(tree->attr.name);
+  IrIns *ins;
+  if (tree->child[0] == NULL)
+  {
+    ins = emit(irSTORE);
+    ins->slot = s;
+    ins->a = value;
+  }
+  else
+  {
+    IrArg base = arrayBase(s);
+    IrArg index = genValue(tree->child[0]);
+    IrArg address = emitDef(irADD, base, index);
+    ins = emit(irSTI);
+    ins->a = address;
+    ins->b = value;
+  }
+  return value;
+}
+
+static IrArg genCall(TreeNode *tree)
+{
+  TreeNode *arg;
+  IrIns *ins;
+  IrArg args[64];
+  int n = 0, i;
+  if (!strcmp(tree->attr.name, "input"))
+  {
+    ins = emit(irIN);
+    ins->dst = irNewTemp(cur);
+    return irTemp(ins->dst);
+  }
+  if (!strcmp(tree->attr.name, "output"))
+  {
+    IrArg value = genValue(tree->child[0]);
+    emit(irOUT)->a = value;
+    return irConst(0);
+  }
+  for (arg = tree->child[0]; arg != NULL && n < 64; arg = arg->sibling)
+    args[n++] = genValue(arg);
+  ins = emit(irCALL);
+  ins->callee = findFunc(tree->attr.name);
+  ins->nargs = n;
+  ins->args = (IrArg *)malloc((n ? n : 1) * sizeof(IrArg));
+  for (i = 0; i < n; i++)
+    ins->args[i] = args[i];
+  if (ins->callee >= 0 && prog->funcs[ins->callee]->isVoid)
+    return irConst(0);
+  ins->dst = irNewTemp(cur);
+  return irTemp(ins->dst);
+}
+
+/* Function genValue generates the code of an
+ * expression and returns the operand holding it
+ */
+static IrArg genValue(TreeNode *tree)
+{
+  int s;
+  if (tree->nodekind == StmtK && tree->kind.stmt == AssignK)
+    return genAssign(tree);
+  switch (tree->kind.exp)
+  {
+  case ConstK:
+    return irConst(tree->attr.val);
+  case IdK:
+    s = slotOf(tree->attr.name);
+    if (cur->slots[s].isArray)
+      /* an array passed by reference */
+      return arrayBase(s);
+    else
+    {
+      IrIns *ins = emit(irLOAD);
+      ins->dst = irNewTemp(cur);
+      ins->slot = s;
+      return irTemp(ins->dst);
+    }
+  case ArrayIdK:
+  {
+    IrArg base, index;
+    IrIns *ins;
+    s = slotOf(tree->attr.name);
+    base = arrayBase(s);
+    index = genValue(tree->child[0]);
+    index = emitDef(irADD, base, index);
+    ins = emit(irLDI);
+    ins->a = index;
+    ins->dst = irNewTemp(cur);
+    return irTemp(ins->dst);
+  }
+  case OpK:
+  {
+    IrArg x = genValue(tree->child[0]);
+    IrArg y = genValue(tree->child[1]);
+    return emitDef(binaryOp(tree->attr.op), x, y);
+  }
+  case ActvK:
+    return genCall(tree);
+  default:
+    return irConst(0);
+  }
+}
+
+/* Procedure genCond jumps to label when the
+ * condition tree is false and falls through
+ * when it holds
+ */
+static void genCond(TreeNode *tree, int label)
+{
+  IrIns *ins;
+  IrArg x, y;
+  if (tree->nodekind == ExpK && tree->kind.exp == OpK && irIsRelation(binaryOp(tree->attr.op)))
+  {
+    x = genValue(tree->child[0]);
+    y = genValue(tree->child[1]);
+    ins = emit(irBR);
+    ins->rel = irNegate(binaryOp(tree->attr.op));
+  }
+  else
+  {
+    x = genValue(tree);
+    y = irConst(0);
+    ins = emit(irBR);
+    ins->rel = irEQ;
+  }
+  ins->a = x;
+  ins->b = y;
+  ins->label = label;
+}
+
+static void genList(TreeNode *tree);
+
+static void genStmt(TreeNode *tree)
+{
+  int l1, l2;
+  switch (tree->kind.stmt)
+  {
+  case IfK:
+    l1 = irNewLabel(cur);
+    genCond(tree->child[0], l1);
+    genList(tree->child[1]);
+    if (tree->child[2] != NULL)
+    {
+      l2 = irNewLabel(cur);
+      emitJump(l2);
+      emitLabel(l1);
+      genList(tree->child[2]);
+      emitLabel(l2);
+    }
+    else
+      emitLabel(l1);
+    break;
+  case WhileK:
+    l1 = irNewLabel(cur);
+    l2 = irNewLabel(cur);
+    emitLabel(l1);
+    genCond(tree->child[0], l2);
+    genList(tree->child[1]);
+    emitJump(l1);
+    emitLabel(l2);
+    break;
+  case AssignK:
+    genAssign(tree);
+    break;
+  case ReturnK:
+    if (tree->child[0] != NULL)
+    {
+      IrArg value = genValue(tree->child[0]);
+      emit(irRET)->a = value;
+    }
+    else
+      emit(irRET);
+    break;
+  case BlockK:
+    genList(tree->child[0]);
+    break;
+  default:
+    break;
+  }
+}
+
+/* Procedure genDecl makes the slot of a local
+ * variable declared in the current scope
+ */
+static void genDecl(TreeNode *tree)
+{
+  ScopeMemLock loc;
+  switch (tree->kind.decl)
+  {
+  case VarK:
+  case ArrayK:
+    loc = lookup(contextStack[contextLevel]->scopeName, tree->attr.name);
+    if (tree->kind.decl == ArrayK)
+      irAddSlot(cur, tree->attr.name, slLOCAL, loc.memloc, tree->child[0]->attr.val, TRUE);
+    else
+      irAddSlot(cur, tree->attr.name, slLOCAL, loc.memloc, 1, FALSE);
+    break;
+  default:
+    break;
+  }
+}
+
+/* Procedure genList generates a list of siblings,
+ * keeping the scope stack of analyze.c in step as
+ * cgen.c does
+ */
+static void genList(TreeNode *tree)
+{
+  while (tree != NULL)
+  {
+    preProcScope(tree, 0);
+    lineno = tree->lineno;
+    switch (tree->nodekind)
+    {
+    case StmtK:
+      genStmt(tree);
+      break;
+    case ExpK:
+      genValue(tree);
+      break;
+    case DeclK:
+      genDecl(tree);
+      break;
+    default:
+      break;
+    }
+    postProcScope(tree);
+    tree = tree->sibling;
+  }
+}
+
+static void genFunc(TreeNode *tree)
+{
+  TreeNode *param;
+  ScopeMemLock loc;
+  IrFunc *f = (IrFunc *)calloc(1, sizeof(IrFunc));
+  f->name = tree->attr.name;
+  f->isVoid = tree->type == Void;
+  f->isMain = !strcmp(tree->attr.name, "main");
+  prog->funcs = (IrFunc **)realloc(prog->funcs, (prog->nfuncs + 1) * sizeof(IrFunc *));
+  prog->funcs[prog->nfuncs] = f;
+  if (f->isMain)
+    prog->mainIndex = prog->nfuncs;
+  prog->nfuncs++;
+  cur = f;
+
+  preProcScope(tree, 0);
+  /* read before postProcScope overwrites it */
+  f->frameSize = st_scope_lookup(tree->attr.name)->sizeOfVariables;
+  for (param = tree->child[0]; param != NULL; param = param->sibling)
+  {
+    loc = lookup(contextStack[contextLevel]->scopeName, param->attr.name);
+    irAddSlot(f, param->attr.name, slPARAM, loc.memloc, 1, param->arrayField);
+    f->nparams++;
+  }
+  genList(tree->child[1]);
+  /* falling off the end returns */
+  if (f->last == NULL || f->last->op != irRET)
+    emit(irRET);
+  postProcScope(tree);
+}
+
+IrProgram *irGenerate(TreeNode *syntaxTree)
+{
+  TreeNode *t;
+  ScopeMemLock loc;
+  prog = (IrProgram *)calloc(1, sizeof(IrProgram));
+  prog->mainIndex = -1;
+  for (t = syntaxTree; t != NULL; t = t->sibling)
+  {
+    if (t->nodekind != DeclK)
+      continue;
+    lineno = t->lineno;
+    if (t->kind.decl == FunK)
+      genFunc(t);
+    else if ((t->kind.decl == VarK || t->kind.decl == ArrayK) && nGlobals < SIZE)
+    {
+      loc = lookup(GLOBAL_SCOPE, t->attr.name);
+      globalSlots[nGlobals].name = t->attr.name;
+      globalSlots[nGlobals].kind = slGLOBAL;
+      globalSlots[nGlobals].memloc = loc.memloc;
+      globalSlots[nGlobals].size = t->kind.decl == ArrayK ? t->child[0]->attr.val : 1;
+      globalSlots[nGlobals].isArray = t->kind.decl == ArrayK;
+      nGlobals++;
+    }
+  }
+  return prog;
+}
+
+/**********************************************/
+/* the primary function of the IR back end    */
+/**********************************************/
+void irCodeGen(TreeNode *syntaxTree)
+{
+  IrProgram *p = irGenerate(syntaxTree);
+  int i;
+  if (TraceIR)
+  {
+    irPrintProgram(p, "IR");
+    for (i = 0; i < p->nfuncs; i++)
+    {
+      IrCfg *cfg = cfgBuild(p->funcs[i]);
+      cfgPrint(cfg);
+      cfgFree(cfg);
+    }
+  }
+  if (OptLevel > 0)
+  {
+    irOptimize(p);
+    if (TraceIR)
+      irPrintProgram(p, "optimized IR");
+  }
+  irLower(p);
+}
+
+/**************************************************/
+/***********   Printing                ************/
+/**************************************************/
+
+static char *opNames[] = {
+    "nop", "move", "+", "-", "*", "/", "<", "<=", ">", ">=", "==", "!=",
+    "load", "store", "addr", "ldi", "sti", "in", "out", "call", "ret",
+    "label", "jump", "br", "phi"};
+
+const char *irOpName(IrOp op)
+{
+  return opNames[op];
+}
+
+static char *argString(IrArg a, char *buf)
+{
+  if (a.kind == argTEMP)
+    sprintf(buf, "t%d", a.val);
+  else if (a.kind == argCONST)
+    sprintf(buf, "%d", a.val);
+  else
+    strcpy(buf, "_");
+  return buf;
+}
+
+static char *slotString(IrFunc *f, int s, char *buf)
+{
+  if (s < 0 || s >= f->nslots)
+    strcpy(buf, "?");
+  else if (f->slots[s].kind == slGLOBAL)
+    sprintf(buf, "%s", f->slots[s].name);
+  else
+    sprintf(buf, "%s.%d", f->slots[s].name, f->slots[s].memloc);
+  return buf;
+}
+
+void irPrintIns(IrProgram *p, IrFunc *f, IrIns *ins)
+{
+  char a[32], b[32], s[64];
+  int i;
+  if (ins->op == irLABEL)
+  {
+    pc("*   L%d:\n", ins->label);
+    return;
+  }
+  pc("*     ");
+  if (ins->dst >= 0)
+    pc("t%d = ", ins->dst);
+  argString(ins->a, a);
+  argString(ins->b, b);
+  switch (ins->op)
+  {
+  case irMOVE:
+    pc("%s", a);
+    break;
+  case irLOAD:
+    pc("load %s", slotString(f, ins->slot, s));
+    break;
+  case irSTORE:
+    pc("store %s = %s", slotString(f, ins->slot, s), a);
+    break;
+  case irADDR:
+    pc("&%s", slotString(f, ins->slot, s));
+    break;
+  case irLDI:
+    pc("[%s%+d]", a, ins->off);
+    break;
+  case irSTI:
+    pc("[%s%+d] = %s", a, ins->off, b);
+    break;
+  case irIN:
+    pc("input()");
+    break;
+  case irOUT:
+    pc("output(%s)", a);
+    break;
+  case irCALL:
+    pc("%s(", ins->callee >= 0 ? p->funcs[ins->callee]->name : "?");
+    for (i = 0; i < ins->nargs; i++)
+      pc("%s%s", i ? ", " : "", argString(ins->args[i], a));
+    pc(")");
+    break;
+  case irPHI:
+    pc("phi %s(", slotString(f, ins->slot, s));
+    for (i = 0; i < ins->nargs; i++)
+      pc("%s%s", i ? ", " : "", argString(ins->args[i], a));
+    pc(")");
+    break;
+  case irRET:
+    pc(ins->a.kind == argNONE ? "return" : "return %s", a);
+    break;
+  case irJUMP:
+    pc("goto L%d", ins->label);
+    break;
+  case irBR:
+    pc("if %s %s %s goto L%d", a, irOpName(ins->rel), b, ins->label);
+    break;
+  case irNOP:
+    pc("nop");
+    break;
+  default:
+    pc("%s %s %s", a, irOpName(ins->op), b);
+    break;
+  }
+  pc("\n");
+}
+
+void irPrintFunc(IrProgram *p, IrFunc *f)
+{
+  IrIns *ins;
+  pc("* %s %s: %d params, %d words of variables, %d temps\n",
+     f->isVoid ? "void" : "int", f->name, f->nparams, f->frameSize, f->ntemps);
+  for (ins = f->first; ins != NULL; ins = ins->next)
+    irPrintIns(p, f, ins);
+}
+
+void irPrintProgram(IrProgram *p, char *title)
+{
+  int i;
+  pc("* ---- %s ----\n", title);
+  for (i = 0; i < p->nfuncs; i++)
+    irPrintFunc(p, p->funcs[i]);
+}
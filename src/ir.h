@@ -0,0 +1,181 @@
+/****************************************************/
+/* File: ir.h                                       */
+/* Three-address intermediate representation of    */
+/* the C- compiler. It is built from the syntax     */
+/* tree after typeCheck, rewritten by IR-to-IR      */
+/* passes and lowered to TM code by lower.c         */
+/****************************************************/
+
+#ifndef _IR_H_
+#define _IR_H_
+
+#include "globals.h"
+
+typedef enum
+{
+  irNOP,
+  irMOVE,  /* d = a */
+  /* d = a op b */
+  irADD,
+  irSUB,
+  irMUL,
+  irDIV,
+  /* d = a rel b, 1 when it holds and 0 otherwise */
+  irLT,
+  irLE,
+  irGT,
+  irGE,
+  irEQ,
+  irNE,
+  irLOAD,  /* d = slot */
+  irSTORE, /* slot = a */
+  irADDR,  /* d = address of word 0 of the array slot */
+  irLDI,   /* d = mem[a + off] */
+  irSTI,   /* mem[a + off] = b */
+  irIN,    /* d = input() */
+  irOUT,   /* output(a) */
+  irCALL,  /* d = callee(args); d is -1 for void functions */
+  irRET,   /* return a; a is empty in void functions */
+  irLABEL, /* label: */
+  irJUMP,  /* goto label */
+  irBR,    /* if a rel b goto label */
+  irPHI    /* d = args[i] when coming from predecessor i (SSA only) */
+} IrOp;
+
+/* an operand: a temporary or an integer constant */
+typedef enum
+{
+  argNONE,
+  argTEMP,
+  argCONST
+} IrArgKind;
+
+typedef struct
+{
+  IrArgKind kind;
+  int val; /* temp number or constant */
+} IrArg;
+
+/* Slots are the memory words named in the source:
+ * frame slots live at fp-2-memloc (words memloc ..
+ * memloc+size-1 for arrays, word 0 at the lowest
+ * address) and globals at gp+memloc, with memloc as
+ * given by the symbol table. An array parameter is
+ * a one-word slot holding the address of word 0.
+ */
+typedef enum
+{
+  slLOCAL,
+  slPARAM,
+  slGLOBAL
+} IrSlotKind;
+
+typedef struct
+{
+  char *name;
+  IrSlotKind kind;
+  int memloc;
+  int size;
+  int isArray;
+} IrSlot;
+
+typedef struct IrIns
+{
+  IrOp op;
+  int dst;   /* temp defined, -1 for none */
+  IrArg a, b;
+  IrOp rel;  /* irBR: irLT .. irNE */
+  int slot;  /* irLOAD, irSTORE, irADDR: index in the function's slots */
+  int off;   /* irLDI, irSTI */
+  int label; /* irLABEL, irJUMP, irBR */
+  int callee; /* irCALL: index in the program, -1 if undeclared */
+  int nargs;
+  IrArg *args; /* irCALL, irPHI */
+  int lineno;
+  int mark;  /* scratch field of the passes and of lower.c */
+  struct IrIns *prev, *next;
+} IrIns;
+
+typedef struct
+{
+  char *name;
+  int isVoid;
+  int isMain;
+  int nparams;   /* the params are slots 0 .. nparams-1 */
+  int frameSize; /* sizeOfVariables of the scope: params and locals */
+  IrSlot *slots;
+  int nslots, maxSlots;
+  int ntemps;
+  int nlabels;
+  IrIns *first, *last;
+} IrFunc;
+
+typedef struct
+{
+  IrFunc **funcs; /* in source order */
+  int nfuncs;
+  int mainIndex;
+} IrProgram;
+
+/* Function irGenerate builds the IR of a
+ * checked syntax tree
+ */
+IrProgram *irGenerate(TreeNode *syntaxTree);
+
+/* Procedure irCodeGen is the IR counterpart of
+ * codeGen: it builds the IR, optimizes it when
+ * OptLevel > 0 and lowers it to TM code
+ */
+void irCodeGen(TreeNode *syntaxTree);
+
+/* construction helpers used by the passes */
+IrArg irTemp(int t);
+IrArg irConst(int c);
+extern const IrArg irNone;
+int irNewTemp(IrFunc *f);
+int irNewLabel(IrFunc *f);
+IrIns *irNewIns(IrOp op);
+/* pos NULL appends (irInsertBefore) or prepends (irInsertAfter) */
+void irInsertBefore(IrFunc *f, IrIns *pos, IrIns *ins);
+void irInsertAfter(IrFunc *f, IrIns *pos, IrIns *ins);
+/* unlinks ins from f and frees it */
+void irRemove(IrFunc *f, IrIns *ins);
+/* turns ins into an irNOP in place, which keeps
+ * a CFG built over f valid
+ */
+void irNop(IrIns *ins);
+int irFindSlot(IrFunc *f, IrSlotKind kind, int memloc);
+int irAddSlot(IrFunc *f, char *name, IrSlotKind kind, int memloc, int size, int isArray);
+
+/* operand i of ins, NULL past the last one; empty */
+/* operands (argNONE) may be returned as well     */
+IrArg *irOperand(IrIns *ins, int i);
+/* TRUE for the binary arithmetic and relational ops */
+int irIsBinary(IrOp op);
+int irIsRelation(IrOp op);
+/* the relation that holds when rel does not */
+IrOp irNegate(IrOp rel);
+/* the relation with its operands swapped */
+IrOp irSwap(IrOp rel);
+/* TRUE if removing ins could change the program */
+int irHasEffect(IrIns *ins);
+/* TRUE for irJUMP, irBR and irRET */
+int irIsBranch(IrIns *ins);
+/* TRUE if the jump or branch ins only goes to
+ * the next instruction
+ */
+int irJumpsToNext(IrIns *ins);
+/* Function irFold evaluates op the way TM does;
+ * FALSE when it cannot be done at compile time
+ */
+int irFold(IrOp op, int x, int y, int *result);
+
+const char *irOpName(IrOp op);
+/* Procedures irPrint* write the IR as TM comment
+ * lines to the current output (see pc)
+ */
+void irPrintIns(IrProgram *prog, IrFunc *f, IrIns *ins);
+void irPrintFunc(IrProgram *prog, IrFunc *f);
+void irPrintProgram(IrProgram *prog, char *title);
+
+#endif
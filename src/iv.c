@@ -0,0 +1,452 @@
+/****************************************************/
+/* File: iv.c                                       */
+/* Induction variables of the loops of SSA form:   */
+/* array elements indexed by a counter are reached */
+/* through a pointer that steps with the counter,  */
+/* and the loop test moves to the pointer when the */
+/* counter has no other use                         */
+/****************************************************/
+
+#include "globals.h"
+#include "ir.h"
+#include "cfg.h"
+#include "opt.h"
+
+#define MAX_POINTERS 4
+
+/* a counter: i = phi(init, next) in the loop header,
+ * with next = i + step on every back edge
+ */
+typedef struct
+{
+  IrIns *phi;
+  IrIns *inc; /* defines next */
+  IrArg init;
+  int step;
+} Counter;
+
+/* a pointer that is base + i all along the loop */
+typedef struct
+{
+  IrArg base;
+  int slot;    /* array slot when base is its address, else -1 */
+  IrArg start; /* base, in the preheader */
+  int q, next; /* the phi and its value on the back edges */
+} Pointer;
+
+static IrCfg *cfg;
+static IrFunc *fn;
+static IrIns **defOf;  /* by temp, NULL for none */
+static int *defBlock;  /* by temp, -1 for none */
+static int maxTemps;
+
+/* Procedure define records that ins, in block b,
+ * defines its temp; ins->mark is the block of every
+ * instruction
+ */
+static void define(IrIns *ins, int b)
+{
+  int t;
+  ins->mark = b;
+  if (ins->dst < 0)
+    return;
+  if (ins->dst >= maxTemps)
+  {
+    t = maxTemps;
+    maxTemps = 2 * ins->dst + 16;
+    defOf = (IrIns **)realloc(defOf, maxTemps * sizeof(IrIns *));
+    defBlock = (int *)realloc(defBlock, maxTemps * sizeof(int));
+    for (; t < maxTemps; t++)
+    {
+      defOf[t] = NULL;
+      defBlock[t] = -1;
+    }
+  }
+  defOf[ins->dst] = ins;
+  defBlock[ins->dst] = b;
+}
+
+/* Procedure insertAfter puts ins after pos, in block b */
+static void insertAfter(int b, IrIns *pos, IrIns *ins)
+{
+  irInsertAfter(fn, pos, ins);
+  if (pos == cfg->blocks[b].last)
+    cfg->blocks[b].last = ins;
+}
+
+/* Function newIns makes d = a op b in block b, after
+ * pos or, for pos NULL, at the end of the block
+ * before its jump
+ */
+static IrIns *newIns(int blk, IrIns *pos, IrOp op, IrArg a, IrArg b)
+{
+  IrIns *ins = irNewIns(op);
+  IrBlock *block = &cfg->blocks[blk];
+  ins->dst = irNewTemp(fn);
+  ins->a = a;
+  ins->b = b;
+  ins->lineno = block->last->lineno;
+  if (pos != NULL)
+    insertAfter(blk, pos, ins);
+  else if (irIsBranch(block->last))
+    irInsertBefore(fn, block->last, ins);
+  else
+    insertAfter(blk, block->last, ins);
+  define(ins, blk);
+  return ins;
+}
+
+/* TRUE if a is the same on every trip of loop l */
+static int invariant(IrLoop *l, IrArg a)
+{
+  return a.kind == argCONST ||
+         (a.kind == argTEMP && (defBlock[a.val] < 0 || !l->body[defBlock[a.val]]));
+}
+
+/* Function counterOffset tells if a is counter i
+ * plus a constant, which it puts in k
+ */
+static int counterOffset(int i, IrArg a, int *k)
+{
+  IrIns *d;
+  if (a.kind != argTEMP)
+    return FALSE;
+  if (a.val == i)
+  {
+    *k = 0;
+    return TRUE;
+  }
+  d = defOf[a.val];
+  if (d == NULL || d->a.kind != argTEMP || d->a.val != i || d->b.kind != argCONST)
+    return FALSE;
+  if (d->op == irADD)
+    *k = d->b.val;
+  else if (d->op == irSUB)
+    *k = -d->b.val;
+  else
+    return FALSE;
+  return TRUE;
+}
+
+/* Function findCounter tells if phi, in the header
+ * of loop l, is a counter
+ */
+static int findCounter(IrLoop *l, int pre, IrIns *phi, Counter *c)
+{
+  IrBlock *h = &cfg->blocks[l->header];
+  IrArg a;
+  int j;
+  c->phi = phi;
+  c->inc = NULL;
+  c->init = irNone;
+  for (j = 0; j < phi->nargs; j++)
+  {
+    a = phi->args[j];
+    if (h->pred[j] == pre)
+      c->init = a;
+    else if (a.kind != argTEMP || (c->inc != NULL && c->inc->dst != a.val))
+      return FALSE;
+    else
+      c->inc = defOf[a.val];
+  }
+  return c->init.kind != argNONE && c->inc != NULL &&
+         counterOffset(phi->dst, irTemp(c->inc->dst), &c->step) && l->body[defBlock[c->inc->dst]];
+}
+
+/* TRUE if temp t is only the address of indexed
+ * loads and stores
+ */
+static int addressOnly(int t)
+{
+  IrIns *ins;
+  IrArg *arg;
+  int i;
+  for (ins = fn->first; ins != NULL; ins = ins->next)
+    for (i = 0; (arg = irOperand(ins, i)) != NULL; i++)
+      if (arg->kind == argTEMP && arg->val == t &&
+          !((ins->op == irLDI || ins->op == irSTI) && arg == &ins->a))
+        return FALSE;
+  return TRUE;
+}
+
+/* TRUE if base can have a pointer in loop l */
+static int pointerBase(IrLoop *l, IrArg base)
+{
+  return base.kind == argTEMP &&
+         (invariant(l, base) || (defOf[base.val] != NULL && defOf[base.val]->op == irADDR));
+}
+
+/* TRUE if ins, in loop l, is an element address
+ * with index x
+ */
+static int elementAddress(IrLoop *l, IrIns *ins, int x)
+{
+  IrArg base;
+  if (ins->op != irADD || !l->body[ins->mark] || ins->dst < 0)
+    return FALSE;
+  base = ins->a.kind == argTEMP && ins->a.val == x ? ins->b : ins->a;
+  return pointerBase(l, base) && addressOnly(ins->dst);
+}
+
+/* Function counterDies tells if counter c is only
+ * stepped, compared in the loop with values the
+ * same on every trip and used, alone or plus a
+ * constant, to index arrays in the loop
+ */
+static int counterDies(IrLoop *l, Counter *c)
+{
+  IrIns *ins, *use;
+  IrArg *arg, *other, *x;
+  int i, j, t;
+  for (ins = fn->first; ins != NULL; ins = ins->next)
+  {
+    if (ins == c->phi || ins == c->inc)
+      continue;
+    for (i = 0; (arg = irOperand(ins, i)) != NULL; i++)
+    {
+      if (arg->kind != argTEMP || (arg->val != c->phi->dst && arg->val != c->inc->dst))
+        continue;
+      other = arg == &ins->a ? &ins->b : &ins->a;
+      if (ins->op == irBR)
+      {
+        if (!l->body[ins->mark] || !invariant(l, *other))
+          return FALSE;
+      }
+      else if (elementAddress(l, ins, arg->val))
+        continue;
+      else if (ins->dst < 0 || !counterOffset(c->phi->dst, irTemp(ins->dst), &t) || !l->body[ins->mark])
+        return FALSE;
+      else
+        /* an index i + k */
+        for (use = fn->first; use != NULL; use = use->next)
+          for (j = 0; (x = irOperand(use, j)) != NULL; j++)
+            if (x->kind == argTEMP && x->val == ins->dst && !elementAddress(l, use, ins->dst))
+              return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/* Function pointerFor gives the pointer over the
+ * array at base, making it the first time: it
+ * starts at base + init in the preheader and steps
+ * right after the counter does
+ */
+static Pointer *pointerFor(Pointer *ptrs, int *n, IrLoop *l, int pre, Counter *c, IrArg base)
+{
+  IrBlock *h = &cfg->blocks[l->header];
+  IrIns *d = defOf[base.val], *q, *addr;
+  IrArg first;
+  Pointer *p;
+  int i, slot = d != NULL && d->op == irADDR ? d->slot : -1;
+  for (i = 0; i < *n; i++)
+    if (slot >= 0 ? ptrs[i].slot == slot : ptrs[i].base.val == base.val)
+      return &ptrs[i];
+  if (*n == MAX_POINTERS)
+    return NULL;
+  p = &ptrs[(*n)++];
+  p->base = base;
+  p->slot = slot;
+  p->start = base;
+  if (slot >= 0)
+  {
+    /* the address is taken again, so that the pointer
+     * starts in the preheader and is not tied to a temp
+     * that may live across calls
+     */
+    addr = irNewIns(irADDR);
+    addr->dst = irNewTemp(fn);
+    addr->slot = slot;
+    addr->lineno = cfg->blocks[pre].last->lineno;
+    if (irIsBranch(cfg->blocks[pre].last))
+      irInsertBefore(fn, cfg->blocks[pre].last, addr);
+    else
+      insertAfter(pre, cfg->blocks[pre].last, addr);
+    define(addr, pre);
+    p->start = irTemp(addr->dst);
+  }
+  if (slot >= 0 && c->init.kind == argCONST && c->init.val == 0)
+    first = p->start;
+  else
+    first = irTemp(newIns(pre, NULL, irADD, p->start, c->init)->dst);
+  q = irNewIns(irPHI);
+  q->dst = irNewTemp(fn);
+  q->slot = slot >= 0 ? slot : (d != NULL && d->op == irLOAD ? d->slot : -1);
+  q->lineno = c->phi->lineno;
+  q->nargs = h->npred;
+  q->args = (IrArg *)malloc((h->npred + 1) * sizeof(IrArg));
+  insertAfter(l->header, c->phi, q);
+  define(q, l->header);
+  p->q = q->dst;
+  p->next = newIns(defBlock[c->inc->dst], c->inc, irADD, irTemp(q->dst), irConst(c->step))->dst;
+  for (i = 0; i < h->npred; i++)
+    q->args[i] = h->pred[i] == pre ? first : irTemp(p->next);
+  return p;
+}
+
+/* TRUE if every path to ins goes through d first */
+static int follows(IrIns *ins, IrIns *d)
+{
+  IrIns *p;
+  if (ins->mark != d->mark)
+    return cfgDominates(cfg, d->mark, ins->mark);
+  for (p = d->next; p != cfg->blocks[d->mark].last; p = p->next)
+    if (p == ins)
+      return TRUE;
+  return p == ins;
+}
+
+/* Procedure reduce rewrites the element addresses
+ * base + i + k of loop l, with base the same on
+ * every trip, into the pointer over base with
+ * offset k; it gives the number of pointers made
+ */
+static int reduce(IrLoop *l, int pre, Counter *c, Pointer *ptrs)
+{
+  int n = 0, i, j, k, b;
+  IrIns *ins, *use;
+  IrArg base, index;
+  Pointer *p;
+  for (i = 0; i < cfg->norder; i++)
+  {
+    b = cfg->order[i];
+    if (!l->body[b])
+      continue;
+    for (ins = cfg->blocks[b].first;; ins = ins->next)
+    {
+      if (ins->op == irADD && ins->dst >= 0)
+        for (j = 0; j < 2; j++)
+        {
+          base = j ? ins->b : ins->a;
+          index = j ? ins->a : ins->b;
+          if (!pointerBase(l, base) || !counterOffset(c->phi->dst, index, &k) ||
+              !addressOnly(ins->dst) || (p = pointerFor(ptrs, &n, l, pre, c, base)) == NULL)
+            continue;
+          for (use = fn->first; use != NULL; use = use->next)
+            if ((use->op == irLDI || use->op == irSTI) && use->a.kind == argTEMP &&
+                use->a.val == ins->dst)
+            {
+              /* past the step, the stepped pointer keeps q from living on */
+              if (follows(use, defOf[p->next]))
+              {
+                use->a = irTemp(p->next);
+                use->off += k - c->step;
+              }
+              else
+              {
+                use->a = irTemp(p->q);
+                use->off += k;
+              }
+            }
+          irNop(ins);
+          break;
+        }
+      if (ins == cfg->blocks[b].last)
+        break;
+    }
+  }
+  return n;
+}
+
+/* Procedure replaceTest is linear test replacement:
+ * when the counter is only stepped and compared
+ * with values the same on every trip, the tests
+ * compare the pointer with base plus those values
+ * and the counter dies
+ */
+static void replaceTest(IrLoop *l, int pre, Counter *c, Pointer *p)
+{
+  IrIns *ins;
+  IrArg *arg, *other;
+  int i, t;
+  for (ins = fn->first; ins != NULL; ins = ins->next)
+  {
+    if (ins == c->phi || ins == c->inc)
+      continue;
+    for (i = 0; (arg = irOperand(ins, i)) != NULL; i++)
+    {
+      if (arg->kind != argTEMP || (arg->val != c->phi->dst && arg->val != c->inc->dst))
+        continue;
+      other = arg == &ins->a ? &ins->b : &ins->a;
+      if (ins->op != irBR || !l->body[ins->mark] || !invariant(l, *other) ||
+          (other->kind == argTEMP && (other->val == c->phi->dst || other->val == c->inc->dst)))
+        return;
+    }
+  }
+  for (ins = fn->first; ins != NULL; ins = ins->next)
+  {
+    if (ins->op != irBR)
+      continue;
+    for (i = 0; i < 2; i++)
+    {
+      arg = i ? &ins->b : &ins->a;
+      other = i ? &ins->a : &ins->b;
+      if (arg->kind != argTEMP || (arg->val != c->phi->dst && arg->val != c->inc->dst))
+        continue;
+      t = arg->val;
+      *arg = irTemp(t == c->phi->dst ? p->q : p->next);
+      *other = irTemp(newIns(pre, NULL, irADD, p->start, *other)->dst);
+      break;
+    }
+  }
+}
+
+/* Procedure reduceLoop leaves alone the loops that
+ * call: a temp live across a call is kept in the
+ * frame, so a pointer would cost a load and a store
+ * on every trip
+ */
+static void reduceLoop(IrLoop *l)
+{
+  int pre = cfgPreheader(cfg, l), b;
+  IrIns *ins, *next;
+  IrBlock *h = &cfg->blocks[l->header];
+  Pointer ptrs[MAX_POINTERS];
+  Counter c;
+  if (pre < 0)
+    return;
+  for (b = 0; b < cfg->nblocks; b++)
+    if (l->body[b])
+      for (ins = cfg->blocks[b].first;; ins = ins->next)
+      {
+        if (ins->op == irCALL)
+          return;
+        if (ins == cfg->blocks[b].last)
+          break;
+      }
+  for (ins = h->first; ins->op == irLABEL || ins->op == irPHI || ins->op == irNOP; ins = next)
+  {
+    next = ins->next;
+    if (ins->op == irPHI && findCounter(l, pre, ins, &c) && counterDies(l, &c) &&
+        reduce(l, pre, &c, ptrs) > 0)
+    {
+      /* the indexes the addresses were made of go first */
+      irDeadCode(fn);
+      replaceTest(l, pre, &c, &ptrs[0]);
+    }
+    if (ins == h->last)
+      break;
+  }
+}
+
+void reduceInductions(IrCfg *g)
+{
+  int i, b;
+  IrIns *ins;
+  cfg = g;
+  fn = g->func;
+  for (b = 0; b < g->nblocks; b++)
+    for (ins = g->blocks[b].first;; ins = ins->next)
+    {
+      define(ins, b);
+      if (ins == g->blocks[b].last)
+        break;
+    }
+  for (i = g->nloops - 1; i >= 0; i--)
+    reduceLoop(&g->loops[i]);
+  free(defOf);
+  free(defBlock);
+  defOf = NULL;
+  defBlock = NULL;
+  maxTemps = 0;
+}
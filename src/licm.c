@@ -0,0 +1,183 @@
+/****************************************************/
+/* File: licm.c                                     */
+/* Loop-invariant code motion: every loop gets a    */
+/* preheader before SSA form is built, and the     */
+/* values a loop computes the same on every trip   */
+/* are moved into it                                */
+/****************************************************/
+
+#include "globals.h"
+#include "ir.h"
+#include "cfg.h"
+#include "opt.h"
+
+/**************************************************/
+/***********   Preheaders              ************/
+/**************************************************/
+
+/* The preheader is a label and an irNOP put just
+ * before the loop test; the nop keeps the label
+ * from joining the block of the header. Branches
+ * into the header from outside the loop go to
+ * the new label instead.
+ */
+void addPreheaders(IrFunc *f)
+{
+  IrCfg *cfg = cfgBuild(f);
+  IrLoop *l;
+  IrBlock *h;
+  IrIns *label, *nop, *last;
+  int i, j;
+  for (i = 0; i < cfg->nloops; i++)
+  {
+    l = &cfg->loops[i];
+    h = &cfg->blocks[l->header];
+    label = irNewIns(irLABEL);
+    label->label = irNewLabel(f);
+    label->lineno = h->first->lineno;
+    nop = irNewIns(irNOP);
+    nop->lineno = h->first->lineno;
+    irInsertBefore(f, h->first, label);
+    irInsertBefore(f, h->first, nop);
+    for (j = 0; j < h->npred; j++)
+    {
+      if (l->body[h->pred[j]])
+        continue;
+      last = cfg->blocks[h->pred[j]].last;
+      if ((last->op == irJUMP || last->op == irBR) && cfg->labelBlock[last->label] == l->header)
+        last->label = label->label;
+    }
+  }
+  cfgFree(cfg);
+}
+
+/**************************************************/
+/***********   Code motion             ************/
+/**************************************************/
+
+static IrCfg *cfg;
+static int *defBlock; /* by temp, -1 for none */
+
+/* TRUE if no operand of ins is computed in l */
+static int invariant(IrLoop *l, IrIns *ins)
+{
+  IrArg *arg;
+  int i;
+  for (i = 0; (arg = irOperand(ins, i)) != NULL; i++)
+    if (arg->kind == argTEMP && defBlock[arg->val] >= 0 && l->body[defBlock[arg->val]])
+      return FALSE;
+  return TRUE;
+}
+
+/* Procedure hoist moves ins to the end of block b */
+static void hoist(IrIns *ins, int b)
+{
+  IrBlock *blk = &cfg->blocks[b];
+  IrIns *copy = irNewIns(irNOP);
+  *copy = *ins;
+  copy->prev = copy->next = NULL;
+  if (irIsBranch(blk->last))
+    irInsertBefore(cfg->func, blk->last, copy);
+  else
+  {
+    irInsertAfter(cfg->func, blk->last, copy);
+    blk->last = copy;
+  }
+  defBlock[copy->dst] = b;
+  irNop(ins);
+}
+
+/* Procedure hoistLoop moves the invariant values
+ * of loop l into its preheader. A load stays when
+ * the loop may store to its word or call. The
+ * preheader runs even when the body does not, so
+ * a division that may stop TM and an indexed load
+ * that may read outside memory are only moved from
+ * the loop test, ahead of anything with an effect.
+ */
+static void hoistLoop(IrLoop *l)
+{
+  int pre = cfgPreheader(cfg, l), calls = FALSE, writes = FALSE, early, move, i, b;
+  char *stored;
+  IrIns *ins;
+  IrBlock *blk;
+  if (pre < 0)
+    return;
+  stored = (char *)calloc(cfg->func->nslots + 1, 1);
+  for (b = 0; b < cfg->nblocks; b++)
+  {
+    if (!l->body[b])
+      continue;
+    for (ins = cfg->blocks[b].first;; ins = ins->next)
+    {
+      if (ins->op == irCALL)
+        calls = TRUE;
+      else if (ins->op == irSTI)
+        writes = TRUE;
+      else if (ins->op == irSTORE)
+        stored[ins->slot] = TRUE;
+      if (ins == cfg->blocks[b].last)
+        break;
+    }
+  }
+  /* in reverse postorder a value is met after its operands */
+  for (i = 0; i < cfg->norder; i++)
+  {
+    b = cfg->order[i];
+    if (!l->body[b])
+      continue;
+    blk = &cfg->blocks[b];
+    early = b == l->header;
+    for (ins = blk->first;; ins = ins->next)
+    {
+      switch (ins->op)
+      {
+      case irADDR:
+        /* one LDA, as cheap as reloading it */
+        move = FALSE;
+        break;
+      case irLOAD:
+        move = !calls && !stored[ins->slot];
+        break;
+      case irLDI:
+        move = early && !calls && !writes;
+        break;
+      case irDIV:
+        move = early || !irHasEffect(ins);
+        break;
+      default:
+        move = irIsBinary(ins->op);
+        break;
+      }
+      if (move && invariant(l, ins))
+        hoist(ins, pre);
+      if (irHasEffect(ins) && ins->op != irLABEL)
+        early = FALSE;
+      if (ins == blk->last)
+        break;
+    }
+  }
+  free(stored);
+}
+
+void licm(IrCfg *g)
+{
+  int i, b;
+  IrIns *ins;
+  cfg = g;
+  defBlock = (int *)malloc((g->func->ntemps + 1) * sizeof(int));
+  for (i = 0; i < g->func->ntemps; i++)
+    defBlock[i] = -1;
+  for (b = 0; b < g->nblocks; b++)
+    for (ins = g->blocks[b].first;; ins = ins->next)
+    {
+      if (ins->dst >= 0)
+        defBlock[ins->dst] = b;
+      if (ins == g->blocks[b].last)
+        break;
+    }
+  /* inner loops first: what leaves them may leave the outer ones too */
+  for (i = g->nloops - 1; i >= 0; i--)
+    hoistLoop(&g->loops[i]);
+  free(defBlock);
+}
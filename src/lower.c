@@ -0,0 +1,862 @@
+/****************************************************/
+/* File: lower.c                                    */
+/* Lowering of the three-address IR to TM code      */
+/* through the emitting utilities of code.c         */
+/****************************************************/
+
+#include "globals.h"
+#include "code.h"
+#include "ir.h"
+#include "cfg.h"
+#include "lower.h"
+
+#define FP_LOCALS_OFFSET -2
+
+/* registers given to temps; ac stays free as the
+ * scratch register of every instruction
+ */
+#define NO_TEMP_REGS 3
+static const int tempRegs[NO_TEMP_REGS] = {ac1, ac2, mp};
+
+/* where the temps of a function live */
+typedef struct
+{
+  int *reg;   /* register of each temp, -1 when it has a frame word */
+  int *home;  /* fp offset of the frame word */
+  int *remat; /* slot whose address the temp is, recomputed when spilled; -1 for none */
+  int nspill;
+  int borrow; /* fp offset of the word saving a borrowed register */
+  int size;   /* words below the return address: variables, temps, borrow */
+  int leaf;   /* calls nothing: the frame is addressed from sp, fp is left alone */
+  int entry;  /* TM location of the function, -1 until emitted */
+} Frame;
+
+/* a jump emitted before its target was known */
+typedef struct
+{
+  int loc;
+  char *op;
+  int r;
+  int target; /* label, or function for calls */
+} Fixup;
+
+static IrProgram *prog;
+static Frame *frames;
+static IrFunc *fn;
+static Frame *fr;
+static int *labelLoc;
+static Fixup *jumpFix, *callFix;
+static int nJumpFix, nCallFix, maxJumpFix, maxCallFix;
+static int borrowed = -1;
+
+static void addFixup(Fixup **fix, int *n, int *max, char *op, int r, int target)
+{
+  if (*n == *max)
+  {
+    *max = *max ? 2 * *max : 16;
+    *fix = (Fixup *)realloc(*fix, *max * sizeof(Fixup));
+  }
+  (*fix)[*n].loc = emitSkip(1);
+  (*fix)[*n].op = op;
+  (*fix)[*n].r = r;
+  (*fix)[*n].target = target;
+  (*n)++;
+}
+
+/**************************************************/
+/***********   Temp allocation         ************/
+/**************************************************/
+
+/* register the frame of the function is addressed from */
+static int frameReg(void)
+{
+  return fr->leaf ? sp : fp;
+}
+
+/* Function frameOff turns an fp offset into one
+ * from frameReg. In a leaf function sp stays where
+ * the caller left it, 2 + size words below the
+ * word fp would point to.
+ */
+static int frameOff(int off)
+{
+  return fr->leaf ? off - FP_LOCALS_OFFSET + fr->size : off;
+}
+
+static int slotBase(IrSlot *s)
+{
+  return s->kind == slGLOBAL ? gp : frameReg();
+}
+
+/* fp offset of word 0 of a frame slot */
+static int frameWord(IrSlot *s)
+{
+  return FP_LOCALS_OFFSET - s->memloc - (s->size - 1);
+}
+
+/* offset of word 0 of s from its base register */
+static int slotOffset(IrSlot *s)
+{
+  if (s->kind == slGLOBAL)
+    return s->memloc;
+  return frameOff(frameWord(s));
+}
+
+
+static int *sortKey;
+static int *homeSlot; /* frame slot a temp can be spilled to, -1 for none */
+
+/* Procedure findHomes marks the temps loaded once
+ * from a frame slot that the function never
+ * stores: spilled, they can stay in that slot.
+ * Temps set once to the address of an array need
+ * no word at all.
+ */
+static void findHomes(IrFunc *f, Frame *frame)
+{
+  int *defs = (int *)calloc(f->ntemps + 1, sizeof(int));
+  char *stored = (char *)calloc(f->nslots + 1, 1);
+  IrIns *ins;
+  int t;
+  for (ins = f->first; ins != NULL; ins = ins->next)
+  {
+    if (ins->dst >= 0)
+      defs[ins->dst]++;
+    if (ins->op == irSTORE)
+      stored[ins->slot] = TRUE;
+  }
+  for (t = 0; t < f->ntemps; t++)
+    homeSlot[t] = frame->remat[t] = -1;
+  for (ins = f->first; ins != NULL; ins = ins->next)
+    if (ins->op == irLOAD && defs[ins->dst] == 1 && !stored[ins->slot] &&
+        f->slots[ins->slot].kind != slGLOBAL)
+      homeSlot[ins->dst] = ins->slot;
+    else if (ins->op == irADDR && defs[ins->dst] == 1)
+      frame->remat[ins->dst] = ins->slot;
+  free(defs);
+  free(stored);
+}
+
+/* frame word of a spilled temp */
+static int spillHome(IrFunc *f, Frame *frame, int t)
+{
+  if (frame->remat[t] >= 0)
+    return 0;
+  if (homeSlot[t] >= 0)
+    return frameWord(&f->slots[homeSlot[t]]);
+  return FP_LOCALS_OFFSET - f->frameSize - frame->nspill++;
+}
+
+static int byKey(const void *x, const void *y)
+{
+  return sortKey[*(const int *)x] - sortKey[*(const int *)y];
+}
+
+/* Function cheaper tells whether spilling temp x
+ * costs less than spilling y: fewer weighted uses
+ * per position of the interval, then the
+ * interval that ends later
+ */
+static int cheaper(int x, int y, long *weight, int *start, int *end)
+{
+  long cx = weight[x] * (end[y] - start[y] + 1);
+  long cy = weight[y] * (end[x] - start[x] + 1);
+  return cx < cy || (cx == cy && end[x] > end[y]);
+}
+
+/* Procedure allocate gives registers to the temps
+ * of f by linear scan. The interval of a temp runs
+ * from its first to its last appearance, stretched
+ * over every block it is live into or out of. A temp
+ * live across a call gets a frame word, as calls
+ * clobber every register; when registers run out,
+ * the temp with the lowest weight (uses, times 10
+ * per loop level) per position goes to the frame.
+ */
+static void allocate(IrFunc *f, Frame *frame)
+{
+  int n = f->ntemps, i, j, t, k, pos, w;
+  int *start = (int *)malloc((n + 1) * sizeof(int));
+  int *end = (int *)malloc((n + 1) * sizeof(int));
+  int *order = (int *)malloc((n + 1) * sizeof(int));
+  long *weight = (long *)calloc(n + 1, sizeof(long));
+  char *acrossCall = (char *)calloc(n + 1, 1);
+  int active[NO_TEMP_REGS];
+  IrCfg *cfg = cfgBuild(f);
+  IrBlock *b;
+  IrIns *ins;
+  IrArg *arg;
+  unsigned *live;
+
+  cfgLiveness(cfg);
+  homeSlot = (int *)malloc((n + 1) * sizeof(int));
+  frame->remat = (int *)malloc((n + 1) * sizeof(int));
+  findHomes(f, frame);
+  live = (unsigned *)malloc(cfg->words * sizeof(unsigned));
+  for (t = 0; t < n; t++)
+    start[t] = end[t] = -1;
+#define TOUCH(t, p)                    \
+  {                                    \
+    if (start[t] < 0 || start[t] > p)  \
+      start[t] = p;                    \
+    if (end[t] < p)                    \
+      end[t] = p;                      \
+  }
+  pos = 0;
+  for (i = 0; i < cfg->nblocks; i++)
+  {
+    b = &cfg->blocks[i];
+    for (w = 1, j = 0; j < b->depth && j < 6; j++)
+      w *= 10;
+    for (t = 0; t < n; t++)
+      if (cfgLive(b->liveIn, t))
+        TOUCH(t, pos);
+    for (ins = b->first;; ins = ins->next, pos++)
+    {
+      ins->mark = pos;
+      for (j = 0; (arg = irOperand(ins, j)) != NULL; j++)
+        if (arg->kind == argTEMP)
+        {
+          TOUCH(arg->val, pos);
+          weight[arg->val] += w;
+        }
+      if (ins->dst >= 0)
+      {
+        TOUCH(ins->dst, pos);
+        /* spilled to its slot, the temp costs no store */
+        if (homeSlot[ins->dst] < 0 && frame->remat[ins->dst] < 0)
+          weight[ins->dst] += w;
+      }
+      if (ins == b->last)
+        break;
+    }
+    /* a position of its own, so that nothing defined
+     * at the end of the block can take their register
+     */
+    pos++;
+    for (t = 0; t < n; t++)
+      if (cfgLive(b->liveOut, t))
+        TOUCH(t, pos);
+    pos++;
+    /* what is live after a call, but its result, lives across it */
+    memcpy(live, b->liveOut, cfg->words * sizeof(unsigned));
+    for (ins = b->last;; ins = ins->prev)
+    {
+      if (ins->dst >= 0)
+        cfgSetLive(live, ins->dst, FALSE);
+      if (ins->op == irCALL)
+        for (t = 0; t < n; t++)
+          if (cfgLive(live, t))
+            acrossCall[t] = TRUE;
+      for (j = 0; (arg = irOperand(ins, j)) != NULL; j++)
+        if (arg->kind == argTEMP)
+          cfgSetLive(live, arg->val, TRUE);
+      if (ins == b->first)
+        break;
+    }
+  }
+#undef TOUCH
+
+  frame->reg = (int *)malloc((n + 1) * sizeof(int));
+  frame->home = (int *)malloc((n + 1) * sizeof(int));
+  frame->nspill = 0;
+  k = 0;
+  for (t = 0; t < n; t++)
+  {
+    frame->reg[t] = -1;
+    frame->home[t] = 0;
+    if (start[t] < 0)
+      continue;
+    if (acrossCall[t])
+      frame->home[t] = spillHome(f, frame, t);
+    else
+      order[k++] = t;
+  }
+  sortKey = start;
+  qsort(order, k, sizeof(int), byKey);
+
+  for (i = 0; i < NO_TEMP_REGS; i++)
+    active[i] = -1;
+  for (i = 0; i < k; i++)
+  {
+    int victim = -1;
+    t = order[i];
+    for (j = 0; j < NO_TEMP_REGS; j++)
+      if (active[j] >= 0 && end[active[j]] <= start[t])
+        active[j] = -1;
+    for (j = 0; j < NO_TEMP_REGS && active[j] >= 0; j++)
+      if (victim < 0 || cheaper(active[j], active[victim], weight, start, end))
+        victim = j;
+    if (j < NO_TEMP_REGS)
+    {
+      active[j] = t;
+      frame->reg[t] = tempRegs[j];
+      continue;
+    }
+    if (cheaper(active[victim], t, weight, start, end))
+    {
+      int s = active[victim];
+      frame->reg[s] = -1;
+      frame->home[s] = spillHome(f, frame, s);
+      frame->reg[t] = tempRegs[victim];
+      active[victim] = t;
+    }
+    else
+      frame->home[t] = spillHome(f, frame, t);
+  }
+  /* the mark of an instruction becomes the set of
+   * registers no temp holds there
+   */
+  for (ins = f->first; ins != NULL; ins = ins->next)
+  {
+    int busy = 0;
+    for (t = 0; t < n; t++)
+      if (frame->reg[t] >= 0 && start[t] <= ins->mark && ins->mark <= end[t])
+        for (j = 0; j < NO_TEMP_REGS; j++)
+          if (tempRegs[j] == frame->reg[t])
+            busy |= 1 << j;
+    ins->mark = ~busy & ((1 << NO_TEMP_REGS) - 1);
+  }
+  frame->borrow = FP_LOCALS_OFFSET - f->frameSize - frame->nspill;
+  frame->size = f->frameSize + frame->nspill + 1;
+  frame->leaf = TRUE;
+  for (ins = f->first; ins != NULL; ins = ins->next)
+    if (ins->op == irCALL)
+      frame->leaf = FALSE;
+  frame->entry = -1;
+  free(start);
+  free(end);
+  free(order);
+  free(weight);
+  free(acrossCall);
+  free(homeSlot);
+  free(live);
+  cfgFree(cfg);
+}
+
+/**************************************************/
+/***********   Instruction selection   ************/
+/**************************************************/
+
+static int inReg(IrArg a)
+{
+  return a.kind == argTEMP ? fr->reg[a.val] : -1;
+}
+
+/* Function fetch returns the register holding a;
+ * constants and temps in the frame are loaded
+ * into the scratch register r
+ */
+static int fetch(IrArg a, int r)
+{
+  if (inReg(a) >= 0)
+    return inReg(a);
+  if (a.kind == argTEMP && fr->remat[a.val] >= 0)
+    emitRM("LDA", r, slotOffset(&fn->slots[fr->remat[a.val]]), slotBase(&fn->slots[fr->remat[a.val]]),
+           "array address");
+  else if (a.kind == argTEMP)
+    emitRM("LD", r, frameOff(fr->home[a.val]), frameReg(), "reload temp");
+  else
+    emitRM("LDC", r, a.val, 0, "load const");
+  return r;
+}
+
+/* register the result of ins is computed into */
+static int target(IrIns *ins)
+{
+  return fr->reg[ins->dst] >= 0 ? fr->reg[ins->dst] : ac;
+}
+
+/* Procedure keep sends the result of ins from r
+ * to its frame word, if it has one
+ */
+static void keep(IrIns *ins, int r)
+{
+  if (fr->reg[ins->dst] < 0 && fr->remat[ins->dst] < 0)
+    emitRM("ST", r, frameOff(fr->home[ins->dst]), frameReg(), "spill temp");
+}
+
+/* Function second returns a register for the
+ * second operand of ins when ac holds the first:
+ * the register of the result if it is not an
+ * operand, one that no temp holds at ins, or else
+ * one saved in the borrow word until unborrow
+ */
+static int second(IrIns *ins, IrArg a, IrArg b)
+{
+  int rd = ins->dst >= 0 ? fr->reg[ins->dst] : -1;
+  int i;
+  if (rd >= 0 && rd != inReg(a) && rd != inReg(b))
+    return rd;
+  for (i = 0; i < NO_TEMP_REGS; i++)
+    if (ins->mark & (1 << i))
+      return tempRegs[i];
+  for (i = 0; i < NO_TEMP_REGS; i++)
+    if (tempRegs[i] != inReg(a) && tempRegs[i] != inReg(b) && tempRegs[i] != rd)
+      break;
+  borrowed = tempRegs[i];
+  emitRM("ST", borrowed, frameOff(fr->borrow), frameReg(), "borrow a register");
+  return borrowed;
+}
+
+static void unborrow(void)
+{
+  if (borrowed >= 0)
+    emitRM("LD", borrowed, frameOff(fr->borrow), frameReg(), "give back the register");
+  borrowed = -1;
+}
+
+/* fetch both operands, a first */
+static void fetchPair(IrIns *ins, IrArg a, IrArg b, int *ra, int *rb)
+{
+  *ra = fetch(a, ac);
+  if (inReg(b) >= 0)
+    *rb = inReg(b);
+  else
+    *rb = fetch(b, *ra == ac ? second(ins, a, b) : ac);
+}
+
+static char *jumpName(IrOp rel)
+{
+  switch (rel)
+  {
+  case irLT:
+    return "JLT";
+  case irLE:
+    return "JLE";
+  case irGT:
+    return "JGT";
+  case irGE:
+    return "JGE";
+  case irEQ:
+    return "JEQ";
+  default:
+    return "JNE";
+  }
+}
+
+static void jumpTo(char *op, int r, int label)
+{
+  if (labelLoc[label] >= 0)
+    emitRM_Abs(op, r, labelLoc[label], "jump to label");
+  else
+    addFixup(&jumpFix, &nJumpFix, &maxJumpFix, op, r, label);
+}
+
+static void callTo(int callee)
+{
+  if (callee < 0)
+    emitRM_Abs("LDA", PC, 0, "BUG: call to an undeclared function");
+  else if (frames[callee].entry >= 0)
+    emitRM_Abs("LDA", PC, frames[callee].entry, "jump to the function");
+  else
+    addFixup(&callFix, &nCallFix, &maxCallFix, "LDA", PC, callee);
+}
+
+static void lowerBinary(IrIns *ins)
+{
+  IrArg a = ins->a, b = ins->b;
+  int rd = target(ins), ra, rb;
+  if (ins->op == irADD && a.kind == argCONST)
+  {
+    a = ins->b;
+    b = ins->a;
+  }
+  if ((ins->op == irADD || ins->op == irSUB) && b.kind == argCONST)
+  {
+    ra = fetch(a, ac);
+    emitRM("LDA", rd, ins->op == irADD ? b.val : -b.val, ra, "add const");
+    keep(ins, rd);
+    return;
+  }
+  if (irIsRelation(ins->op) && b.kind == argCONST)
+  {
+    ra = fetch(a, ac);
+    if (b.val != 0 || ra != ac)
+      emitRM("LDA", ac, -b.val, ra, "compare with const");
+  }
+  else
+  {
+    fetchPair(ins, a, b, &ra, &rb);
+    switch (ins->op)
+    {
+    case irADD:
+      emitRO("ADD", rd, ra, rb, "op +");
+      break;
+    case irSUB:
+      emitRO("SUB", rd, ra, rb, "op -");
+      break;
+    case irMUL:
+      emitRO("MUL", rd, ra, rb, "op *");
+      break;
+    case irDIV:
+      emitRO("DIV", rd, ra, rb, "op /");
+      break;
+    default:
+      emitRO("SUB", ac, ra, rb, "compare");
+      break;
+    }
+    unborrow();
+  }
+  if (irIsRelation(ins->op))
+  {
+    if (rd != ac)
+    {
+      emitRM("LDC", rd, 1, 0, "true case");
+      emitRM(jumpName(ins->op), ac, 1, PC, "br if true");
+      emitRM("LDC", rd, 0, 0, "false case");
+    }
+    else
+    {
+      emitRM(jumpName(ins->op), ac, 2, PC, "br if true");
+      emitRM("LDC", ac, 0, 0, "false case");
+      emitRM("LDA", PC, 1, PC, "unconditional jmp");
+      emitRM("LDC", ac, 1, 0, "true case");
+    }
+  }
+  keep(ins, rd);
+}
+
+static void lowerBranch(IrIns *ins)
+{
+  IrArg a = ins->a, b = ins->b;
+  IrOp rel = ins->rel;
+  int ra, rb, value;
+  if (a.kind == argCONST && b.kind != argCONST)
+  {
+    a = ins->b;
+    b = ins->a;
+    rel = irSwap(rel);
+  }
+  if (a.kind == argCONST)
+  {
+    if (irFold(rel, a.val, b.val, &value) && value)
+      jumpTo("LDA", PC, ins->label);
+    return;
+  }
+  if (b.kind == argCONST)
+  {
+    ra = fetch(a, ac);
+    if (b.val != 0)
+    {
+      emitRM("LDA", ac, -b.val, ra, "compare with const");
+      ra = ac;
+    }
+  }
+  else
+  {
+    fetchPair(ins, a, b, &ra, &rb);
+    emitRO("SUB", ac, ra, rb, "compare");
+    unborrow();
+    ra = ac;
+  }
+  jumpTo(jumpName(rel), ra, ins->label);
+}
+
+/* Procedure lowerCall builds the frame of the
+ * callee with one move of sp, over the saved fp,
+ * the return address and the callee's words, and
+ * puts each argument in its param word from there.
+ * The callee saves fp itself if it needs it.
+ */
+static void lowerCall(IrIns *ins)
+{
+  int i, r, retPC, len;
+  if (TraceCode)
+    emitComment("-> Function Call");
+  len = ins->callee >= 0 ? frames[ins->callee].size : 0;
+  emitRM("LDA", sp, FP_LOCALS_OFFSET - len, sp, "Prologue: Allocating the frame");
+  for (i = 0; i < ins->nargs; i++)
+  {
+    r = fetch(ins->args[i], ac);
+    emitRM("ST", r, len - i, sp, "Storing arg value in the new frame");
+  }
+  /* 3 instructions up to the return point */
+  retPC = emitSkip(0) + 3;
+  emitRM("LDC", ac, retPC, 0, "Storing return address on ac");
+  emitRM("ST", ac, len + 1, sp, "Store return address on stack");
+  callTo(ins->callee);
+  if (ins->dst >= 0)
+  {
+    if (target(ins) != ac)
+      emitRM("LDA", target(ins), 0, ac, "move the result");
+    keep(ins, ac);
+  }
+  if (TraceCode)
+    emitComment("<- Function Call");
+}
+
+/* Function tailCall tells if ins is a call whose
+ * value the function returns right away. It is
+ * not one when the function has arrays in its
+ * frame, whose addresses the callee may have.
+ */
+static int tailCall(IrIns *ins)
+{
+  int s;
+  if (OptLevel <= 0 || fn->isMain || ins->op != irCALL || ins->callee < 0 ||
+      ins->next == NULL || ins->next->op != irRET ||
+      (ins->next->a.kind != argNONE && (ins->next->a.kind != argTEMP || ins->next->a.val != ins->dst)))
+    return FALSE;
+  for (s = 0; s < fn->nslots; s++)
+    if (fn->slots[s].kind == slLOCAL && fn->slots[s].isArray)
+      return FALSE;
+  return TRUE;
+}
+
+/* Procedure lowerTailCall makes the callee take
+ * over the frame: the arguments become the params,
+ * the saved fp and return address stay, and the
+ * callee returns straight to our caller. fp is
+ * given back first, for the callee to save again.
+ * Arguments are staged below sp when one of them
+ * is read from a word that an earlier one
+ * overwrites.
+ */
+static void lowerTailCall(IrIns *ins)
+{
+  int i, j, r, t, staged = FALSE;
+  if (TraceCode)
+    emitComment("-> Tail Call");
+  for (j = 0; j < ins->nargs; j++)
+  {
+    t = ins->args[j].val;
+    if (ins->args[j].kind == argTEMP && fr->reg[t] < 0 && fr->remat[t] < 0)
+      for (i = 0; i < j; i++)
+        if (fr->home[t] == FP_LOCALS_OFFSET - i)
+          staged = TRUE;
+  }
+  for (i = 0; i < ins->nargs; i++)
+  {
+    r = fetch(ins->args[i], ac);
+    if (staged)
+      emitRM("ST", r, -i, sp, "Staging arg value below sp");
+    else
+      emitRM("ST", r, FP_LOCALS_OFFSET - i, fp, "Storing arg value in param");
+  }
+  if (staged)
+    for (i = 0; i < ins->nargs; i++)
+    {
+      emitRM("LD", ac, -i, sp, "Loading staged arg value");
+      emitRM("ST", ac, FP_LOCALS_OFFSET - i, fp, "Storing arg value in param");
+    }
+  emitRM("LDA", sp, FP_LOCALS_OFFSET - frames[ins->callee].size, fp, "Allocating memory for the callee");
+  emitRM("LD", fp, 0, fp, "Restoring previous FP");
+  callTo(ins->callee);
+  if (TraceCode)
+    emitComment("<- Tail Call");
+}
+
+/* Procedure lowerReturn puts the value in ac and
+ * goes to the epilogue, which every return of the
+ * function shares at its end
+ */
+static void lowerReturn(IrIns *ins)
+{
+  IrIns *p;
+  int r;
+  if (fn->isMain)
+  {
+    emitRO("HALT", 0, 0, 0, "return from main");
+    return;
+  }
+  if (ins->a.kind != argNONE)
+  {
+    r = fetch(ins->a, ac);
+    if (r != ac)
+      emitRM("LDA", ac, 0, r, "return value in ac");
+  }
+  for (p = ins->next; p != NULL && (p->op == irLABEL || p->op == irNOP); p = p->next)
+    ;
+  if (p != NULL)
+    jumpTo("LDA", PC, fn->nlabels);
+}
+
+/* Procedure lowerEpilogue destroys the frame, gives
+ * the caller its fp back and returns
+ */
+static void lowerEpilogue(void)
+{
+  if (TraceCode)
+    emitComment("-> Function Epilogue");
+  if (fr->leaf)
+    emitRM("LDA", sp, -FP_LOCALS_OFFSET + fr->size, sp, "Destroying the frame");
+  else
+  {
+    emitRM("LDA", sp, 0, fp, "Destroying the frame");
+    emitRM("LD", fp, 0, sp, "Restoring previous FP");
+  }
+  emitRM("LD", PC, -1, sp, "return");
+  if (TraceCode)
+    emitComment("<- Function Epilogue");
+}
+
+static void lowerIns(IrIns *ins)
+{
+  IrSlot *s = ins->slot >= 0 ? &fn->slots[ins->slot] : NULL;
+  int ra, rb, rd;
+  switch (ins->op)
+  {
+  case irMOVE:
+    rd = target(ins);
+    if (ins->a.kind == argCONST)
+      emitRM("LDC", rd, ins->a.val, 0, "load const");
+    else
+    {
+      ra = fetch(ins->a, rd);
+      if (ra != rd)
+        emitRM("LDA", rd, 0, ra, "move");
+    }
+    keep(ins, rd);
+    break;
+  case irLOAD:
+    /* a temp spilled to the slot it comes from */
+    if (fr->reg[ins->dst] < 0 && s->kind != slGLOBAL && fr->home[ins->dst] == frameWord(s))
+      break;
+    rd = target(ins);
+    emitRM("LD", rd, slotOffset(s), slotBase(s), s->kind == slGLOBAL ? "load global" : "load local");
+    keep(ins, rd);
+    break;
+  case irSTORE:
+    ra = fetch(ins->a, ac);
+    emitRM("ST", ra, slotOffset(s), slotBase(s), s->kind == slGLOBAL ? "store global" : "store local");
+    break;
+  case irADDR:
+    if (fr->reg[ins->dst] < 0 && fr->remat[ins->dst] >= 0)
+      break;
+    rd = target(ins);
+    emitRM("LDA", rd, slotOffset(s), slotBase(s), "array address");
+    keep(ins, rd);
+    break;
+  case irLDI:
+    ra = fetch(ins->a, ac);
+    rd = target(ins);
+    emitRM("LD", rd, ins->off, ra, "load array element");
+    keep(ins, rd);
+    break;
+  case irSTI:
+    fetchPair(ins, ins->a, ins->b, &ra, &rb);
+    emitRM("ST", rb, ins->off, ra, "store array element");
+    unborrow();
+    break;
+  case irIN:
+    rd = target(ins);
+    emitRO("IN", rd, 0, 0, "read integer value");
+    keep(ins, rd);
+    break;
+  case irOUT:
+    ra = fetch(ins->a, ac);
+    emitRO("OUT", ra, 0, 0, "write value");
+    break;
+  case irCALL:
+    lowerCall(ins);
+    break;
+  case irRET:
+    lowerReturn(ins);
+    break;
+  case irLABEL:
+    labelLoc[ins->label] = emitSkip(0);
+    break;
+  case irJUMP:
+    if (!irJumpsToNext(ins))
+      jumpTo("LDA", PC, ins->label);
+    break;
+  case irBR:
+    lowerBranch(ins);
+    break;
+  case irNOP:
+    break;
+  case irPHI:
+    emitComment("BUG: phi left in the IR");
+    break;
+  default:
+    lowerBinary(ins);
+    break;
+  }
+}
+
+static void lowerFunc(int i)
+{
+  char buf[128];
+  IrIns *ins;
+  int j, loc;
+  fn = prog->funcs[i];
+  fr = &frames[i];
+  /* label nlabels is the epilogue */
+  labelLoc = (int *)malloc((fn->nlabels + 1) * sizeof(int));
+  for (j = 0; j <= fn->nlabels; j++)
+    labelLoc[j] = -1;
+  nJumpFix = 0;
+  if (TraceCode)
+  {
+    sprintf(buf, "-> Function %.100s", fn->name);
+    emitComment(buf);
+  }
+  fr->entry = emitSkip(0);
+  /* the caller built the frame; main builds its own */
+  if (fn->isMain)
+    emitRM("LDA", sp, FP_LOCALS_OFFSET - fr->size, sp, "Prologue: Allocating the frame of main");
+  else if (!fr->leaf)
+    emitRM("ST", fp, -FP_LOCALS_OFFSET + fr->size, sp, "Prologue: Storing FP on stack");
+  if (!fr->leaf)
+    emitRM("LDA", fp, -FP_LOCALS_OFFSET + fr->size, sp, "Prologue: FP now points to current frame");
+  for (ins = fn->first; ins != NULL; ins = ins->next)
+    if (tailCall(ins))
+    {
+      lowerTailCall(ins);
+      /* its return is left to the callee */
+      ins = ins->next;
+    }
+    else
+      lowerIns(ins);
+  if (!fn->isMain)
+  {
+    labelLoc[fn->nlabels] = emitSkip(0);
+    lowerEpilogue();
+  }
+  loc = emitSkip(0);
+  for (j = 0; j < nJumpFix; j++)
+  {
+    emitBackup(jumpFix[j].loc);
+    emitRM_Abs(jumpFix[j].op, jumpFix[j].r, labelLoc[jumpFix[j].target], "jump to label");
+  }
+  if (nJumpFix > 0)
+    emitRestore();
+  if (emitSkip(0) != loc)
+    emitComment("BUG: jump fixups");
+  if (TraceCode)
+  {
+    sprintf(buf, "<- Function %.100s", fn->name);
+    emitComment(buf);
+  }
+  free(labelLoc);
+}
+
+void irLower(IrProgram *p)
+{
+  int i;
+  prog = p;
+  frames = (Frame *)calloc(p->nfuncs + 1, sizeof(Frame));
+  for (i = 0; i < p->nfuncs; i++)
+    allocate(p->funcs[i], &frames[i]);
+  nCallFix = 0;
+
+  emitComment("TINY Compilation to TM Code");
+  emitComment("Standard prelude:");
+  emitRM("LD", mp, 0, ac, "load maxaddress from location 0");
+  emitRM("ST", ac, 0, ac, "clear location 0");
+  emitRM("LDA", sp, 0, mp, "Pointing sp to top of memory");
+  emitComment("End of standard prelude.");
+  if (p->mainIndex > 0)
+    callTo(p->mainIndex);
+  for (i = 0; i < p->nfuncs; i++)
+    lowerFunc(i);
+  for (i = 0; i < nCallFix; i++)
+  {
+    emitBackup(callFix[i].loc);
+    emitRM_Abs(callFix[i].op, callFix[i].r, frames[callFix[i].target].entry, "jump to the function");
+  }
+  if (nCallFix > 0)
+    emitRestore();
+  emitComment("End of execution.");
+}
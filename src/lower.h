@@ -0,0 +1,17 @@
+/****************************************************/
+/* File: lower.h                                    */
+/* Lowering of the three-address IR to TM code      */
+/****************************************************/
+
+#ifndef _LOWER_H_
+#define _LOWER_H_
+
+#include "ir.h"
+
+/* Procedure irLower emits the TM code of prog,
+ * prelude included, through code.c; it follows
+ * the frame layout and calling sequence of cgen.c
+ */
+void irLower(IrProgram *prog);
+
+#endif
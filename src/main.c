@@ -28,6 +28,7 @@
 #include "analyze.h"
 #if !NO_CODE
 #include "cgen.h"
+#include "ir.h"
 #endif
 #endif
 #endif
@@ -45,6 +46,10 @@ int TraceScan = TRUE;
 int TraceParse = TRUE;
 int TraceAnalyze = TRUE;
 int TraceCode = TRUE;
+int TraceIR = FALSE;
+
+/* tree code generator unless -O is given */
+int OptLevel = -1;
 
 int Error = FALSE;
 
@@ -54,9 +59,22 @@ int main(int argc, char *argv[])
 
   //// opening sources ////
   char pgm[120]; /* source code file name */
-  if ((argc < 2) || (argc > 3))
+  char *prog = argv[0];
+  // options: -O0 goes through the IR, -O (-O1) optimizes it too, -D dumps it
+  for (; argc > 1 && argv[1][0] == '-'; argc--, argv++)
+  {
+    if (!strcmp(argv[1], "-O0"))
+      OptLevel = 0;
+    else if (!strcmp(argv[1], "-O") || !strcmp(argv[1], "-O1"))
+      OptLevel = 1;
+    else if (!strcmp(argv[1], "-D"))
+      TraceIR = TRUE;
+    else
+      break;
+  }
+  if ((argc < 2) || (argc > 3) || argv[1][0] == '-')
   {
-    fprintf(stderr, "usage: %s <filename> [<detailpath>]\n", argv[0]);
+    fprintf(stderr, "usage: %s [-O0|-O] [-D] <filename> [<detailpath>]\n", prog);
     exit(1);
   }
   strcpy(pgm, argv[1]);
@@ -123,7 +141,10 @@ int main(int argc, char *argv[])
       printf("Unable to open %s\n", codefile);
       exit(1);
     }
-    codeGen(syntaxTree/*, codefile*/);
+    if (OptLevel < 0)
+      codeGen(syntaxTree/*, codefile*/);
+    else
+      irCodeGen(syntaxTree);
     fclose(code);
   }
 #endif
@@ -0,0 +1,161 @@
+/****************************************************/
+/* File: opt.c                                      */
+/* Pipeline of the IR optimization passes and the   */
+/* clean-ups shared by them                         */
+/****************************************************/
+
+#include "globals.h"
+#include "ir.h"
+#include "cfg.h"
+#include "opt.h"
+
+/**************************************************/
+/***********   Dead code               ************/
+/**************************************************/
+
+/* A temp is needed when an instruction with an
+ * effect reads it, or when the instruction that
+ * computes a needed temp reads it; the marking
+ * runs until nothing changes.
+ */
+void irDeadCode(IrFunc *f)
+{
+  char *needed = (char *)calloc(f->ntemps + 1, 1);
+  int changed = TRUE, i;
+  IrIns *ins;
+  IrArg *arg;
+  while (changed)
+  {
+    changed = FALSE;
+    for (ins = f->first; ins != NULL; ins = ins->next)
+    {
+      if (!irHasEffect(ins) && (ins->dst < 0 || !needed[ins->dst]))
+        continue;
+      for (i = 0; (arg = irOperand(ins, i)) != NULL; i++)
+        if (arg->kind == argTEMP && !needed[arg->val])
+        {
+          needed[arg->val] = TRUE;
+          changed = TRUE;
+        }
+    }
+  }
+  for (ins = f->first; ins != NULL; ins = ins->next)
+    if (ins->op != irNOP && !irHasEffect(ins) && (ins->dst < 0 || !needed[ins->dst]))
+      irNop(ins);
+  free(needed);
+}
+
+/**************************************************/
+/***********   Control flow clean-up   ************/
+/**************************************************/
+
+/* removes the blocks no path from the entry reaches */
+static int removeUnreachable(IrFunc *f)
+{
+  IrCfg *cfg = cfgBuild(f);
+  IrIns *ins, *next, *last;
+  int i, changed = FALSE;
+  for (i = 0; i < cfg->nblocks; i++)
+  {
+    if (cfg->blocks[i].rpo >= 0)
+      continue;
+    last = cfg->blocks[i].last;
+    for (ins = cfg->blocks[i].first;; ins = next)
+    {
+      next = ins->next;
+      irRemove(f, ins);
+      if (ins == last)
+        break;
+    }
+    changed = TRUE;
+  }
+  cfgFree(cfg);
+  return changed;
+}
+
+void irSimplify(IrFunc *f)
+{
+  char *used = (char *)malloc(f->nlabels + 1);
+  int changed = TRUE, value;
+  IrIns *ins, *next;
+  while (changed)
+  {
+    changed = FALSE;
+    for (ins = f->first; ins != NULL; ins = next)
+    {
+      next = ins->next;
+      if (ins->op == irBR && ins->a.kind == argCONST && ins->b.kind == argCONST &&
+          irFold(ins->rel, ins->a.val, ins->b.val, &value))
+      {
+        if (value)
+        {
+          ins->op = irJUMP;
+          ins->a = ins->b = irNone;
+        }
+        else
+          irNop(ins);
+        changed = TRUE;
+      }
+      if (ins->op == irNOP || ((ins->op == irJUMP || ins->op == irBR) && irJumpsToNext(ins)))
+      {
+        irRemove(f, ins);
+        changed = TRUE;
+      }
+    }
+    memset(used, 0, f->nlabels + 1);
+    for (ins = f->first; ins != NULL; ins = ins->next)
+      if (ins->op == irJUMP || ins->op == irBR)
+        used[ins->label] = TRUE;
+    for (ins = f->first; ins != NULL; ins = next)
+    {
+      next = ins->next;
+      if (ins->op == irLABEL && !used[ins->label])
+      {
+        irRemove(f, ins);
+        changed = TRUE;
+      }
+    }
+    if (f->first != NULL && removeUnreachable(f))
+      changed = TRUE;
+  }
+  free(used);
+}
+
+/**************************************************/
+/***********   Pipeline                ************/
+/**************************************************/
+
+static void optimizeFunc(IrProgram *prog, IrFunc *f)
+{
+  IrCfg *cfg;
+  irSimplify(f);
+  addPreheaders(f);
+  cfg = ssaBuild(f);
+  sccp(cfg);
+  gvn(cfg);
+  licm(cfg);
+  reduceInductions(cfg);
+  irDeadCode(f);
+  deadStores(cfg);
+  deadLoops(cfg);
+  irDeadCode(f);
+  if (TraceIR)
+  {
+    pc("* ---- SSA form ----\n");
+    irPrintFunc(prog, f);
+  }
+  ssaDestroy(cfg);
+  irSimplify(f);
+  irDeadCode(f);
+  deadDefs(f);
+  irSimplify(f);
+}
+
+void irOptimize(IrProgram *prog)
+{
+  int i;
+  irTailRecursion(prog);
+  irInline(prog);
+  for (i = 0; i < prog->nfuncs; i++)
+    optimizeFunc(prog, prog->funcs[i]);
+}
@@ -0,0 +1,123 @@
+/****************************************************/
+/* File: opt.h                                      */
+/* IR-to-IR optimization passes of the C- compiler  */
+/* and the pipeline that runs them when OptLevel > 0 */
+/****************************************************/
+
+#ifndef _OPT_H_
+#define _OPT_H_
+
+#include "ir.h"
+#include "cfg.h"
+
+/* Procedure irOptimize runs the passes over
+ * every function of prog
+ */
+void irOptimize(IrProgram *prog);
+
+/* Procedure irTailRecursion turns the calls of a
+ * function to itself whose value it returns at
+ * once into stores to its params and a jump back
+ * to its start
+ */
+void irTailRecursion(IrProgram *prog);
+
+/* Procedure irInline replaces the calls of small
+ * functions and of functions called from one
+ * place by their bodies, within a size budget,
+ * and drops the functions no longer called
+ */
+void irInline(IrProgram *prog);
+
+/* Procedure irDeadCode turns the instructions
+ * whose results are never used into irNOPs;
+ * it works in and out of SSA form
+ */
+void irDeadCode(IrFunc *f);
+
+/* Procedure irSimplify cleans up the control
+ * flow of f: branches on constants are decided,
+ * jumps to the next instruction, unused labels,
+ * irNOPs and unreachable blocks are removed
+ */
+void irSimplify(IrFunc *f);
+
+/* Function ssaBuild puts f in SSA form: the
+ * scalar words of f (non-array locals, params
+ * and scalar globals) become temps with phis
+ * at the joins. Stores to globals are kept and
+ * globals are read again after every call. The
+ * CFG it returns must be handed to ssaDestroy;
+ * the passes in between may rewrite instructions
+ * but not the control flow.
+ */
+IrCfg *ssaBuild(IrFunc *f);
+
+/* Procedure ssaDestroy replaces the phis by
+ * copies on the incoming edges, frees cfg and
+ * coalesces the copies it can
+ */
+void ssaDestroy(IrCfg *cfg);
+
+/* Procedure sccp is sparse conditional constant
+ * propagation (Wegman and Zadeck) over SSA form:
+ * temps known to be constant are replaced by
+ * their values, decided branches get constant
+ * operands and phi operands coming from edges
+ * that are never taken are emptied
+ */
+void sccp(IrCfg *cfg);
+
+/* Procedure gvn numbers the values of SSA form
+ * down the dominator tree: an expression, address
+ * or load already computed in a dominating block
+ * is reused. Loads are only reused while no store
+ * or call comes between, and a store gives its
+ * value to the loads of the same word after it.
+ */
+void gvn(IrCfg *cfg);
+
+/* Procedure addPreheaders gives every loop of f
+ * a block of its own just before the loop test,
+ * where licm can put what it moves out
+ */
+void addPreheaders(IrFunc *f);
+
+/* Procedure licm moves the values computed the
+ * same on every trip of a loop of SSA form into
+ * the preheader of the loop, inner loops first
+ */
+void licm(IrCfg *cfg);
+
+/* Procedure reduceInductions finds the counters
+ * of the loops of SSA form, stepped by a constant
+ * on every trip. An array element indexed by one
+ * is reached through a pointer that steps along,
+ * and the loop test compares that pointer when
+ * the counter has no other use.
+ */
+void reduceInductions(IrCfg *cfg);
+
+/* Procedure deadStores removes the stores of SSA
+ * form that nothing reads: to a word no load
+ * reaches before it is stored again, a call, or
+ * the return of a function other than main, and
+ * to a local array that is never read
+ */
+void deadStores(IrCfg *cfg);
+
+/* Procedure deadLoops decides the exit test of the
+ * loops of SSA form that compute nothing used
+ * after them, when the test is on a counter sure
+ * to reach it; irSimplify then drops the loop
+ */
+void deadLoops(IrCfg *cfg);
+
+/* Procedure deadDefs removes the definitions of
+ * temps that are dead where they are made. Out of
+ * SSA form a temp may be set in several places,
+ * of which irDeadCode only drops unused ones.
+ */
+void deadDefs(IrFunc *f);
+
+#endif
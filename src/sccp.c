@@ -0,0 +1,336 @@
+/****************************************************/
+/* File: sccp.c                                     */
+/* Sparse conditional constant propagation over    */
+/* the SSA form of an IR function                   */
+/****************************************************/
+
+#include "globals.h"
+#include "ir.h"
+#include "cfg.h"
+#include "opt.h"
+
+/* what is known of the value of a temp */
+typedef enum
+{
+  vTOP,   /* nothing yet: its definition has not run */
+  vCONST, /* always the same constant */
+  vBOTTOM /* not a constant */
+} Level;
+
+static IrCfg *cfg;
+static Level *level;   /* by temp */
+static int *value;     /* by temp, when vCONST */
+static IrIns **defOf;  /* by temp */
+static int *useStart;  /* uses of temp t are useList[useStart[t] .. useStart[t+1]-1] */
+static IrIns **useList;
+static char *reached;  /* by block */
+static char *taken;    /* edge k of block b at 2*b+k */
+
+/* worklists of instructions and of blocks */
+static IrIns **insWork;
+static int nInsWork, maxInsWork;
+static int *blockWork;
+static int nBlockWork;
+
+static void pushIns(IrIns *ins)
+{
+  if (nInsWork == maxInsWork)
+  {
+    maxInsWork = maxInsWork ? 2 * maxInsWork : 64;
+    insWork = (IrIns **)realloc(insWork, maxInsWork * sizeof(IrIns *));
+  }
+  insWork[nInsWork++] = ins;
+}
+
+/* Procedure lower moves temp t down the lattice,
+ * queueing its uses when that changes anything
+ */
+static void lower(int t, Level l, int c)
+{
+  int i;
+  if (l == vCONST && level[t] == vCONST && value[t] != c)
+    l = vBOTTOM;
+  if (l <= level[t])
+    return;
+  level[t] = l;
+  value[t] = c;
+  for (i = useStart[t]; i < useStart[t + 1]; i++)
+    pushIns(useList[i]);
+}
+
+static Level levelOf(IrArg a, int *c)
+{
+  if (a.kind == argCONST)
+  {
+    *c = a.val;
+    return vCONST;
+  }
+  if (a.kind == argTEMP)
+  {
+    *c = value[a.val];
+    return level[a.val];
+  }
+  return vBOTTOM;
+}
+
+/* Function evalBinary works out a op b; x - x and
+ * the relations of x with itself are known
+ * whatever x is
+ */
+static Level evalBinary(IrOp op, IrArg a, IrArg b, int *c)
+{
+  int x, y;
+  Level la = levelOf(a, &x), lb = levelOf(b, &y);
+  if (a.kind == argTEMP && b.kind == argTEMP && a.val == b.val &&
+      (op == irSUB || irIsRelation(op)))
+  {
+    irFold(op, 0, 0, c);
+    return vCONST;
+  }
+  if (la == vBOTTOM || lb == vBOTTOM)
+    return vBOTTOM;
+  if (la == vTOP || lb == vTOP)
+    return vTOP;
+  return irFold(op, x, y, c) ? vCONST : vBOTTOM;
+}
+
+static int edgeTaken(int from, int to)
+{
+  IrBlock *b = &cfg->blocks[from];
+  int k;
+  for (k = 0; k < b->nsucc; k++)
+    if (b->succ[k] == to)
+      return taken[2 * from + k];
+  return FALSE;
+}
+
+static void visitPhis(int b);
+
+static void take(int b, int k)
+{
+  int s = cfg->blocks[b].succ[k];
+  if (taken[2 * b + k])
+    return;
+  taken[2 * b + k] = TRUE;
+  if (!reached[s])
+  {
+    reached[s] = TRUE;
+    blockWork[nBlockWork++] = s;
+  }
+  else
+    visitPhis(s);
+}
+
+static void visitBranch(IrIns *ins, int b)
+{
+  IrBlock *blk = &cfg->blocks[b];
+  int c, k;
+  Level l = evalBinary(ins->rel, ins->a, ins->b, &c);
+  if (l == vTOP)
+    return;
+  for (k = 0; k < blk->nsucc; k++)
+    if (l == vBOTTOM || blk->nsucc == 1 ||
+        (blk->succ[k] == cfg->labelBlock[ins->label]) == (c != 0))
+      take(b, k);
+}
+
+static void visit(IrIns *ins)
+{
+  int b = ins->mark, c = 0, j, x;
+  IrBlock *blk = &cfg->blocks[b];
+  Level l;
+  if (!reached[b])
+    return;
+  switch (ins->op)
+  {
+  case irPHI:
+    l = vTOP;
+    for (j = 0; j < ins->nargs; j++)
+    {
+      Level la;
+      if (ins->args[j].kind == argNONE || !edgeTaken(blk->pred[j], b))
+        continue;
+      la = levelOf(ins->args[j], &x);
+      if (la == vBOTTOM || (la == vCONST && l == vCONST && x != c))
+        l = vBOTTOM;
+      else if (la == vCONST && l == vTOP)
+      {
+        l = vCONST;
+        c = x;
+      }
+    }
+    lower(ins->dst, l, c);
+    break;
+  case irMOVE:
+    l = levelOf(ins->a, &c);
+    lower(ins->dst, l, c);
+    break;
+  case irBR:
+    visitBranch(ins, b);
+    break;
+  case irJUMP:
+    take(b, 0);
+    break;
+  default:
+    if (ins->dst < 0)
+      break;
+    if (irIsBinary(ins->op))
+      l = evalBinary(ins->op, ins->a, ins->b, &c);
+    else
+      l = vBOTTOM;
+    lower(ins->dst, l, c);
+    break;
+  }
+}
+
+static void visitPhis(int b)
+{
+  IrIns *ins;
+  for (ins = cfg->blocks[b].first;; ins = ins->next)
+  {
+    if (ins->op == irPHI)
+      pushIns(ins);
+    else if (ins->op != irLABEL)
+      break;
+    if (ins == cfg->blocks[b].last)
+      break;
+  }
+}
+
+static void visitBlock(int b)
+{
+  IrBlock *blk = &cfg->blocks[b];
+  IrIns *ins;
+  for (ins = blk->first;; ins = ins->next)
+  {
+    visit(ins);
+    if (ins == blk->last)
+      break;
+  }
+  if (!irIsBranch(blk->last) && blk->nsucc > 0)
+    take(b, 0);
+}
+
+/* Procedure collect numbers the instructions by
+ * block and finds the definition and uses of
+ * every temp
+ */
+static void collect(void)
+{
+  int n = cfg->func->ntemps, b, i, t;
+  IrIns *ins;
+  IrArg *arg;
+  defOf = (IrIns **)calloc(n + 1, sizeof(IrIns *));
+  useStart = (int *)calloc(n + 2, sizeof(int));
+  for (b = 0; b < cfg->nblocks; b++)
+    for (ins = cfg->blocks[b].first;; ins = ins->next)
+    {
+      ins->mark = b;
+      if (ins->dst >= 0)
+        defOf[ins->dst] = ins;
+      for (i = 0; (arg = irOperand(ins, i)) != NULL; i++)
+        if (arg->kind == argTEMP)
+          useStart[arg->val + 1]++;
+      if (ins == cfg->blocks[b].last)
+        break;
+    }
+  for (t = 0; t < n; t++)
+    useStart[t + 1] += useStart[t];
+  useList = (IrIns **)malloc((useStart[n] + 1) * sizeof(IrIns *));
+  for (b = 0; b < cfg->nblocks; b++)
+    for (ins = cfg->blocks[b].first;; ins = ins->next)
+    {
+      for (i = 0; (arg = irOperand(ins, i)) != NULL; i++)
+        if (arg->kind == argTEMP)
+          useList[useStart[arg->val]++] = ins;
+      if (ins == cfg->blocks[b].last)
+        break;
+    }
+  /* the fill moved every start to the next one */
+  for (t = n; t > 0; t--)
+    useStart[t] = useStart[t - 1];
+  useStart[0] = 0;
+}
+
+/* Procedure rewrite applies what was found:
+ * constant temps are replaced by their values,
+ * phis forget the edges never taken and branches
+ * that always go one way get constant operands
+ */
+static void rewrite(void)
+{
+  int n = cfg->func->ntemps, t, i, b, j;
+  IrArg *arg;
+  IrIns *ins;
+  IrBlock *blk;
+  for (t = 0; t < n; t++)
+  {
+    if (level[t] != vCONST)
+      continue;
+    for (i = useStart[t]; i < useStart[t + 1]; i++)
+    {
+      for (j = 0; (arg = irOperand(useList[i], j)) != NULL; j++)
+        if (arg->kind == argTEMP && arg->val == t)
+          *arg = irConst(value[t]);
+    }
+    if (defOf[t] != NULL && !irHasEffect(defOf[t]))
+      irNop(defOf[t]);
+  }
+  for (b = 0; b < cfg->nblocks; b++)
+  {
+    blk = &cfg->blocks[b];
+    for (ins = blk->first;; ins = ins->next)
+    {
+      if (ins->op == irPHI)
+        for (j = 0; j < ins->nargs; j++)
+          if (!edgeTaken(blk->pred[j], b))
+            ins->args[j] = irNone;
+      if (ins == blk->last)
+        break;
+    }
+    ins = blk->last;
+    if (reached[b] && ins->op == irBR && blk->nsucc == 2 && taken[2 * b] != taken[2 * b + 1])
+    {
+      ins->a = ins->b = irConst(0);
+      ins->rel = taken[2 * b] == (blk->succ[0] == cfg->labelBlock[ins->label]) ? irEQ : irNE;
+    }
+  }
+}
+
+void sccp(IrCfg *g)
+{
+  int n = g->func->ntemps, t;
+  cfg = g;
+  level = (Level *)malloc((n + 1) * sizeof(Level));
+  value = (int *)calloc(n + 1, sizeof(int));
+  for (t = 0; t < n; t++)
+    level[t] = vTOP;
+  reached = (char *)calloc(cfg->nblocks + 1, 1);
+  taken = (char *)calloc(2 * cfg->nblocks + 2, 1);
+  blockWork = (int *)malloc((cfg->nblocks + 1) * sizeof(int));
+  nBlockWork = nInsWork = 0;
+  collect();
+
+  reached[0] = TRUE;
+  blockWork[nBlockWork++] = 0;
+  while (nBlockWork > 0 || nInsWork > 0)
+  {
+    if (nBlockWork > 0)
+      visitBlock(blockWork[--nBlockWork]);
+    else
+      visit(insWork[--nInsWork]);
+  }
+  rewrite();
+
+  free(level);
+  free(value);
+  free(defOf);
+  free(useStart);
+  free(useList);
+  free(reached);
+  free(taken);
+  free(blockWork);
+  free(insWork);
+  insWork = NULL;
+  maxInsWork = 0;
+}
@@ -0,0 +1,560 @@
+/****************************************************/
+/* File: ssa.c                                      */
+/* Construction of SSA form over the scalar words   */
+/* of an IR function (Cytron et al.) and the way    */
+/* back to ordinary temps                           */
+/****************************************************/
+
+#include "globals.h"
+#include "ir.h"
+#include "cfg.h"
+#include "opt.h"
+
+/* values a promoted slot had on the way down the
+ * dominator tree
+ */
+typedef struct
+{
+  IrArg *vals;
+  int n, max;
+} ValStack;
+
+static IrFunc *fn;
+static IrCfg *cfg;
+static char *promoted;   /* for each slot */
+static ValStack *stacks; /* for each slot */
+static IrArg *repl;      /* value of each removed load, by temp */
+
+/* Function promotable tells the slots that are a
+ * single word: scalars, and array params, which
+ * hold the address of the array
+ */
+static int promotable(IrSlot *s)
+{
+  return s->kind == slPARAM || !s->isArray;
+}
+
+/* Procedure defineAt inserts "t = load s" for a
+ * value of s that comes from memory: marked, it is
+ * a definition of s rather than a use
+ */
+static void defineAt(IrIns *after, int s)
+{
+  IrIns *ins = irNewIns(irLOAD);
+  ins->dst = irNewTemp(fn);
+  ins->slot = s;
+  ins->mark = TRUE;
+  if (after != NULL)
+    ins->lineno = after->lineno;
+  irInsertAfter(fn, after, ins);
+}
+
+/* Procedure prepare chooses the slots to promote
+ * and defines them at the entry and, for globals,
+ * after every call
+ */
+static void prepare(void)
+{
+  int s;
+  IrIns *ins;
+  promoted = (char *)calloc(fn->nslots + 1, 1);
+  for (ins = fn->first; ins != NULL; ins = ins->next)
+  {
+    ins->mark = FALSE;
+    if (ins->op == irLOAD && promotable(&fn->slots[ins->slot]))
+      promoted[ins->slot] = TRUE;
+  }
+  for (ins = fn->first; ins != NULL; ins = ins->next)
+    if (ins->op == irCALL)
+      for (s = 0; s < fn->nslots; s++)
+        if (promoted[s] && fn->slots[s].kind == slGLOBAL)
+          defineAt(ins, s);
+  for (s = fn->nslots - 1; s >= 0; s--)
+    if (promoted[s])
+      defineAt(NULL, s);
+  /* the entry block must have no predecessors */
+  if (fn->first == NULL || fn->first->op == irLABEL)
+    irInsertAfter(fn, NULL, irNewIns(irNOP));
+}
+
+/**************************************************/
+/***********   Phi placement           ************/
+/**************************************************/
+
+/* frontier[x * nblocks + y]: y is in the dominance
+ * frontier of x
+ */
+static char *frontier;
+
+static void frontiers(void)
+{
+  int n = cfg->nblocks, b, j, r;
+  IrBlock *blk;
+  frontier = (char *)calloc(n * n + 1, 1);
+  for (b = 0; b < n; b++)
+  {
+    blk = &cfg->blocks[b];
+    if (blk->npred < 2)
+      continue;
+    for (j = 0; j < blk->npred; j++)
+      for (r = blk->pred[j]; r >= 0 && r != blk->idom; r = cfg->blocks[r].idom)
+        frontier[r * n + b] = TRUE;
+  }
+}
+
+static void insertPhi(int b, int s)
+{
+  IrBlock *blk = &cfg->blocks[b];
+  IrIns *ins = irNewIns(irPHI), *after = NULL, *p;
+  int i;
+  ins->dst = irNewTemp(fn);
+  ins->slot = s;
+  ins->lineno = blk->first->lineno;
+  ins->nargs = blk->npred;
+  ins->args = (IrArg *)malloc((blk->npred + 1) * sizeof(IrArg));
+  for (i = 0; i < blk->npred; i++)
+    ins->args[i] = irNone;
+  /* after the labels of the block */
+  for (p = blk->first; p->op == irLABEL; p = p->next)
+  {
+    after = p;
+    if (p == blk->last)
+      break;
+  }
+  if (after == NULL)
+  {
+    irInsertBefore(fn, blk->first, ins);
+    blk->first = ins;
+  }
+  else
+  {
+    irInsertAfter(fn, after, ins);
+    if (after == blk->last)
+      blk->last = ins;
+  }
+}
+
+/* Procedure placePhis puts a phi for every
+ * promoted slot in the iterated dominance
+ * frontier of the blocks that define it
+ */
+static void placePhis(void)
+{
+  int n = cfg->nblocks, s, b, x, y, top;
+  int *hasPhi = (int *)malloc((n + 1) * sizeof(int));
+  int *queued = (int *)malloc((n + 1) * sizeof(int));
+  int *work = (int *)malloc((n + 1) * sizeof(int));
+  IrIns *ins;
+  for (b = 0; b < n; b++)
+    hasPhi[b] = queued[b] = -1;
+  for (s = 0; s < fn->nslots; s++)
+  {
+    if (!promoted[s])
+      continue;
+    top = 0;
+    for (b = 0; b < n; b++)
+      for (ins = cfg->blocks[b].first;; ins = ins->next)
+      {
+        if (ins->slot == s && (ins->op == irSTORE || (ins->op == irLOAD && ins->mark)) && queued[b] != s)
+        {
+          queued[b] = s;
+          work[top++] = b;
+        }
+        if (ins == cfg->blocks[b].last)
+          break;
+      }
+    while (top > 0)
+    {
+      x = work[--top];
+      for (y = 0; y < n; y++)
+        if (frontier[x * n + y] && hasPhi[y] != s)
+        {
+          insertPhi(y, s);
+          hasPhi[y] = s;
+          if (queued[y] != s)
+          {
+            queued[y] = s;
+            work[top++] = y;
+          }
+        }
+    }
+  }
+  free(hasPhi);
+  free(queued);
+  free(work);
+}
+
+/**************************************************/
+/***********   Renaming                ************/
+/**************************************************/
+
+static void push(int s, IrArg v)
+{
+  ValStack *st = &stacks[s];
+  if (st->n == st->max)
+  {
+    st->max = st->max ? 2 * st->max : 8;
+    st->vals = (IrArg *)realloc(st->vals, st->max * sizeof(IrArg));
+  }
+  st->vals[st->n++] = v;
+}
+
+static IrArg top(int s)
+{
+  return stacks[s].n > 0 ? stacks[s].vals[stacks[s].n - 1] : irNone;
+}
+
+/* Procedure renameBlock walks the dominator
+ * tree from block b: loads of promoted slots give
+ * way to the value on top of the stack of the
+ * slot, stores and phis push new values, and the
+ * phis of the successors get their operand for b
+ */
+static void renameBlock(int b)
+{
+  IrBlock *blk = &cfg->blocks[b], *sb;
+  int *saved = (int *)malloc((fn->nslots + 1) * sizeof(int));
+  int i, j, s;
+  IrIns *ins;
+  IrArg *arg;
+  for (s = 0; s < fn->nslots; s++)
+    saved[s] = stacks[s].n;
+  for (ins = blk->first;; ins = ins->next)
+  {
+    if (ins->op != irPHI)
+      for (i = 0; (arg = irOperand(ins, i)) != NULL; i++)
+        if (arg->kind == argTEMP && repl[arg->val].kind != argNONE)
+          *arg = repl[arg->val];
+    s = ins->slot;
+    if (s >= 0 && promoted[s])
+      switch (ins->op)
+      {
+      case irPHI:
+        push(s, irTemp(ins->dst));
+        break;
+      case irLOAD:
+        if (ins->mark)
+        {
+          push(s, irTemp(ins->dst));
+          ins->mark = FALSE;
+        }
+        else
+        {
+          repl[ins->dst] = top(s);
+          irNop(ins);
+        }
+        break;
+      case irSTORE:
+        push(s, ins->a);
+        /* callees and the code after a call read globals from memory */
+        if (fn->slots[s].kind != slGLOBAL)
+          irNop(ins);
+        break;
+      default:
+        break;
+      }
+    if (ins == blk->last)
+      break;
+  }
+  for (i = 0; i < blk->nsucc; i++)
+  {
+    sb = &cfg->blocks[blk->succ[i]];
+    for (j = 0; j < sb->npred && sb->pred[j] != b; j++)
+      ;
+    for (ins = sb->first;; ins = ins->next)
+    {
+      if (ins->op == irPHI)
+        ins->args[j] = top(ins->slot);
+      else if (ins->op != irLABEL)
+        break;
+      if (ins == sb->last)
+        break;
+    }
+  }
+  for (i = 0; i < blk->nkids; i++)
+    renameBlock(blk->kids[i]);
+  for (s = 0; s < fn->nslots; s++)
+    stacks[s].n = saved[s];
+  free(saved);
+}
+
+IrCfg *ssaBuild(IrFunc *f)
+{
+  int s, t;
+  fn = f;
+  prepare();
+  cfg = cfgBuild(f);
+  frontiers();
+  placePhis();
+  stacks = (ValStack *)calloc(f->nslots + 1, sizeof(ValStack));
+  repl = (IrArg *)malloc((f->ntemps + 1) * sizeof(IrArg));
+  for (t = 0; t < f->ntemps; t++)
+    repl[t] = irNone;
+  renameBlock(0);
+  for (s = 0; s < f->nslots; s++)
+    free(stacks[s].vals);
+  free(stacks);
+  free(repl);
+  free(frontier);
+  free(promoted);
+  return cfg;
+}
+
+/**************************************************/
+/***********   Out of SSA              ************/
+/**************************************************/
+
+typedef struct
+{
+  int dst;
+  IrArg src;
+} Copy;
+
+static IrIns *newMove(int dst, IrArg src, int lineno)
+{
+  IrIns *ins = irNewIns(irMOVE);
+  ins->dst = dst;
+  ins->a = src;
+  ins->lineno = lineno;
+  return ins;
+}
+
+/* Function sequence orders the parallel copies c
+ * into moves, breaking cycles with a new temp
+ */
+static int sequence(Copy *c, int n, IrIns **out, int lineno)
+{
+  int k = 0, i, j, t;
+  while (n > 0)
+  {
+    for (i = 0; i < n; i++)
+    {
+      for (j = 0; j < n; j++)
+        if (j != i && c[j].src.kind == argTEMP && c[j].src.val == c[i].dst)
+          break;
+      if (j == n)
+        break;
+    }
+    if (i < n)
+    {
+      out[k++] = newMove(c[i].dst, c[i].src, lineno);
+      c[i] = c[--n];
+    }
+    else
+    {
+      /* only cycles are left: save one destination */
+      t = irNewTemp(fn);
+      out[k++] = newMove(t, irTemp(c[0].dst), lineno);
+      for (j = 0; j < n; j++)
+        if (c[j].src.kind == argTEMP && c[j].src.val == c[0].dst)
+          c[j].src = irTemp(t);
+    }
+  }
+  return k;
+}
+
+static int writes(Copy *c, int n, IrArg a)
+{
+  int i;
+  for (i = 0; i < n; i++)
+    if (a.kind == argTEMP && a.val == c[i].dst)
+      return TRUE;
+  return FALSE;
+}
+
+/* Function beforeBranch tells whether the copies
+ * of the taken edge p->b may go before the branch
+ * ending p: they must not change what the branch
+ * or the other way out of p reads
+ */
+static int beforeBranch(int p, int b, Copy *c, int n)
+{
+  IrIns *br = cfg->blocks[p].last, *ins;
+  IrBlock *sb;
+  int s, j;
+  if (writes(c, n, br->a) || writes(c, n, br->b))
+    return FALSE;
+  if (p + 1 >= cfg->nblocks || (s = p + 1) == b)
+    return TRUE;
+  /* a temp defined in b is only live into blocks b dominates */
+  if (cfgDominates(cfg, b, s))
+    return FALSE;
+  sb = &cfg->blocks[s];
+  for (j = 0; j < sb->npred && sb->pred[j] != p; j++)
+    ;
+  for (ins = sb->first;; ins = ins->next)
+  {
+    if (ins->op == irPHI && j < ins->nargs && writes(c, n, ins->args[j]))
+      return FALSE;
+    if (ins->op != irPHI && ins->op != irLABEL && ins->op != irNOP)
+      break;
+    if (ins == sb->last)
+      break;
+  }
+  return TRUE;
+}
+
+/* Procedure placeCopies puts the copies of the
+ * edge p->b at the end of p, or on a block of
+ * their own when the edge is the taken way out
+ * of a branch and they cannot go before it
+ */
+static void placeCopies(int p, int b, Copy *c, int n)
+{
+  IrIns *last = cfg->blocks[p].last, *ins;
+  IrIns **moves = (IrIns **)malloc((2 * n + 1) * sizeof(IrIns *));
+  int k = sequence(c, n, moves, last->lineno), i, label;
+  if (last->op == irJUMP || (last->op == irBR && cfg->labelBlock[last->label] == b && beforeBranch(p, b, c, n)))
+    for (i = 0; i < k; i++)
+      irInsertBefore(fn, last, moves[i]);
+  else if (last->op == irBR && cfg->labelBlock[last->label] == b)
+  {
+    label = irNewLabel(fn);
+    ins = irNewIns(irLABEL);
+    ins->label = label;
+    irInsertBefore(fn, NULL, ins);
+    for (i = 0; i < k; i++)
+      irInsertBefore(fn, NULL, moves[i]);
+    ins = irNewIns(irJUMP);
+    ins->label = last->label;
+    irInsertBefore(fn, NULL, ins);
+    last->label = label;
+  }
+  else
+    /* falling through into b */
+    for (i = k - 1; i >= 0; i--)
+      irInsertAfter(fn, last, moves[i]);
+  free(moves);
+}
+
+/* Function find follows the merges of coalesce */
+static int find(int *alias, int t)
+{
+  while (alias[t] != t)
+    t = alias[t] = alias[alias[t]];
+  return t;
+}
+
+/* Procedure coalesce merges the two temps of a
+ * move when they are never live at the same time,
+ * which removes most of the copies left by the
+ * phis. Two temps interfere when one is defined
+ * where the other is live, the source of a move
+ * aside.
+ */
+static void coalesce(IrFunc *f)
+{
+  IrCfg *g = cfgBuild(f);
+  int n = f->ntemps, w, b, i, k, t, d, s;
+  unsigned *adj, *live;
+  int *alias = (int *)malloc((n + 1) * sizeof(int));
+  IrIns *ins;
+  IrArg *arg;
+  cfgLiveness(g);
+  w = g->words;
+  adj = (unsigned *)calloc(n * w + 1, sizeof(unsigned));
+  live = (unsigned *)malloc(w * sizeof(unsigned));
+  for (b = 0; b < g->nblocks; b++)
+  {
+    memcpy(live, g->blocks[b].liveOut, w * sizeof(unsigned));
+    for (ins = g->blocks[b].last;; ins = ins->prev)
+    {
+      if (ins->dst >= 0)
+      {
+        for (t = 0; t < n; t++)
+          if (t != ins->dst && cfgLive(live, t) &&
+              !(ins->op == irMOVE && ins->a.kind == argTEMP && ins->a.val == t))
+          {
+            cfgSetLive(&adj[ins->dst * w], t, TRUE);
+            cfgSetLive(&adj[t * w], ins->dst, TRUE);
+          }
+        cfgSetLive(live, ins->dst, FALSE);
+      }
+      for (i = 0; (arg = irOperand(ins, i)) != NULL; i++)
+        if (arg->kind == argTEMP)
+          cfgSetLive(live, arg->val, TRUE);
+      if (ins == g->blocks[b].first)
+        break;
+    }
+  }
+  for (t = 0; t < n; t++)
+    alias[t] = t;
+  for (ins = f->first; ins != NULL; ins = ins->next)
+  {
+    if (ins->op != irMOVE || ins->a.kind != argTEMP)
+      continue;
+    d = find(alias, ins->dst);
+    s = find(alias, ins->a.val);
+    if (d == s || cfgLive(&adj[d * w], s))
+      continue;
+    alias[s] = d;
+    for (k = 0; k < w; k++)
+      adj[d * w + k] |= adj[s * w + k];
+    for (t = 0; t < n; t++)
+      if (cfgLive(&adj[s * w], t))
+        cfgSetLive(&adj[t * w], d, TRUE);
+  }
+  for (ins = f->first; ins != NULL; ins = ins->next)
+  {
+    if (ins->dst >= 0)
+      ins->dst = find(alias, ins->dst);
+    for (i = 0; (arg = irOperand(ins, i)) != NULL; i++)
+      if (arg->kind == argTEMP)
+        arg->val = find(alias, arg->val);
+    if (ins->op == irMOVE && ins->a.kind == argTEMP && ins->a.val == ins->dst)
+      irNop(ins);
+  }
+  free(adj);
+  free(live);
+  free(alias);
+  cfgFree(g);
+}
+
+void ssaDestroy(IrCfg *g)
+{
+  int b, j, n, max = 8;
+  Copy *c = (Copy *)malloc(max * sizeof(Copy));
+  IrBlock *blk;
+  IrIns *ins;
+  cfg = g;
+  fn = g->func;
+  for (b = 0; b < cfg->nblocks; b++)
+  {
+    blk = &cfg->blocks[b];
+    for (j = 0; j < blk->npred; j++)
+    {
+      n = 0;
+      /* the phis follow the labels; dead ones are irNOPs by now */
+      for (ins = blk->first; ins->op == irPHI || ins->op == irLABEL || ins->op == irNOP; ins = ins->next)
+      {
+        if (ins->op == irPHI && ins->args[j].kind != argNONE &&
+            !(ins->args[j].kind == argTEMP && ins->args[j].val == ins->dst))
+        {
+          if (n == max)
+          {
+            max *= 2;
+            c = (Copy *)realloc(c, max * sizeof(Copy));
+          }
+          c[n].dst = ins->dst;
+          c[n].src = ins->args[j];
+          n++;
+        }
+        if (ins == blk->last)
+          break;
+      }
+      if (n > 0)
+        placeCopies(blk->pred[j], b, c, n);
+    }
+  }
+  for (b = 0; b < cfg->nblocks; b++)
+    for (ins = cfg->blocks[b].first;; ins = ins->next)
+    {
+      if (ins->op == irPHI)
+        irNop(ins);
+      if (ins == cfg->blocks[b].last)
+        break;
+    }
+  free(c);
+  cfgFree(cfg);
+  coalesce(fn);
+}
@@ -222,6 +222,9 @@ ScopeMemLock st_lookup_memloc(char *scope, char *name)
   int scopeHash = hash(scope);
   ScopeBucketList s = hashTable[scopeHash];
   ScopeMemLock sc;
+  /* other scopes may share the bucket */
+  while ((s != NULL) && (strcmp(scope, s->scopeName) != 0))
+    s = s->next;
   while (s != NULL)
   {
     // pc("Looking for %s in scope %s\n", name, s->scopeName);
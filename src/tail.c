@@ -0,0 +1,92 @@
+/****************************************************/
+/* File: tail.c                                     */
+/* Tail recursion: a function returning the value  */
+/* of a call to itself stores the arguments in its */
+/* params and jumps back to its start instead       */
+/****************************************************/
+
+#include "globals.h"
+#include "ir.h"
+#include "opt.h"
+
+/* Function tailPosition tells if f returns the
+ * value of call right after it, through labels
+ * and jumps
+ */
+static int tailPosition(IrFunc *f, IrIns *call)
+{
+  IrIns *ins = call->next, *p;
+  int steps = 0;
+  while (ins != NULL && steps++ < f->nlabels + 1)
+  {
+    if (ins->op == irLABEL || ins->op == irNOP)
+      ins = ins->next;
+    else if (ins->op == irJUMP)
+    {
+      for (p = f->first; p != NULL; p = p->next)
+        if (p->op == irLABEL && p->label == ins->label)
+          break;
+      ins = p;
+    }
+    else
+      return ins->op == irRET &&
+             (ins->a.kind == argNONE || (ins->a.kind == argTEMP && ins->a.val == call->dst));
+  }
+  return FALSE;
+}
+
+/* TRUE if call passes an array of the frame of f,
+ * which the jump would have the callee share
+ */
+static int passesFrame(IrFunc *f, IrIns *call)
+{
+  IrIns *ins;
+  int i;
+  for (i = 0; i < call->nargs; i++)
+    if (call->args[i].kind == argTEMP)
+      for (ins = f->first; ins != NULL; ins = ins->next)
+        if (ins->op == irADDR && ins->dst == call->args[i].val &&
+            f->slots[ins->slot].kind != slGLOBAL)
+          return TRUE;
+  return FALSE;
+}
+
+void irTailRecursion(IrProgram *prog)
+{
+  IrFunc *f;
+  IrIns *ins, *next, *start, *p;
+  int i, j;
+  for (i = 0; i < prog->nfuncs; i++)
+  {
+    f = prog->funcs[i];
+    start = NULL;
+    for (ins = f->first; ins != NULL; ins = next)
+    {
+      next = ins->next;
+      if (ins->op != irCALL || ins->callee != i || ins->nargs != f->nparams ||
+          !tailPosition(f, ins) || passesFrame(f, ins))
+        continue;
+      if (start == NULL)
+      {
+        start = irNewIns(irLABEL);
+        start->label = irNewLabel(f);
+        start->lineno = f->first->lineno;
+        irInsertBefore(f, f->first, start);
+      }
+      /* the arguments are all computed before the first store */
+      for (j = 0; j < ins->nargs; j++)
+      {
+        p = irNewIns(irSTORE);
+        p->slot = j;
+        p->a = ins->args[j];
+        p->lineno = ins->lineno;
+        irInsertBefore(f, ins, p);
+      }
+      p = irNewIns(irJUMP);
+      p->label = start->label;
+      p->lineno = ins->lineno;
+      irInsertBefore(f, ins, p);
+      irRemove(f, ins);
+    }
+  }
+}
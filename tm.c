@@ -3,12 +3,25 @@
 /* The TM ("Tiny Machine") computer                 */
 /* Compiler Construction: Principles and Practice   */
 /* Kenneth C. Louden                                */
+/* The simulator itself is in tmlib/libtm.c; this   */
+/* file is its command line and REPL front end      */
 /****************************************************/
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include "libtm.h"
 
 #ifndef TRUE
 #define TRUE 1
@@ -18,64 +31,29 @@
 #endif
 
 /******* const *******/
-#define   IADDR_SIZE  1024 /* increase for large programs */
-#define   DADDR_SIZE  1024 /* increase for large programs */
-#define   NO_REGS 8
-#define   PC_REG  7
-
 #define   LINESIZE  121
 #define   WORDSIZE  20
 
-/******* type  *******/
+#define   HEAT_MAGIC    0x4d484d54 /* "TMHM" */
+#define   OUTBUF_SIZE   65536
+#define   SLICE         (1L << 20) /* instructions a session runs per turn */
 
-typedef enum {
-   opclRR,     /* reg operands r,s,t */
-   opclRM,     /* reg r, mem d+s */
-   opclRA      /* reg r, int d+s */
-   } OPCLASS;
-
-typedef enum {
-   /* RR instructions */
-   opHALT,    /* RR     halt, operands are ignored */
-   opIN,      /* RR     read into reg(r); s and t are ignored */
-   opOUT,     /* RR     write from reg(r), s and t are ignored */
-   opADD,    /* RR     reg(r) = reg(s)+reg(t) */
-   opSUB,    /* RR     reg(r) = reg(s)-reg(t) */
-   opMUL,    /* RR     reg(r) = reg(s)*reg(t) */
-   opDIV,    /* RR     reg(r) = reg(s)/reg(t) */
-   opRRLim,   /* limit of RR opcodes */
-
-   /* RM instructions */
-   opLD,      /* RM     reg(r) = mem(d+reg(s)) */
-   opST,      /* RM     mem(d+reg(s)) = reg(r) */
-   opRMLim,   /* Limit of RM opcodes */
-
-   /* RA instructions */
-   opLDA,     /* RA     reg(r) = d+reg(s) */
-   opLDC,     /* RA     reg(r) = d ; reg(s) is ignored */
-   opJLT,     /* RA     if reg(r)<0 then reg(7) = d+reg(s) */
-   opJLE,     /* RA     if reg(r)<=0 then reg(7) = d+reg(s) */
-   opJGT,     /* RA     if reg(r)>0 then reg(7) = d+reg(s) */
-   opJGE,     /* RA     if reg(r)>=0 then reg(7) = d+reg(s) */
-   opJEQ,     /* RA     if reg(r)==0 then reg(7) = d+reg(s) */
-   opJNE,     /* RA     if reg(r)!=0 then reg(7) = d+reg(s) */
-   opRALim    /* Limit of RA opcodes */
-   } OPCODE;
-
-typedef enum {
-   srOKAY,
-   srHALT,
-   srIMEM_ERR,
-   srDMEM_ERR,
-   srZERODIVIDE
-   } STEPRESULT;
+/******* type  *******/
 
+/* files behind the IN/OUT callbacks of one machine */
 typedef struct {
-      int iop  ;
-      int iarg1  ;
-      int iarg2  ;
-      int iarg3  ;
-   } INSTRUCTION;
+      FILE * in ;        /* source of IN values */
+      FILE * out ;       /* destination of OUT and HALT lines */
+      int termFallback ; /* continue IN from the terminal when in ends */
+      /* buffered I/O (-B): all of in, read before the run */
+      int * inVals ;
+      long inCount ;
+      long inNext ;
+      size_t inMapped ;  /* bytes mmap'd for inVals, 0 if malloc'd */
+      char * outBuf ;    /* OUT and HALT lines, written when full */
+      size_t outLen ;
+      int rawOut ;       /* out gets the OUT values as int32 words */
+   } FILEIO;
 
 /******** vars ********/
 int iloc = 0 ;
@@ -83,51 +61,58 @@ int dloc = 0 ;
 int traceflag = FALSE;
 int icountflag = FALSE;
 
-INSTRUCTION iMem [IADDR_SIZE];
-int dMem [DADDR_SIZE];
-int reg [NO_REGS];
+/* instruction budget and wall-clock limit per run (0 = none) */
+long budget = 0 ;
+double timeLimit = 0 ;
+/* memory profile output (REPL) or suffix (batch); NULL = off */
+char * heatName = NULL ;
+/* buffered I/O, and where its OUT values go (REPL) or the */
+/* suffix replacing .out (batch); NULL = stdout / .out     */
+int bufferflag = FALSE ;
+char * outName = NULL ;
+/* statistics output (REPL) or suffix (batch), NULL = off, */
+/* and how many opcode pairs and triples it lists          */
+char * statsName = NULL ;
+int topK = 10 ;
+/* cycle-cost model, used when costflag is set */
+int costflag = FALSE ;
+TM_COSTS costs ;
+/* auto-checkpoint every ckptInterval instructions (0 = off) */
+long ckptInterval = 0 ;
+long nextCkpt = 0 ;
+char snapName[LINESIZE] ;
+/* lowest stack address, guarded below (0 = no guard) */
+int guardLimit = 0 ;
 
-char * opCodeTab[]
-        = {"HALT","IN","OUT","ADD","SUB","MUL","DIV","????",
-            /* RR opcodes */
-           "LD","ST","????", /* RM opcodes */
-           "LDA","LDC","JLT","JLE","JGT","JGE","JEQ","JNE","????"
-           /* RA opcodes */
-          };
+/* the program and the machine driven by the REPL */
+TM_PROGRAM * prog ;
+TM_MACHINE * mach ;
+FILEIO machIO ;
+MEMPROF * prof ;
+TM_STATS * stats ;
 
-char * stepResultTab[]
-        = {"OK","Halted","Instruction Memory Fault",
-           "Data Memory Fault","Division by 0"
-          };
-
-char pgmName[20];
-FILE *pgm  ;
+char pgmName[LINESIZE];
 
 char in_Line[LINESIZE] ;
 int lineLen ;
 int inCol  ;
 int num  ;
 char word[WORDSIZE] ;
+char path[LINESIZE] ;
 char ch  ;
 int done  ;
 
-/********************************************/
-int opClass( int c )
-{ if      ( c <= opRRLim) return ( opclRR );
-  else if ( c <= opRMLim) return ( opclRM );
-  else                    return ( opclRA );
-} /* opClass */
-
 /********************************************/
 void writeInstruction ( int loc )
-{ printf( "%5d: ", loc) ;
-  if ( (loc >= 0) && (loc < IADDR_SIZE) )
-  { printf("%6s%3d,", opCodeTab[iMem[loc].iop], iMem[loc].iarg1);
-    switch ( opClass(iMem[loc].iop) )
-    { case opclRR: printf("%1d,%1d", iMem[loc].iarg2, iMem[loc].iarg3);
+{ INSTRUCTION ins;
+  printf( "%5d%c ", loc, tmIsBreak(prog, loc) ? '*' : ':') ;
+  if ( (loc < tmProgramSize(prog)) && tmGetInstruction(prog, loc, &ins) )
+  { printf("%6s%3d,", tmOpName(ins.iop), ins.iarg1);
+    switch ( tmOpClass(ins.iop) )
+    { case opclRR: printf("%1d,%1d", ins.iarg2, ins.iarg3);
                    break;
       case opclRM:
-      case opclRA: printf("%3d(%1d)", iMem[loc].iarg2, iMem[loc].iarg3);
+      case opclRA: printf("%3d(%1d)", ins.iarg2, ins.iarg3);
                    break;
     }
     printf ("\n") ;
@@ -195,14 +180,17 @@ int getWord (void)
 } /* getWord */
 
 /********************************************/
-int skipCh ( char c  )
-{ int temp = FALSE;
-  if ( nonBlank() && (ch == c) )
-  { getCh();
-    temp = TRUE;
+int getPath (void)
+{ int length = 0;
+  if (nonBlank ())
+  { while ((inCol < lineLen) && (ch != ' '))
+    { if (length < LINESIZE-1) path [length++] =  ch ;
+      getCh() ;
+    }
   }
-  return temp;
-} /* skipCh */
+  path[length] = '\0';
+  return (length != 0);
+} /* getPath */
 
 /********************************************/
 int atEOL(void)
@@ -210,199 +198,321 @@ int atEOL(void)
 } /* atEOL */
 
 /********************************************/
-int error( char * msg, int lineNo, int instNo)
-{ printf("Line %d",lineNo);
-  if (instNo >= 0) printf(" (Instruction %d)",instNo);
-  printf("   %s\n",msg);
+int readValue ( FILE * f, int * val )
+{ char line[LINESIZE];
+  char * end;
+  long v;
+  while (fgets(line, LINESIZE, f) != NULL)
+  { v = strtol(line, &end, 10);
+    if (end != line)
+    { *val = (int) v;
+      return TRUE;
+    }
+  }
   return FALSE;
-} /* error */
-
-/********************************************/
-int readInstructions (void)
-{ OPCODE op;
-  int arg1, arg2, arg3;
-  int loc, regNo, lineNo;
-  for (regNo = 0 ; regNo < NO_REGS ; regNo++)
-      reg[regNo] = 0 ;
-  dMem[0] = DADDR_SIZE - 1 ;
-  for (loc = 1 ; loc < DADDR_SIZE ; loc++)
-      dMem[loc] = 0 ;
-  for (loc = 0 ; loc < IADDR_SIZE ; loc++)
-  { iMem[loc].iop = opHALT ;
-    iMem[loc].iarg1 = 0 ;
-    iMem[loc].iarg2 = 0 ;
-    iMem[loc].iarg3 = 0 ;
-  }
-  lineNo = 0 ;
-  while (! feof(pgm))
-  { fgets( in_Line, LINESIZE-2, pgm  ) ;
-    inCol = 0 ; 
-    lineNo++;
-    lineLen = strlen(in_Line)-1 ;
-    if (in_Line[lineLen]=='\n') in_Line[lineLen] = '\0' ;
-    else in_Line[++lineLen] = '\0';
-    if ( (nonBlank()) && (in_Line[inCol] != '*') )
-    { if (! getNum())
-        return error("Bad location", lineNo,-1);
-      loc = num;
-      if (loc > IADDR_SIZE)
-        return error("Location too large",lineNo,loc);
-      if (! skipCh(':'))
-        return error("Missing colon", lineNo,loc);
-      if (! getWord ())
-        return error("Missing opcode", lineNo,loc);
-      op = opHALT ;
-      while ((op < opRALim)
-             && (strncmp(opCodeTab[op], word, 4) != 0) )
-          op++ ;
-      if (strncmp(opCodeTab[op], word, 4) != 0)
-          return error("Illegal opcode", lineNo,loc);
-      switch ( opClass(op) )
-      { case opclRR :
-        /***********************************/
-        if ( (! getNum ()) || (num < 0) || (num >= NO_REGS) )
-            return error("Bad first register", lineNo,loc);
-        arg1 = num;
-        if ( ! skipCh(','))
-            return error("Missing comma", lineNo, loc);
-        if ( (! getNum ()) || (num < 0) || (num >= NO_REGS) )
-            return error("Bad second register", lineNo, loc);
-        arg2 = num;
-        if ( ! skipCh(',')) 
-            return error("Missing comma", lineNo,loc);
-        if ( (! getNum ()) || (num < 0) || (num >= NO_REGS) )
-            return error("Bad third register", lineNo,loc);
-        arg3 = num;
-        break;
+} /* readValue */
 
-        case opclRM :
-        case opclRA :
-        /***********************************/
-        if ( (! getNum ()) || (num < 0) || (num >= NO_REGS) )
-            return error("Bad first register", lineNo,loc);
-        arg1 = num;
-        if ( ! skipCh(','))
-            return error("Missing comma", lineNo,loc);
-        if (! getNum ())
-            return error("Bad displacement", lineNo,loc);
-        arg2 = num;
-        if ( ! skipCh('(') && ! skipCh(',') )
-            return error("Missing LParen", lineNo,loc);
-        if ( (! getNum ()) || (num < 0) || (num >= NO_REGS))
-            return error("Bad second register", lineNo,loc);
-        arg3 = num;
-        break;
-        }
-      iMem[loc].iop = op;
-      iMem[loc].iarg1 = arg1;
-      iMem[loc].iarg2 = arg2;
-      iMem[loc].iarg3 = arg3;
-    }
+/********************************************/
+/* I/O callbacks on a FILEIO                */
+/********************************************/
+int fileIn ( void * user, int * value )
+{ FILEIO * io = (FILEIO *) user;
+  int ok;
+  if (io->in != stdin)
+  { if (readValue(io->in, value)) return TRUE;
+    if (! io->termFallback) return FALSE;
+    /* input file exhausted: continue from the terminal */
+    fclose(io->in);
+    io->in = stdin ;
+  }
+  do
+  { printf("Enter value for IN instruction: ") ;
+    fflush (stdin);
+    fflush (stdout);
+    gets(in_Line);
+    lineLen = strlen(in_Line) ;
+    inCol = 0;
+    ok = getNum();
+    if ( ! ok ) printf ("Illegal value\n");
+    else *value = num;
   }
+  while (! ok);
   return TRUE;
-} /* readInstructions */
+} /* fileIn */
+
+void fileOut ( void * user, int value )
+{ fprintf(((FILEIO *) user)->out, "OUT instruction prints: %d\n", value);
+} /* fileOut */
+
+void fileHalt ( void * user, int r, int s, int t )
+{ fprintf(((FILEIO *) user)->out, "HALT: %1d,%1d,%1d\n", r, s, t);
+} /* fileHalt */
 
+const TM_IO fileIO = { fileIn, fileOut, fileHalt } ;
 
 /********************************************/
-STEPRESULT stepTM (void)
-{ INSTRUCTION currentinstruction  ;
-  int pc  ;
-  int r,s,t,m  ;
-  int ok ;
+/* Buffered I/O. The input file is read at  */
+/* once: a name ending in .bin is mmap'd as */
+/* int32 words, other files are parsed as   */
+/* readValue would, one number per line.    */
+/* OUT and HALT lines (or raw int32 values) */
+/* collect in outBuf, which is written when */
+/* full, at HALT and when the run ends.     */
+/********************************************/
+int endsWith ( char * name, char * suffix )
+{ size_t len = strlen(name), slen = strlen(suffix);
+  return (len > slen) && ! strcmp(name + len - slen, suffix) ;
+} /* endsWith */
 
-  pc = reg[PC_REG] ;
-  if ( (pc < 0) || (pc > IADDR_SIZE)  )
-      return srIMEM_ERR ;
-  reg[PC_REG] = pc + 1 ;
-  currentinstruction = iMem[ pc ] ;
-  switch (opClass(currentinstruction.iop) )
-  { case opclRR :
-    /***********************************/
-      r = currentinstruction.iarg1 ;
-      s = currentinstruction.iarg2 ;
-      t = currentinstruction.iarg3 ;
-      break;
+int readInput ( FILEIO * io, char * inName )
+{ struct stat st;
+  char * text, * p, * end;
+  long n = 0;
+  io->inNext = 0 ;
+  io->inCount = 0 ;
+  io->inMapped = 0 ;
+  io->inVals = NULL ;
+  if (fstat(fileno(io->in), &st) != 0) return FALSE;
+  if (endsWith(inName, ".bin"))
+  { io->inCount = st.st_size / sizeof(int) ;
+    if (io->inCount == 0) return TRUE;
+    io->inMapped = io->inCount * sizeof(int) ;
+    io->inVals = (int *) mmap(NULL, io->inMapped, PROT_READ, MAP_PRIVATE,
+                              fileno(io->in), 0);
+    if (io->inVals != MAP_FAILED) return TRUE;
+    io->inVals = NULL ;
+    io->inMapped = 0 ;
+    return FALSE;
+  }
+  text = (char *) malloc(st.st_size + 1);
+  /* at most one value per two bytes */
+  io->inVals = (int *) malloc((st.st_size / 2 + 1) * sizeof(int));
+  if ( (text == NULL) || (io->inVals == NULL)
+       || (fread(text, 1, st.st_size, io->in) != (size_t) st.st_size) )
+  { free(text);
+    free(io->inVals);
+    io->inVals = NULL ;
+    return FALSE;
+  }
+  text[st.st_size] = '\0' ;
+  p = text ;
+  while (*p != '\0')
+  { long v = strtol(p, &end, 10);
+    if (end != p) io->inVals[n++] = (int) v ;
+    p = strchr(end, '\n');
+    if (p == NULL) break;
+    p++ ;
+  }
+  io->inCount = n ;
+  free(text);
+  return TRUE;
+} /* readInput */
 
-    case opclRM :
-    /***********************************/
-      r = currentinstruction.iarg1 ;
-      s = currentinstruction.iarg3 ;
-      m = currentinstruction.iarg2 + reg[s] ;
-      if ( (m < 0) || (m > DADDR_SIZE))
-         return srDMEM_ERR ;
-      break;
+/********************************************/
+int openBuffers ( FILEIO * io, char * inName, int rawOut )
+{ io->rawOut = rawOut ;
+  io->outLen = 0 ;
+  io->outBuf = (char *) malloc(OUTBUF_SIZE);
+  if (io->outBuf == NULL) return FALSE;
+  if ((io->in != stdin) && readInput(io, inName)) return TRUE;
+  if (io->in == stdin)
+  { io->inVals = NULL ;
+    io->inCount = io->inNext = 0 ;
+    io->inMapped = 0 ;
+    return TRUE;
+  }
+  free(io->outBuf);
+  io->outBuf = NULL ;
+  return FALSE;
+} /* openBuffers */
 
-    case opclRA :
-    /***********************************/
-      r = currentinstruction.iarg1 ;
-      s = currentinstruction.iarg3 ;
-      m = currentinstruction.iarg2 + reg[s] ;
-      break;
-  } /* case */
+/********************************************/
+void flushOut ( FILEIO * io )
+{ if (io->outLen > 0)
+    fwrite(io->outBuf, 1, io->outLen, io->out);
+  io->outLen = 0 ;
+} /* flushOut */
 
-  switch ( currentinstruction.iop)
-  { /* RR instructions */
-    case opHALT :
-    /***********************************/
-      printf("HALT: %1d,%1d,%1d\n",r,s,t);
-      return srHALT ;
-      /* break; */
+/********************************************/
+void closeBuffers ( FILEIO * io )
+{ flushOut(io);
+  if (io->inMapped > 0) munmap(io->inVals, io->inMapped);
+  else free(io->inVals);
+  free(io->outBuf);
+  io->inVals = NULL ;
+  io->outBuf = NULL ;
+} /* closeBuffers */
 
-    case opIN :
-    /***********************************/
-      do
-      { printf("Enter value for IN instruction: ") ;
-        fflush (stdin);
-        fflush (stdout);
-        gets(in_Line);
-        lineLen = strlen(in_Line) ;
-        inCol = 0;
-        ok = getNum();
-        if ( ! ok ) printf ("Illegal value\n");
-        else reg[r] = num;
-      }
-      while (! ok);
-      break;
+/********************************************/
+int bufIn ( void * user, int * value )
+{ FILEIO * io = (FILEIO *) user;
+  if (io->inNext >= io->inCount) return FALSE;
+  *value = io->inVals[io->inNext++] ;
+  return TRUE;
+} /* bufIn */
 
-    case opOUT :  
-      printf ("OUT instruction prints: %d\n", reg[r] ) ;
-      break;
-    case opADD :  reg[r] = reg[s] + reg[t] ;  break;
-    case opSUB :  reg[r] = reg[s] - reg[t] ;  break;
-    case opMUL :  reg[r] = reg[s] * reg[t] ;  break;
+void bufOut ( void * user, int value )
+{ static const char prefix[] = "OUT instruction prints: ";
+  FILEIO * io = (FILEIO *) user;
+  char digits[12];
+  char * p = io->outBuf ;
+  unsigned int u = (value < 0) ? - (unsigned int) value : (unsigned int) value;
+  int n = 0;
+  if (io->outLen + sizeof(prefix) + sizeof(digits) + 1 > OUTBUF_SIZE)
+    flushOut(io);
+  p += io->outLen ;
+  if (io->rawOut)
+  { memcpy(p, &value, sizeof(int));
+    io->outLen += sizeof(int) ;
+    return;
+  }
+  memcpy(p, prefix, sizeof(prefix) - 1);
+  p += sizeof(prefix) - 1 ;
+  if (value < 0) *p++ = '-' ;
+  do
+  { digits[n++] = (char) ('0' + u % 10) ;
+    u /= 10 ;
+  } while (u != 0);
+  while (n > 0) *p++ = digits[--n] ;
+  *p++ = '\n' ;
+  io->outLen = p - io->outBuf ;
+} /* bufOut */
 
-    case opDIV :
-    /***********************************/
-      if ( reg[t] != 0 ) reg[r] = reg[s] / reg[t];
-      else return srZERODIVIDE ;
-      break;
+void bufHalt ( void * user, int r, int s, int t )
+{ FILEIO * io = (FILEIO *) user;
+  if (! io->rawOut)
+  { if (io->outLen + 3 * 12 + 10 > OUTBUF_SIZE) flushOut(io);
+    io->outLen += sprintf(io->outBuf + io->outLen, "HALT: %1d,%1d,%1d\n",
+                          r, s, t);
+  }
+  flushOut(io);
+} /* bufHalt */
 
-    /*************** RM instructions ********************/
-    case opLD :    reg[r] = dMem[m] ;  break;
-    case opST :    dMem[m] = reg[r] ;  break;
+const TM_IO bufIO = { bufIn, bufOut, bufHalt } ;
 
-    /*************** RA instructions ********************/
-    case opLDA :    reg[r] = m ; break;
-    case opLDC :    reg[r] = currentinstruction.iarg2 ;   break;
-    case opJLT :    if ( reg[r] <  0 ) reg[PC_REG] = m ; break;
-    case opJLE :    if ( reg[r] <=  0 ) reg[PC_REG] = m ; break;
-    case opJGT :    if ( reg[r] >  0 ) reg[PC_REG] = m ; break;
-    case opJGE :    if ( reg[r] >=  0 ) reg[PC_REG] = m ; break;
-    case opJEQ :    if ( reg[r] == 0 ) reg[PC_REG] = m ; break;
-    case opJNE :    if ( reg[r] != 0 ) reg[PC_REG] = m ; break;
+/********************************************/
+/* read the cycle-cost model: one setting   */
+/* per line, # starts a comment             */
+/*    <OPCODE> <cycles>  cost of an opcode  */
+/*    mem <cycles>       extra for LD/ST    */
+/*    taken <cycles>     extra for a jump   */
+/* Opcodes not mentioned cost 1 cycle.      */
+/********************************************/
+int readCostModel ( char * fname )
+{ FILE * f;
+  char line[LINESIZE], name[WORDSIZE];
+  int op, n, cost, lineNo = 0, memCost = 0;
+  f = fopen(fname,"r");
+  if (f == NULL)
+  { printf("cost file '%s' not found\n",fname);
+    return FALSE;
+  }
+  for (op = opHALT ; op <= opRALim ; op++) costs.op[op] = 1 ;
+  costs.taken = 0 ;
+  while (fgets(line, LINESIZE, f) != NULL)
+  { lineNo++ ;
+    if (strchr(line,'#') != NULL) *strchr(line,'#') = '\0' ;
+    n = sscanf(line, "%19s %d", name, &cost) ;
+    if (n == EOF) continue;
+    if ((n != 2) || (cost < 0))
+    { printf("%s, line %d: expected <name> <cycles>\n",fname,lineNo);
+      fclose(f);
+      return FALSE;
+    }
+    if      (strcmp(name,"mem") == 0)   memCost = cost ;
+    else if (strcmp(name,"taken") == 0) costs.taken = cost ;
+    else if ((op = tmLookupOpcode(name, strlen(name))) >= 0)
+      costs.op[op] = cost ;
+    else
+    { printf("%s, line %d: unknown opcode %s\n",fname,lineNo,name);
+      fclose(f);
+      return FALSE;
+    }
+  }
+  fclose(f);
+  costs.op[opBRK] = 0 ;
+  costs.op[opLD] += memCost ;
+  costs.op[opST] += memCost ;
+  costflag = TRUE ;
+  return TRUE;
+} /* readCostModel */
 
-    /* end of legal instructions */
-  } /* case */
-  return srOKAY ;
-} /* stepTM */
+/********************************************/
+int guardMachine ( TM_MACHINE * m )
+{ if ( (guardLimit > 0) && ! tmSetGuard(m, guardLimit) )
+  { printf("Cannot guard the stack below %d\n",guardLimit);
+    return FALSE;
+  }
+  return TRUE;
+} /* guardMachine */
+
+/********************************************/
+/* snapshots of the REPL machine also keep  */
+/* the position in its input file           */
+/********************************************/
+int saveSnapshot ( char * fname )
+{ char err[TM_ERRSIZE];
+  long inPos = -1 ;
+  if (bufferflag) inPos = machIO.inNext ;
+  else if (machIO.in != stdin) inPos = ftell(machIO.in);
+  if (! tmSaveSnapshot(mach, fname, inPos, err))
+  { printf("%s\n",err);
+    return FALSE;
+  }
+  return TRUE;
+} /* saveSnapshot */
+
+/********************************************/
+int loadSnapshot ( char * fname )
+{ char err[TM_ERRSIZE];
+  long inPos ;
+  if (! tmLoadSnapshot(mach, fname, &inPos, err))
+  { printf("%s\n",err);
+    return FALSE;
+  }
+  if ((inPos >= 0) && bufferflag)
+    machIO.inNext = (inPos < machIO.inCount) ? inPos : machIO.inCount ;
+  else if ((inPos >= 0) && (machIO.in != stdin))
+    fseek(machIO.in, inPos, SEEK_SET);
+  if (ckptInterval > 0)
+    nextCkpt = tmInsCount(mach) + ckptInterval ;
+  return TRUE;
+} /* loadSnapshot */
+
+/********************************************/
+void autoCheckpoint (void)
+{ if ( ! saveSnapshot(snapName) )
+    ckptInterval = 0 ;
+  nextCkpt += ckptInterval ;
+} /* autoCheckpoint */
+
+/********************************************/
+/* one instruction with trace, or a run to  */
+/* the next checkpoint (or the end) without */
+/********************************************/
+STEPRESULT runSome ( long maxSteps )
+{ STEPRESULT stepResult;
+  long toCkpt = nextCkpt - tmInsCount(mach) ;
+  if ( traceflag )
+  { iloc = tmGetReg(mach, PC_REG) ;
+    writeInstruction( iloc ) ;
+    maxSteps = 1 ;
+  }
+  if ( (ckptInterval > 0) && ((maxSteps <= 0) || (toCkpt < maxSteps)) )
+    maxSteps = toCkpt ;
+  stepResult = tmRun(mach, maxSteps) ;
+  if ( (ckptInterval > 0) && (tmInsCount(mach) == nextCkpt) )
+    autoCheckpoint ();
+  return stepResult ;
+} /* runSome */
 
 /********************************************/
 int doCommand (void)
 { char cmd;
-  int stepcnt=0, i;
+  long stepcnt=0, count, cycles;
+  int i;
   int printcnt;
   int stepResult;
-  int regNo, loc;
   do
   { printf ("Enter command: ");
     fflush (stdin);
@@ -440,8 +550,19 @@ int doCommand (void)
       printf("   p(rint         "\
              "Toggle print of total instructions executed"\
              " ('go' only)\n");
+      printf("   b(reak <loc>   "\
+             "Toggle a breakpoint at loc, or list them\n");
+      printf("   w(atch <b <n>> "\
+             "Toggle a watch on stores to n dMem locations\n"\
+             "                  starting at b, or list them\n");
       printf("   c(lear         "\
              "Reset simulator for new execution of program\n");
+      printf("   v(erify        "\
+             "Summarize the load-time verifier results\n");
+      printf("   k(eep <file>   "\
+             "Save a snapshot of the machine state\n");
+      printf("   l(oad <file>   "\
+             "Restore the machine state from a snapshot\n");
       printf("   h(elp          "\
              "Cause this list of commands to be printed\n");
       printf("   q(uit          "\
@@ -467,7 +588,7 @@ int doCommand (void)
     case 'r' :
     /***********************************/
       for (i = 0; i < NO_REGS; i++)
-      { printf("%1d: %4d    ", i,reg[i]);
+      { printf("%1d: %4d    ", i,tmGetReg(mach, i));
         if ( (i % 4) == 3 ) printf ("\n");
       }
       break;
@@ -482,7 +603,7 @@ int doCommand (void)
       if ( ! atEOL ())
         printf ("Instruction locations?\n");
       else
-      { while ((iloc >= 0) && (iloc < IADDR_SIZE)
+      { while ((iloc >= 0) && (iloc < tmProgramSize(prog))
                 && (printcnt > 0) )
         { writeInstruction(iloc);
           iloc++ ;
@@ -503,23 +624,100 @@ int doCommand (void)
       else
       { while ((dloc >= 0) && (dloc < DADDR_SIZE)
                   && (printcnt > 0))
-        { printf("%5d: %5d\n",dloc,dMem[dloc]);
+        { printf("%5d: %5d\n",dloc,tmGetMem(mach, dloc));
           dloc++;
           printcnt--;
         }
       }
       break;
 
+    case 'b' :
+    /***********************************/
+      if ( atEOL ())
+      { for (i = 0; i < tmProgramSize(prog); i++)
+          if ( tmIsBreak(prog, i) ) writeInstruction(i);
+      }
+      else if ( ! getNum () || ! atEOL ()
+                || (num < 0) || (num >= tmProgramSize(prog)) )
+        printf("Breakpoint location?\n");
+      else if ( tmClearBreak(prog, num) )
+        printf("Breakpoint at %d removed\n", num);
+      else if ( tmSetBreak(prog, num) )
+        printf("Breakpoint at %d set\n", num);
+      else printf("Out of memory\n");
+      break;
+
+    case 'w' :
+    /***********************************/
+      { int lo = 0, hi ;
+        if ( atEOL ())
+        { for (i = 0; tmGetWatch(prog, i, &lo, &hi); i++)
+            printf("dMem[%d..%d]\n", lo, hi);
+          break;
+        }
+        printcnt = 1 ;
+        if ( getNum ())
+        { lo = num ;
+          if ( getNum ()) printcnt = num ;
+        }
+        if ( ! atEOL () || (printcnt < 1) || (lo < 0)
+             || (lo + printcnt > DADDR_SIZE) )
+          printf("Watch locations?\n");
+        else if ( tmRemoveWatch(prog, lo, lo + printcnt - 1) )
+          printf("Watch on dMem[%d..%d] removed\n", lo, lo + printcnt - 1);
+        else if ( tmAddWatch(prog, lo, lo + printcnt - 1) )
+          printf("Watch on dMem[%d..%d] set\n", lo, lo + printcnt - 1);
+        else printf("Out of memory\n");
+      }
+      break;
+
     case 'c' :
     /***********************************/
       iloc = 0;
       dloc = 0;
       stepcnt = 0;
-      for (regNo = 0;  regNo < NO_REGS ; regNo++)
-            reg[regNo] = 0 ;
-      dMem[0] = DADDR_SIZE - 1 ;
-      for (loc = 1 ; loc < DADDR_SIZE ; loc++)
-            dMem[loc] = 0 ;
+      tmReset(mach);
+      nextCkpt = ckptInterval ;
+      break;
+
+    case 'v' :
+    /***********************************/
+      { int n = tmProgramExtent (prog), pcOk = 0, gpRel = 0, pcRel = 0 ;
+        int memOk = 0, mem = 0, check ;
+        INSTRUCTION ins ;
+        for (i = 0 ; i < n ; i++)
+        { check = tmCheckFlags(prog, i) ;
+          tmGetInstruction(prog, i, &ins) ;
+          if (check & vfPC_OK) pcOk++ ;
+          if (tmOpClass(ins.iop) != opclRM) continue ;
+          mem++ ;
+          if (check & vfMEM_OK) memOk++ ;
+          if (check & vfGP_REL) gpRel++ ;
+          if (check & vfPC_REL) pcRel++ ;
+        }
+        printf("%d of %d instructions have verified successors\n",
+               pcOk, n);
+        printf("%d of %d LD/ST verified in range "
+               "(%d gp-relative, %d pc-relative), %d computed\n",
+               memOk, mem, gpRel, pcRel, mem - memOk);
+      }
+      break;
+
+    case 'k' :
+    /***********************************/
+      if ( ! getPath ())
+        printf("Snapshot file?\n");
+      else if ( saveSnapshot(path) )
+        printf("Snapshot saved to %s\n",path);
+      break;
+
+    case 'l' :
+    /***********************************/
+      if ( ! getPath ())
+        printf("Snapshot file?\n");
+      else if ( loadSnapshot(path) )
+        printf("Snapshot restored from %s (%ld instructions)\n",
+               path, tmInsCount(mach));
       break;
 
     case 'q' : return FALSE;  /* break; */
@@ -528,59 +726,1341 @@ int doCommand (void)
   }  /* case */
   stepResult = srOKAY;
   if ( stepcnt > 0 )
-  { if ( cmd == 'g' )
-    { stepcnt = 0;
-      while (stepResult == srOKAY)
-      { iloc = reg[PC_REG] ;
-        if ( traceflag ) writeInstruction( iloc ) ;
-        stepResult = stepTM ();
-        stepcnt++;
-      }
+  { tmSetLimits(mach, budget, timeLimit);
+    tmSkipBreak(mach);
+    count = tmInsCount(mach);
+    cycles = tmCycles(mach);
+    if ( cmd == 'g' )
+    { while (stepResult == srOKAY)
+        stepResult = runSome (0);
       if ( icountflag )
-        printf("Number of instructions executed = %d\n",stepcnt);
+      { printf("Number of instructions executed = %ld\n",
+               tmInsCount(mach) - count);
+        if ( costflag )
+          printf("Estimated cycles = %ld\n",tmCycles(mach) - cycles);
+      }
     }
     else
-    { while ((stepcnt > 0) && (stepResult == srOKAY))
-      { iloc = reg[PC_REG] ;
-        if ( traceflag ) writeInstruction( iloc ) ;
-        stepResult = stepTM ();
-        stepcnt-- ;
-      }
+    { while ((stepResult == srOKAY)
+             && (tmInsCount(mach) - count < stepcnt))
+        stepResult = runSome (stepcnt - (tmInsCount(mach) - count));
+    }
+    if ( bufferflag ) flushOut(&machIO);
+    printf( "%s\n",tmResultName(stepResult) );
+    if ( stepResult == srBREAK )
+    { iloc = tmGetReg(mach, PC_REG) ;
+      writeInstruction( iloc ) ;
+    }
+    else if ( stepResult == srWATCH )
+    { tmLastWatch(mach, &dloc, &i) ;
+      printf("dMem[%d] = %d (was %d)\n", dloc, tmGetMem(mach, dloc), i);
     }
-    printf( "%s\n",stepResultTab[stepResult] );
   }
   return TRUE;
 } /* doCommand */
 
 
+/********************************************/
+/* Memory profile export. Globals sit at    */
+/* the bottom of dMem and the stack grows   */
+/* down from the top, so addresses from the */
+/* lowest sp reached upwards are stack and  */
+/* the touched ones below it are globals.   */
+/* A name ending in .bin selects the binary */
+/* form: magic, DADDR_SIZE, minSp, then the */
+/* read and write counts as 32-bit words.   */
+/********************************************/
+int writeMemProfile ( MEMPROF * prof, char * fname )
+{ FILE * f;
+  int loc, len, top = -1, touched = 0, stackTouched = 0;
+  unsigned int hdr[3], cnt;
+  len = strlen(fname);
+  f = fopen(fname, ((len > 4) && ! strcmp(fname + len - 4, ".bin"))
+                   ? "wb" : "w");
+  if (f == NULL)
+  { printf("Cannot write memory profile '%s'\n",fname);
+    return FALSE;
+  }
+  for (loc = 0 ; loc < DADDR_SIZE ; loc++)
+    if (prof->reads[loc] || prof->writes[loc])
+    { touched++ ;
+      if (loc >= prof->minSp) stackTouched++ ;
+      else top = loc ;
+    }
+  if ((len > 4) && ! strcmp(fname + len - 4, ".bin"))
+  { hdr[0] = HEAT_MAGIC ;
+    hdr[1] = DADDR_SIZE ;
+    hdr[2] = prof->minSp ;
+    fwrite(hdr, sizeof(unsigned int), 3, f);
+    for (loc = 0 ; loc < DADDR_SIZE ; loc++)
+    { cnt = (unsigned int) prof->reads[loc] ;
+      fwrite(&cnt, sizeof(unsigned int), 1, f);
+    }
+    for (loc = 0 ; loc < DADDR_SIZE ; loc++)
+    { cnt = (unsigned int) prof->writes[loc] ;
+      fwrite(&cnt, sizeof(unsigned int), 1, f);
+    }
+  }
+  else
+  { fprintf(f, "# min sp,%d\n", prof->minSp);
+    fprintf(f, "# stack words used,%d\n", DADDR_SIZE - 1 - prof->minSp);
+    fprintf(f, "# global high-water,%d\n", top);
+    fprintf(f, "# free words between globals and stack,%d\n",
+            prof->minSp - top - 1);
+    fprintf(f, "# addresses touched,%d global,%d stack\n",
+            touched - stackTouched, stackTouched);
+    fprintf(f, "addr,reads,writes,region\n");
+    for (loc = 0 ; loc < DADDR_SIZE ; loc++)
+      if (prof->reads[loc] || prof->writes[loc])
+        fprintf(f, "%d,%lu,%lu,%s\n", loc, prof->reads[loc],
+                prof->writes[loc],
+                (loc >= prof->minSp) ? "stack" : "global");
+  }
+  fclose(f);
+  return TRUE;
+} /* writeMemProfile */
+
+/********************************************/
+/* Statistics export as JSON: opcode counts,*/
+/* taken ratio of the conditional jumps,    */
+/* LD/ST by base register and the topK most */
+/* frequent opcode pairs and triples.       */
+/********************************************/
+typedef struct {
+      int ops [3] ;
+      unsigned long count ;
+   } OPSEQ;
+
+int cmpOpSeq ( const void * a, const void * b )
+{ unsigned long x = ((const OPSEQ *) a)->count ;
+  unsigned long y = ((const OPSEQ *) b)->count ;
+  return (x < y) ? 1 : (x > y) ? -1 : 0 ;
+} /* cmpOpSeq */
+
+void writeOpSeqs ( FILE * f, OPSEQ * seq, int n, int len )
+{ int i, j;
+  qsort(seq, n, sizeof(OPSEQ), cmpOpSeq);
+  for (i = 0 ; (i < n) && (i < topK) ; i++)
+  { fprintf(f, "%s\n    {\"ops\": [", (i > 0) ? "," : "");
+    for (j = 0 ; j < len ; j++)
+      fprintf(f, "%s\"%s\"", (j > 0) ? ", " : "", tmOpName(seq[i].ops[j]));
+    fprintf(f, "], \"count\": %lu}", seq[i].count);
+  }
+  fprintf(f, "\n  ]");
+} /* writeOpSeqs */
+
+int writeStats ( TM_STATS * st, char * fname )
+{ FILE * f;
+  OPSEQ * seq;
+  static const char * base[] = { "gp", "fp", "sp", "other" };
+  unsigned long total = 0, reads[4], writes[4];
+  int op, o2, o3, n, i, r, first;
+  f = fopen(fname, "w");
+  seq = (OPSEQ *) malloc(opRALim * opRALim * opRALim * sizeof(OPSEQ));
+  if ((f == NULL) || (seq == NULL))
+  { printf("Cannot write statistics '%s'\n",fname);
+    if (f != NULL) fclose(f);
+    free(seq);
+    return FALSE;
+  }
+  for (op = 0 ; op < opRALim ; op++) total += st->ops[op] ;
+  fprintf(f, "{\n  \"instructions\": %lu,\n  \"opcodes\": {", total);
+  first = TRUE ;
+  for (op = 0 ; op < opRALim ; op++)
+    if (st->ops[op] != 0)
+    { fprintf(f, "%s\n    \"%s\": %lu", first ? "" : ",",
+              tmOpName(op), st->ops[op]);
+      first = FALSE ;
+    }
+  fprintf(f, "\n  },\n  \"branches\": {");
+  first = TRUE ;
+  for (op = opJLT ; op <= opJNE ; op++)
+    if (st->ops[op] != 0)
+    { fprintf(f, "%s\n    \"%s\": {\"executed\": %lu, \"taken\": %lu, "
+              "\"ratio\": %.4f}", first ? "" : ",", tmOpName(op),
+              st->ops[op], st->taken[op],
+              (double) st->taken[op] / st->ops[op]);
+      first = FALSE ;
+    }
+  for (i = 0 ; i < 4 ; i++) reads[i] = writes[i] = 0 ;
+  for (r = 0 ; r < NO_REGS ; r++)
+  { i = (r == GP_REG) ? 0 : (r == FP_REG) ? 1 : (r == SP_REG) ? 2 : 3 ;
+    reads[i] += st->reads[r] ;
+    writes[i] += st->writes[r] ;
+  }
+  fprintf(f, "\n  },\n  \"memory\": {");
+  for (i = 0 ; i < 4 ; i++)
+    fprintf(f, "%s\n    \"%s\": {\"reads\": %lu, \"writes\": %lu}",
+            (i > 0) ? "," : "", base[i], reads[i], writes[i]);
+  fprintf(f, "\n  },\n  \"pairs\": [");
+  n = 0 ;
+  for (op = 0 ; op < opRALim ; op++)
+    for (o2 = 0 ; o2 < opRALim ; o2++)
+      if (st->pairs[op][o2] != 0)
+      { seq[n].ops[0] = op ;
+        seq[n].ops[1] = o2 ;
+        seq[n++].count = st->pairs[op][o2] ;
+      }
+  writeOpSeqs(f, seq, n, 2);
+  fprintf(f, ",\n  \"triples\": [");
+  n = 0 ;
+  for (op = 0 ; op < opRALim ; op++)
+    for (o2 = 0 ; o2 < opRALim ; o2++)
+      for (o3 = 0 ; o3 < opRALim ; o3++)
+        if (st->triples[op][o2][o3] != 0)
+        { seq[n].ops[0] = op ;
+          seq[n].ops[1] = o2 ;
+          seq[n].ops[2] = o3 ;
+          seq[n++].count = st->triples[op][o2][o3] ;
+        }
+  writeOpSeqs(f, seq, n, 3);
+  fprintf(f, "\n}\n");
+  free(seq);
+  fclose(f);
+  return TRUE;
+} /* writeStats */
+
+/********************************************/
+/* Batch mode: one machine per input file,  */
+/* run by a pool of worker threads that all */
+/* share the program loaded at start-up     */
+/********************************************/
+typedef struct {
+      char ** inNames ;
+      int nJobs ;
+      int lanes ;              /* lanes per lockstep group (0 = off) */
+      int next ;               /* next job (or group) to hand out */
+      STEPRESULT * results ;
+      const char ** errors ;   /* why a job could not start, or NULL */
+      long * counts ;
+      long * cycles ;
+      pthread_mutex_t lock ;
+   } BATCH;
+
+/********************************************/
+/* open the files of one batch job; on      */
+/* failure nothing is left open             */
+/********************************************/
+int openJob ( FILEIO * io, char * inName )
+{ char jobOut[2*LINESIZE];
+  io->termFallback = FALSE ;
+  io->in = fopen(inName,"r");
+  snprintf(jobOut, sizeof(jobOut), "%s.%s", inName,
+           (outName != NULL) ? outName : "out");
+  io->out = fopen(jobOut,"w");
+  if ( (io->in == NULL) || (io->out == NULL)
+       || (bufferflag && ! openBuffers(io, inName, endsWith(jobOut, ".bin"))) )
+  { if (io->in != NULL) fclose(io->in);
+    if (io->out != NULL) fclose(io->out);
+    io->in = NULL ;
+    io->out = NULL ;
+    return FALSE;
+  }
+  return TRUE;
+} /* openJob */
+
+/********************************************/
+void closeJob ( FILEIO * io, STEPRESULT stepResult )
+{ if (bufferflag)
+  { closeBuffers(io);
+    if (io->rawOut)
+    { fclose(io->in);
+      fclose(io->out);
+      return;
+    }
+  }
+  fprintf(io->out, "%s\n", tmResultName(stepResult));
+  fclose(io->in);
+  fclose(io->out);
+} /* closeJob */
+
+/********************************************/
+/* run one batch job; when it cannot start, */
+/* *error tells why and the result is       */
+/* meaningless                              */
+/********************************************/
+STEPRESULT runJob ( char * inName, const char ** error,
+                    long * count, long * cycles )
+{ TM_MACHINE * m;
+  MEMPROF * jobProf = NULL;
+  TM_STATS * jobStats = NULL;
+  STEPRESULT stepResult;
+  FILEIO io;
+  char outName[2*LINESIZE];
+  *error = NULL ;
+  *count = 0 ;
+  *cycles = 0 ;
+  m = tmNewMachine(prog);
+  if (m == NULL)
+  { *error = "Cannot allocate a machine" ;
+    return srOKAY ;
+  }
+  if (! guardMachine(m))
+  { *error = "Cannot guard the stack" ;
+    tmFreeMachine(m);
+    return srOKAY ;
+  }
+  if (! openJob(&io, inName))
+  { *error = "Cannot open the input or output files" ;
+    tmFreeMachine(m);
+    return srOKAY ;
+  }
+  if (heatName != NULL)
+  { jobProf = (MEMPROF *) malloc(sizeof(MEMPROF));
+    if (jobProf != NULL) tmSetProfile(m, jobProf);
+  }
+  if (statsName != NULL)
+  { jobStats = (TM_STATS *) malloc(sizeof(TM_STATS));
+    if (jobStats != NULL) tmSetStats(m, jobStats);
+  }
+  tmSetIO(m, bufferflag ? &bufIO : &fileIO, &io);
+  if (costflag) tmSetCosts(m, &costs);
+  tmSetLimits(m, budget, timeLimit);
+  stepResult = tmRun(m, 0);
+  *count = tmInsCount(m) ;
+  *cycles = tmCycles(m) ;
+  closeJob(&io, stepResult);
+  if (jobProf != NULL)
+  { snprintf(outName, sizeof(outName), "%s.%s", inName, heatName);
+    writeMemProfile(jobProf, outName);
+    free(jobProf);
+  }
+  if (jobStats != NULL)
+  { snprintf(outName, sizeof(outName), "%s.%s", inName, statsName);
+    writeStats(jobStats, outName);
+    free(jobStats);
+  }
+  tmFreeMachine(m);
+  return stepResult ;
+} /* runJob */
+
+/********************************************/
+/* one lockstep group of n input files      */
+/********************************************/
+void runLanes ( char ** inNames, int n, STEPRESULT * results,
+                const char ** errors, long * counts, long * cycles )
+{ FILEIO * io;
+  void ** users;
+  int l;
+  io = (FILEIO *) calloc(n, sizeof(FILEIO));
+  users = (void **) calloc(n, sizeof(void *));
+  for (l = 0 ; l < n ; l++)
+  { /* tmRunLanes leaves a lane that is not srOKAY alone */
+    results[l] = srNOINPUT ;
+    if ((io == NULL) || (users == NULL))
+      errors[l] = "Cannot allocate the lanes" ;
+    else if (! openJob(&io[l], inNames[l]))
+      errors[l] = "Cannot open the input or output files" ;
+    else
+      results[l] = srOKAY ;
+    if (users != NULL) users[l] = &io[l] ;
+  }
+  if ((io != NULL) && (users != NULL))
+  { tmRunLanes(prog, n, bufferflag ? &bufIO : &fileIO, users, costflag ? &costs : NULL,
+               budget, timeLimit, results, counts, cycles);
+    for (l = 0 ; l < n ; l++)
+      if (io[l].in != NULL) closeJob(&io[l], results[l]);
+  }
+  free(io);
+  free(users);
+} /* runLanes */
+
+/********************************************/
+void * batchWorker ( void * arg )
+{ BATCH * b = (BATCH *) arg;
+  int job, n;
+  for (;;)
+  { pthread_mutex_lock(&b->lock);
+    job = b->next++ ;
+    pthread_mutex_unlock(&b->lock);
+    if (b->lanes > 0)
+    { job *= b->lanes ;
+      if (job >= b->nJobs) break;
+      n = (b->nJobs - job < b->lanes) ? b->nJobs - job : b->lanes ;
+      runLanes(&b->inNames[job], n, &b->results[job], &b->errors[job],
+               &b->counts[job], &b->cycles[job]);
+      continue;
+    }
+    if (job >= b->nJobs) break;
+    b->results[job] = runJob(b->inNames[job], &b->errors[job],
+                             &b->counts[job], &b->cycles[job]);
+  }
+  return NULL;
+} /* batchWorker */
+
+/********************************************/
+int runBatch ( int nThreads, int lanes, char ** inNames, int nJobs )
+{ BATCH b;
+  pthread_t * workers;
+  int i, failed = 0;
+  int groups = (lanes > 0) ? (nJobs + lanes - 1) / lanes : nJobs ;
+  if (nThreads <= 0) nThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (nThreads > groups) nThreads = groups ;
+  if (nThreads < 1) nThreads = 1 ;
+  b.inNames = inNames ;
+  b.nJobs = nJobs ;
+  b.lanes = lanes ;
+  b.next = 0 ;
+  b.results = (STEPRESULT *) calloc(nJobs, sizeof(STEPRESULT));
+  b.errors = (const char **) calloc(nJobs, sizeof(const char *));
+  b.counts = (long *) calloc(nJobs, sizeof(long));
+  b.cycles = (long *) calloc(nJobs, sizeof(long));
+  workers = (pthread_t *) calloc(nThreads, sizeof(pthread_t));
+  pthread_mutex_init(&b.lock, NULL);
+  for (i = 0 ; i < nThreads ; i++)
+    pthread_create(&workers[i], NULL, batchWorker, &b);
+  for (i = 0 ; i < nThreads ; i++)
+    pthread_join(workers[i], NULL);
+  pthread_mutex_destroy(&b.lock);
+  for (i = 0 ; i < nJobs ; i++)
+  { if (b.errors[i] != NULL)
+    { printf("%s: %s\n", inNames[i], b.errors[i]);
+      failed++ ;
+      continue;
+    }
+    printf("%s: %s after %ld instructions",
+           inNames[i], tmResultName(b.results[i]), b.counts[i]);
+    if (costflag) printf(", %ld estimated cycles",b.cycles[i]);
+    printf("\n");
+    if (b.results[i] != srHALT) failed++ ;
+  }
+  free(workers);
+  free(b.results);
+  free(b.errors);
+  free(b.counts);
+  free(b.cycles);
+  return failed ;
+} /* runBatch */
+
+/********************************************/
+/* Differential mode: every input file runs */
+/* on each execution engine of libtm, and   */
+/* their OUT values, step result, count of  */
+/* instructions (and cycles) and, where the */
+/* engine keeps a machine, final registers  */
+/* are compared with single stepping. For a */
+/* machine engine the first instruction     */
+/* after which its state differs is found   */
+/* by bisection; for lockstep lanes the     */
+/* first differing OUT is reported.         */
+/********************************************/
+#define NENGINES 4
+
+typedef struct {
+      int * inVals ;       /* shared, read-only */
+      long inCount ;
+      long inNext ;
+      int * outVals ;
+      long outCount ;
+      long outCap ;
+      int * outLoc ;       /* step engine: location of each OUT */
+      long * outIns ;      /* and the instruction count after it */
+   } CAPTURE;
+
+typedef struct {
+      const char * name ;
+      STEPRESULT result ;
+      long count ;
+      long cycles ;
+      int hasRegs ;
+      int reg [NO_REGS] ;
+      int lanesDiffer ;    /* lanes only: the two lanes disagree */
+      CAPTURE cap ;
+   } ENGINE;
+
+static const char * engineName[NENGINES] = { "step", "run", "guard", "lanes" } ;
+
+int capIn ( void * user, int * value )
+{ CAPTURE * c = (CAPTURE *) user;
+  if (c->inNext >= c->inCount) return FALSE;
+  *value = c->inVals[c->inNext++] ;
+  return TRUE;
+} /* capIn */
+
+void capOut ( void * user, int value )
+{ CAPTURE * c = (CAPTURE *) user;
+  int * p;
+  if (c->outCount == c->outCap)
+  { c->outCap = (c->outCap == 0) ? 64 : 2 * c->outCap ;
+    p = (int *) realloc(c->outVals, c->outCap * sizeof(int));
+    if (p == NULL)
+    { c->outCap = c->outCount ;
+      return;
+    }
+    c->outVals = p ;
+  }
+  c->outVals[c->outCount++] = value ;
+} /* capOut */
+
+const TM_IO capIO = { capIn, capOut, NULL } ;
+
+/********************************************/
+void capStart ( CAPTURE * c, FILEIO * in )
+{ memset(c, 0, sizeof(CAPTURE));
+  c->inVals = in->inVals ;
+  c->inCount = in->inCount ;
+} /* capStart */
+
+void capFree ( CAPTURE * c )
+{ free(c->outVals);
+  free(c->outLoc);
+  free(c->outIns);
+} /* capFree */
+
+/********************************************/
+/* a machine for engine e with the options  */
+/* of this run; guard is its stack limit    */
+/********************************************/
+TM_MACHINE * engineMachine ( int e, CAPTURE * c, int guard )
+{ TM_MACHINE * m = tmNewMachine(prog);
+  if (m == NULL) return NULL;
+  tmSetIO(m, &capIO, c);
+  if (costflag) tmSetCosts(m, &costs);
+  if (e == 2) tmSetGuard(m, guard);
+  return m;
+} /* engineMachine */
+
+/********************************************/
+/* state of a machine engine after k steps  */
+/* (all of them if k < 0), with the result  */
+/* of the last one; NULL on failure         */
+/********************************************/
+TM_MACHINE * engineState ( int e, FILEIO * in, CAPTURE * c, int guard,
+                           long k, MEMPROF * prof, STEPRESULT * result )
+{ TM_MACHINE * m;
+  STEPRESULT stepResult = srOKAY;
+  long size;
+  int pc;
+  capStart(c, in);
+  m = engineMachine(e, c, guard);
+  if (m == NULL) return NULL;
+  if (prof != NULL) tmSetProfile(m, prof);
+  tmSetLimits(m, budget, timeLimit);
+  if (e != 0)
+  { if (k != 0) stepResult = tmRun(m, (k < 0) ? 0 : k);
+    if (result != NULL) *result = stepResult ;
+    return m;
+  }
+  while ((stepResult == srOKAY) && ((k < 0) || (tmInsCount(m) < k)))
+  { pc = tmGetReg(m, PC_REG) ;
+    size = c->outCount ;
+    stepResult = tmStep(m);
+    if ((k < 0) && (c->outCount > size))
+    { c->outLoc = (int *) realloc(c->outLoc, c->outCap * sizeof(int));
+      c->outIns = (long *) realloc(c->outIns, c->outCap * sizeof(long));
+      if ((c->outLoc == NULL) || (c->outIns == NULL)) continue;
+      c->outLoc[size] = pc ;
+      c->outIns[size] = tmInsCount(m) ;
+    }
+  }
+  if (result != NULL) *result = stepResult ;
+  return m;
+} /* engineState */
+
+/********************************************/
+/* same registers, data and I/O position    */
+/********************************************/
+int sameState ( TM_MACHINE * a, CAPTURE * ca, TM_MACHINE * b, CAPTURE * cb )
+{ int i;
+  if ((ca->inNext != cb->inNext) || (ca->outCount != cb->outCount))
+    return FALSE;
+  for (i = 0 ; i < NO_REGS ; i++)
+    if (tmGetReg(a, i) != tmGetReg(b, i)) return FALSE;
+  for (i = 0 ; i < DADDR_SIZE ; i++)
+    if (tmGetMem(a, i) != tmGetMem(b, i)) return FALSE;
+  return TRUE;
+} /* sameState */
+
+/********************************************/
+/* the first k after which engine e and the */
+/* step engine differ, and the location of  */
+/* the k-th instruction; -1 if none is      */
+/* found up to hi steps                     */
+/********************************************/
+long bisect ( int e, FILEIO * in, int guard, long hi, int * loc )
+{ TM_MACHINE * a, * b;
+  CAPTURE ca, cb;
+  long lo = 0, mid;
+  int same;
+  a = engineState(0, in, &ca, guard, hi, NULL, NULL);
+  b = engineState(e, in, &cb, guard, hi, NULL, NULL);
+  same = (a == NULL) || (b == NULL) || sameState(a, &ca, b, &cb) ;
+  if (a != NULL) tmFreeMachine(a);
+  if (b != NULL) tmFreeMachine(b);
+  capFree(&ca);
+  capFree(&cb);
+  if (same) return -1 ;
+  /* the states agree after lo steps and differ after hi */
+  while (hi - lo > 1)
+  { mid = lo + (hi - lo) / 2 ;
+    a = engineState(0, in, &ca, guard, mid, NULL, NULL);
+    b = engineState(e, in, &cb, guard, mid, NULL, NULL);
+    same = (a != NULL) && (b != NULL) && sameState(a, &ca, b, &cb) ;
+    if (a != NULL) tmFreeMachine(a);
+    if (b != NULL) tmFreeMachine(b);
+    capFree(&ca);
+    capFree(&cb);
+    if (same) lo = mid ;
+    else hi = mid ;
+  }
+  a = engineState(0, in, &ca, guard, lo, NULL, NULL);
+  *loc = (a != NULL) ? tmGetReg(a, PC_REG) : -1 ;
+  if (a != NULL) tmFreeMachine(a);
+  capFree(&ca);
+  return hi ;
+} /* bisect */
+
+/********************************************/
+/* run engine e to its end                  */
+/********************************************/
+int runEngine ( int e, FILEIO * in, ENGINE * eng, int guard, MEMPROF * prof )
+{ TM_MACHINE * m;
+  CAPTURE lane2;
+  void * users[2];
+  STEPRESULT results[2];
+  long counts[2], cycles[2];
+  int i;
+  eng->name = engineName[e] ;
+  eng->hasRegs = (e != 3) ;
+  if (e != 3)
+  { m = engineState(e, in, &eng->cap, guard, -1, prof, &eng->result);
+    if (m == NULL) return FALSE;
+    eng->count = tmInsCount(m) ;
+    eng->cycles = tmCycles(m) ;
+    for (i = 0 ; i < NO_REGS ; i++) eng->reg[i] = tmGetReg(m, i) ;
+    tmFreeMachine(m);
+    return TRUE;
+  }
+  /* two lanes on the same input, which must agree as well */
+  capStart(&eng->cap, in);
+  capStart(&lane2, in);
+  users[0] = &eng->cap ;
+  users[1] = &lane2 ;
+  results[0] = results[1] = srOKAY ;
+  tmRunLanes(prog, 2, &capIO, users, costflag ? &costs : NULL,
+             budget, timeLimit, results, counts, cycles);
+  eng->result = results[0] ;
+  eng->count = counts[0] ;
+  eng->cycles = cycles[0] ;
+  eng->lanesDiffer = (results[1] != results[0]) || (counts[1] != counts[0])
+                     || (lane2.outCount != eng->cap.outCount)
+                     || ( (lane2.outCount > 0)
+                          && memcmp(lane2.outVals, eng->cap.outVals,
+                                    lane2.outCount * sizeof(int)) ) ;
+  capFree(&lane2);
+  return TRUE;
+} /* runEngine */
+
+/********************************************/
+/* the highest page of dMem the step engine */
+/* never touched, as a tmSetGuard limit     */
+/********************************************/
+int freeGuard ( MEMPROF * pf )
+{ TM_MACHINE * m = tmNewMachine(prog);
+  int lo, hi, words, limit, a, used;
+  if (m == NULL) return 0 ;
+  if ( ! tmSetGuard(m, DADDR_SIZE) || ! tmGetGuard(m, &lo, &hi) )
+  { tmFreeMachine(m);
+    return 0 ;
+  }
+  tmFreeMachine(m);
+  words = hi - lo + 1 ;
+  for (limit = DADDR_SIZE / words * words ; limit - words >= words ;
+       limit -= words)
+  { used = FALSE ;
+    for (a = limit - words ; a < limit ; a++)
+      if (pf->reads[a] || pf->writes[a]) used = TRUE ;
+    if (! used) return limit ;
+  }
+  return 0 ;
+} /* freeGuard */
+
+/********************************************/
+/* compare engine e with the step engine;   */
+/* FALSE (with a report) if they differ     */
+/********************************************/
+int compareEngine ( int e, ENGINE * ref, ENGINE * eng, FILEIO * in,
+                    int guard )
+{ long i, k, n;
+  int loc, same = TRUE;
+  if (eng->result != ref->result)
+  { printf("  %s: %s, step: %s\n", eng->name, tmResultName(eng->result),
+           tmResultName(ref->result));
+    same = FALSE ;
+  }
+  if (eng->count != ref->count)
+  { printf("  %s: %ld instructions, step: %ld\n", eng->name, eng->count,
+           ref->count);
+    same = FALSE ;
+  }
+  if (costflag && (eng->cycles != ref->cycles))
+  { printf("  %s: %ld cycles, step: %ld\n", eng->name, eng->cycles,
+           ref->cycles);
+    same = FALSE ;
+  }
+  n = (eng->cap.outCount < ref->cap.outCount) ? eng->cap.outCount
+                                              : ref->cap.outCount ;
+  for (i = 0 ; (i < n) && (eng->cap.outVals[i] == ref->cap.outVals[i]) ; i++)
+    ;
+  if ((i < n) || (eng->cap.outCount != ref->cap.outCount))
+  { printf("  %s: OUT #%ld is ", eng->name, i + 1);
+    if (i < eng->cap.outCount) printf("%d", eng->cap.outVals[i]);
+    else printf("missing");
+    printf(", step: ");
+    if (i < ref->cap.outCount) printf("%d\n", ref->cap.outVals[i]);
+    else printf("missing\n");
+    same = FALSE ;
+  }
+  if (eng->hasRegs)
+    for (k = 0 ; k < NO_REGS ; k++)
+      if (eng->reg[k] != ref->reg[k])
+      { printf("  %s: reg %ld = %d, step: %d\n", eng->name, k,
+               eng->reg[k], ref->reg[k]);
+        same = FALSE ;
+      }
+  if (eng->lanesDiffer)
+  { printf("  %s: the two lanes disagree\n", eng->name);
+    same = FALSE ;
+  }
+  if (same) return TRUE;
+  if (eng->hasRegs)
+  { n = (eng->count < ref->count) ? eng->count : ref->count ;
+    k = bisect(e, in, guard, n, &loc);
+    if (k < 0)
+      printf("  %s: state agrees for the first %ld instructions\n",
+             eng->name, n);
+    else
+    { printf("  %s: first divergent instruction is #%ld:\n", eng->name, k);
+      writeInstruction(loc);
+    }
+  }
+  else if ((i < ref->cap.outCount) && (ref->cap.outLoc != NULL))
+  { printf("  %s: OUT #%ld comes from instruction #%ld:\n", eng->name,
+           i + 1, ref->cap.outIns[i]);
+    writeInstruction(ref->cap.outLoc[i]);
+  }
+  return FALSE;
+} /* compareEngine */
+
+/********************************************/
+/* one input file (NULL: no input) on all   */
+/* engines; FALSE if any differ             */
+/********************************************/
+int diffJob ( char * inName )
+{ ENGINE eng[NENGINES];
+  FILEIO in;
+  MEMPROF * pf;
+  int e, guard = 0, same = TRUE;
+  memset(&in, 0, sizeof(in));
+  memset(eng, 0, sizeof(eng));
+  if (inName != NULL)
+  { in.in = fopen(inName, "r");
+    if ((in.in == NULL) || ! readInput(&in, inName))
+    { printf("%s: cannot read\n", inName);
+      if (in.in != NULL) fclose(in.in);
+      return FALSE;
+    }
+  }
+  pf = (MEMPROF *) malloc(sizeof(MEMPROF));
+  if ((pf == NULL) || ! runEngine(0, &in, &eng[0], 0, pf))
+  { printf("Out of memory\n");
+    exit(1);
+  }
+  guard = freeGuard(pf);
+  free(pf);
+  printf("%s: %s after %ld instructions, %ld OUT values\n",
+         (inName != NULL) ? inName : "(no input)",
+         tmResultName(eng[0].result), eng[0].count, eng[0].cap.outCount);
+  for (e = 1 ; e < NENGINES ; e++)
+  { if ((e == 2) && (guard == 0))
+    { printf("  guard: skipped, no free page for the guard\n");
+      continue;
+    }
+    if (! runEngine(e, &in, &eng[e], guard, NULL))
+    { printf("Out of memory\n");
+      exit(1);
+    }
+    if (! compareEngine(e, &eng[0], &eng[e], &in, guard)) same = FALSE ;
+    capFree(&eng[e].cap);
+  }
+  printf(same ? "  all engines agree\n" : "  engines disagree\n");
+  capFree(&eng[0].cap);
+  if (in.inMapped > 0) munmap(in.inVals, in.inMapped);
+  else free(in.inVals);
+  if (in.in != NULL) fclose(in.in);
+  return same;
+} /* diffJob */
+
+/********************************************/
+int runDiff ( char ** inNames, int nJobs )
+{ int i, failed = 0;
+  if (nJobs == 0) return diffJob(NULL) ? 0 : 1 ;
+  for (i = 0 ; i < nJobs ; i++)
+    if (! diffJob(inNames[i])) failed++ ;
+  return failed ;
+} /* runDiff */
+
+/********************************************/
+/* Server mode: sessions on a Unix socket.  */
+/* A client sends IN values one per line    */
+/* (the first line names the .tm file when  */
+/* tm has no program; only relative paths   */
+/* without ".." are served) and gets the    */
+/* lines a batch job would write to         */
+/* <infile>.out.                            */
+/* A session runs until IN finds no value:  */
+/* the machine stops with srNOINPUT, its pc */
+/* past the IN, and is the whole suspended  */
+/* state; the value that arrives later is   */
+/* put in the IN's register and the run     */
+/* goes on. Workers take ready sessions     */
+/* from one epoll set (EPOLLONESHOT, so a   */
+/* session is only ever on one thread), and */
+/* a busy session yields every SLICE        */
+/* instructions by asking for EPOLLOUT.     */
+/********************************************/
+typedef struct {
+      int fd ;
+      TM_PROGRAM * prog ;      /* own copy when tm has no program */
+      TM_MACHINE * m ;         /* NULL until the program is known */
+      int * inVals ;           /* values received, not yet read */
+      long inCount ;
+      long inNext ;
+      long inCap ;
+      char line [LINESIZE] ;   /* partial input line */
+      int lineLen ;
+      char * out ;             /* output not yet sent */
+      size_t outLen ;
+      size_t outSent ;
+      size_t outCap ;
+      int eof ;                /* client shut down its side */
+      int waitReg ;            /* register of the IN waiting, -1 if none */
+      int done ;               /* result line queued, close when sent */
+   } SESSION;
+
+int epollFd ;
+int listenFd ;
+
+/********************************************/
+int sessPut ( SESSION * ss, const char * text, size_t len )
+{ char * p;
+  if (ss->outLen + len > ss->outCap)
+  { size_t cap = (ss->outCap == 0) ? 256 : ss->outCap ;
+    while (cap < ss->outLen + len) cap *= 2 ;
+    p = (char *) realloc(ss->out, cap);
+    if (p == NULL) return FALSE;
+    ss->out = p ;
+    ss->outCap = cap ;
+  }
+  memcpy(ss->out + ss->outLen, text, len);
+  ss->outLen += len ;
+  return TRUE;
+} /* sessPut */
+
+int sessIn ( void * user, int * value )
+{ SESSION * ss = (SESSION *) user;
+  if (ss->inNext >= ss->inCount) return FALSE;
+  *value = ss->inVals[ss->inNext++] ;
+  return TRUE;
+} /* sessIn */
+
+void sessOut ( void * user, int value )
+{ char text[40];
+  sessPut((SESSION *) user, text,
+          sprintf(text, "OUT instruction prints: %d\n", value));
+} /* sessOut */
+
+void sessHalt ( void * user, int r, int s, int t )
+{ char text[48];
+  sessPut((SESSION *) user, text,
+          sprintf(text, "HALT: %1d,%1d,%1d\n", r, s, t));
+} /* sessHalt */
+
+const TM_IO sessIO = { sessIn, sessOut, sessHalt } ;
+
+/********************************************/
+/* send what the socket takes; FALSE if the */
+/* client is gone                           */
+/********************************************/
+int sessFlush ( SESSION * ss )
+{ ssize_t n;
+  while (ss->outSent < ss->outLen)
+  { n = send(ss->fd, ss->out + ss->outSent, ss->outLen - ss->outSent,
+             MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n > 0) ss->outSent += n ;
+    else if ((n < 0) && (errno == EINTR)) continue;
+    else return (n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ;
+  }
+  ss->outLen = ss->outSent = 0 ;
+  return TRUE;
+} /* sessFlush */
+
+/********************************************/
+void sessClose ( SESSION * ss )
+{ close(ss->fd);
+  if (ss->m != NULL) tmFreeMachine(ss->m);
+  if (ss->prog != prog) tmFreeProgram(ss->prog);
+  free(ss->inVals);
+  free(ss->out);
+  free(ss);
+} /* sessClose */
+
+/********************************************/
+/* TRUE if a client may load the program    */
+/* name: relative, with no ".." component   */
+/********************************************/
+int servedName ( const char * name )
+{ const char * p = name ;
+  if (*name == '/') return FALSE;
+  for (;;)
+  { if ( (p[0] == '.') && (p[1] == '.') && ((p[2] == '/') || (p[2] == '\0')) )
+      return FALSE;
+    p = strchr(p, '/');
+    if (p == NULL) return TRUE;
+    p++ ;
+  }
+} /* servedName */
+
+/********************************************/
+/* one complete input line; FALSE on errors */
+/* that leave nothing to tell the client    */
+/********************************************/
+int sessLine ( SESSION * ss, char * line )
+{ char err[TM_ERRSIZE];
+  char * end;
+  int * p;
+  long v;
+  if (ss->prog == NULL)
+  { while ((*line == ' ') || (*line == '\t')) line++ ;
+    end = line + strcspn(line, " \t\r");
+    *end = '\0' ;
+    if (servedName(line))
+    { ss->prog = tmLoadProgramFile(line, err);
+      if (ss->prog != NULL) return TRUE;
+    }
+    else snprintf(err, TM_ERRSIZE, "Not serving '%s'", line);
+    /* closed once the error is sent */
+    sessPut(ss, err, strlen(err));
+    sessPut(ss, "\n", 1);
+    ss->done = TRUE ;
+    return TRUE;
+  }
+  v = strtol(line, &end, 10);
+  if (end == line) return TRUE;
+  if (ss->inCount == ss->inCap)
+  { if (ss->inNext > 0)
+    { /* reuse the room of values already read */
+      memmove(ss->inVals, ss->inVals + ss->inNext,
+              (ss->inCount - ss->inNext) * sizeof(int));
+      ss->inCount -= ss->inNext ;
+      ss->inNext = 0 ;
+    }
+    else
+    { p = (int *) realloc(ss->inVals,
+                          (ss->inCap + 64) * 2 * sizeof(int));
+      if (p == NULL) return FALSE;
+      ss->inVals = p ;
+      ss->inCap = (ss->inCap + 64) * 2 ;
+    }
+  }
+  ss->inVals[ss->inCount++] = (int) v ;
+  return TRUE;
+} /* sessLine */
+
+/********************************************/
+/* read what has arrived; FALSE on errors   */
+/********************************************/
+int sessRead ( SESSION * ss )
+{ char buf[4096];
+  ssize_t n;
+  int i;
+  for (;;)
+  { n = recv(ss->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n == 0) ss->eof = TRUE ;
+    if (n <= 0) break;
+    for (i = 0 ; i < n ; i++)
+    { if (buf[i] != '\n')
+      { if (ss->lineLen < LINESIZE-1) ss->line[ss->lineLen++] = buf[i] ;
+        continue;
+      }
+      ss->line[ss->lineLen] = '\0' ;
+      ss->lineLen = 0 ;
+      if (! sessLine(ss, ss->line)) return FALSE;
+      if (ss->done) return TRUE;
+    }
+  }
+  if ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+    return FALSE;
+  if (ss->eof && (ss->lineLen > 0))
+  { ss->line[ss->lineLen] = '\0' ;
+    ss->lineLen = 0 ;
+    if (! sessLine(ss, ss->line)) return FALSE;
+  }
+  return TRUE;
+} /* sessRead */
+
+/********************************************/
+/* limits for the stretch that starts now;  */
+/* the budget counts over the whole session */
+/********************************************/
+void sessLimits ( SESSION * ss )
+{ long fuel = 0 ;
+  if (budget > 0)
+  { fuel = budget - tmInsCount(ss->m) ;
+    if (fuel <= 0) fuel = 1 ;
+  }
+  tmSetLimits(ss->m, fuel, timeLimit);
+} /* sessLimits */
+
+/********************************************/
+void sessFinish ( SESSION * ss, STEPRESULT stepResult )
+{ const char * name = tmResultName(stepResult);
+  sessPut(ss, name, strlen(name));
+  sessPut(ss, "\n", 1);
+  ss->done = TRUE ;
+} /* sessFinish */
+
+/********************************************/
+/* run the session as far as it can go      */
+/* now; the events to wait for, 0 to close  */
+/********************************************/
+#define WAIT_INPUT(ss) \
+  ( ((ss)->outLen > 0) ? (EPOLLIN | EPOLLOUT) : EPOLLIN )
+
+unsigned int sessRun ( SESSION * ss, int readable )
+{ STEPRESULT stepResult;
+  INSTRUCTION ins;
+  int pc;
+  if ( readable && ! ss->done && ! sessRead(ss) ) return 0 ;
+  if ( ! sessFlush(ss) ) return 0 ;
+  if ( ss->done ) return (ss->outLen > 0) ? EPOLLOUT : 0 ;
+  if ( ss->outLen > OUTBUF_SIZE ) return EPOLLOUT ;   /* slow reader */
+  if ( ss->m == NULL )
+  { if ( ss->prog == NULL )
+    { if ( ! ss->eof ) return WAIT_INPUT(ss) ;
+      sessFinish(ss, srNOINPUT);
+      return sessFlush(ss) && (ss->outLen > 0) ? EPOLLOUT : 0 ;
+    }
+    ss->m = tmNewMachine(ss->prog);
+    if ( (ss->m == NULL) || ! guardMachine(ss->m) ) return 0 ;
+    tmSetIO(ss->m, &sessIO, ss);
+    if (costflag) tmSetCosts(ss->m, &costs);
+    sessLimits(ss);
+  }
+  if ( ss->waitReg >= 0 )
+  { if ( ss->inNext < ss->inCount )
+    { tmSetReg(ss->m, ss->waitReg, ss->inVals[ss->inNext++]);
+      ss->waitReg = -1 ;
+      sessLimits(ss);
+    }
+    else if ( ! ss->eof ) return WAIT_INPUT(ss) ;
+  }
+  if ( ss->waitReg < 0 )
+  { stepResult = tmRun(ss->m, SLICE);
+    if ( stepResult == srOKAY )
+    { if ( ! sessFlush(ss) ) return 0 ;
+      return EPOLLIN | EPOLLOUT ;   /* yield, back as soon as writable */
+    }
+    pc = tmGetReg(ss->m, PC_REG) - 1 ;
+    if ( (stepResult == srNOINPUT) && ! ss->eof
+         && tmGetInstruction(ss->prog, pc, &ins) && (ins.iop == opIN) )
+    { ss->waitReg = ins.iarg1 ;
+      if ( ! sessFlush(ss) ) return 0 ;
+      return WAIT_INPUT(ss) ;
+    }
+  }
+  else stepResult = srNOINPUT ;
+  sessFinish(ss, stepResult);
+  if ( ! sessFlush(ss) ) return 0 ;
+  return (ss->outLen > 0) ? EPOLLOUT : 0 ;
+} /* sessRun */
+
+/********************************************/
+void serverAccept ( void )
+{ struct epoll_event ev;
+  SESSION * ss;
+  int fd;
+  while ((fd = accept(listenFd, NULL, NULL)) >= 0)
+  { ss = (SESSION *) calloc(1, sizeof(SESSION));
+    if ( (ss == NULL) || (fcntl(fd, F_SETFL, O_NONBLOCK) != 0) )
+    { free(ss);
+      close(fd);
+      continue;
+    }
+    ss->fd = fd ;
+    ss->prog = prog ;
+    ss->waitReg = -1 ;
+    ev.events = ((prog != NULL) ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT ;
+    ev.data.ptr = ss ;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != 0) sessClose(ss);
+  }
+  ev.events = EPOLLIN | EPOLLONESHOT ;
+  ev.data.ptr = NULL ;
+  epoll_ctl(epollFd, EPOLL_CTL_MOD, listenFd, &ev);
+} /* serverAccept */
+
+/********************************************/
+void * serverWorker ( void * arg )
+{ struct epoll_event ev;
+  SESSION * ss;
+  unsigned int wait;
+  for (;;)
+  { if (epoll_wait(epollFd, &ev, 1, -1) != 1) continue;
+    ss = (SESSION *) ev.data.ptr ;
+    if (ss == NULL)
+    { serverAccept();
+      continue;
+    }
+    wait = sessRun(ss, (ev.events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0);
+    if (wait == 0)
+    { sessClose(ss);
+      continue;
+    }
+    ev.events = wait | EPOLLONESHOT ;
+    ev.data.ptr = ss ;
+    if (epoll_ctl(epollFd, EPOLL_CTL_MOD, ss->fd, &ev) != 0) sessClose(ss);
+  }
+  return arg;
+} /* serverWorker */
+
+/********************************************/
+int runServer ( char * sockName, int nThreads )
+{ struct sockaddr_un addr;
+  struct epoll_event ev;
+  pthread_t * workers;
+  int i;
+  if (nThreads <= 0) nThreads = (nThreads < 0) ? 1
+                                : (int) sysconf(_SC_NPROCESSORS_ONLN);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX ;
+  strncpy(addr.sun_path, sockName, sizeof(addr.sun_path) - 1);
+  unlink(sockName);
+  listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  epollFd = epoll_create1(0);
+  if ( (listenFd < 0) || (epollFd < 0)
+       || (fcntl(listenFd, F_SETFL, O_NONBLOCK) != 0)
+       || (bind(listenFd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+       || (listen(listenFd, SOMAXCONN) != 0) )
+  { printf("Cannot listen on '%s'\n",sockName);
+    return FALSE;
+  }
+  ev.events = EPOLLIN | EPOLLONESHOT ;
+  ev.data.ptr = NULL ;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+  signal(SIGPIPE, SIG_IGN);
+  printf("TM server on %s with %d thread%s\n", sockName, nThreads,
+         (nThreads == 1) ? "" : "s");
+  fflush(stdout);
+  workers = (pthread_t *) calloc(nThreads, sizeof(pthread_t));
+  for (i = 1 ; i < nThreads ; i++)
+    pthread_create(&workers[i], NULL, serverWorker, NULL);
+  serverWorker(NULL);
+  return TRUE;
+} /* runServer */
+
 /********************************************/
 /* E X E C U T I O N   B E G I N S   H E R E */
 /********************************************/
 
-main( int argc, char * argv[] )
-{ if (argc != 2)
-  { printf("usage: %s <filename>\n",argv[0]);
+int main( int argc, char * argv[] )
+{ int opt;
+  char * resumeName = NULL;
+  char * inName = NULL;
+  char * sockName = NULL;
+  int diffflag = FALSE;
+  char err[TM_ERRSIZE];
+  int nThreads = -1 ;
+  int lanes = 0 ;
+  machIO.in = stdin ;
+  machIO.out = stdout ;
+  machIO.termFallback = TRUE ;
+  while ((opt = getopt(argc, argv, "c:s:r:i:j:v:n:T:m:S:K:k:g:Bo:u:d")) != -1)
+  { switch (opt)
+    { case 'c' : ckptInterval = atol(optarg); break;
+      case 's' : strncpy(snapName, optarg, LINESIZE-1); break;
+      case 'r' : resumeName = optarg; break;
+      case 'j' : nThreads = atoi(optarg); break;
+      case 'v' : lanes = atoi(optarg); break;
+      case 'n' : budget = atol(optarg); break;
+      case 'T' : timeLimit = atof(optarg); break;
+      case 'm' : heatName = optarg; break;
+      case 'S' : statsName = optarg; break;
+      case 'K' : topK = atoi(optarg); break;
+      case 'g' : guardLimit = atoi(optarg); break;
+      case 'B' : bufferflag = TRUE; break;
+      case 'o' : outName = optarg; break;
+      case 'u' : sockName = optarg; break;
+      case 'd' : diffflag = TRUE; break;
+      case 'k' :
+        if ( ! readCostModel(optarg) )
+          exit(1);
+        icountflag = TRUE ;
+        break;
+      case 'i' :
+        inName = optarg ;
+        machIO.in = fopen(optarg,"r");
+        if (machIO.in == NULL)
+        { printf("input file '%s' not found\n",optarg);
+          exit(1);
+        }
+        break;
+      default  : optind = argc + 1; break;
+    }
+  }
+  if ((lanes > 0) && (nThreads < 0)) nThreads = 1 ;
+  if ( (optind > argc) || ((outName != NULL) && ! bufferflag)
+       /* the terminal cannot be read before the run */
+       || (bufferflag && (inName == NULL) && (nThreads < 0)
+           && (sockName == NULL) && ! diffflag)
+       || ((lanes > 0)
+           && ((heatName != NULL) || (statsName != NULL) || (guardLimit > 0)))
+       || ((optind < argc - 1) && (nThreads < 0) && ! diffflag)
+       || (diffflag && ((optind == argc) || (nThreads >= 0) || (sockName != NULL)))
+       || ((sockName != NULL)
+           && ((optind < argc - 1) || (lanes > 0) || (resumeName != NULL)))
+       || ((optind == argc) && (sockName == NULL)
+           && ((resumeName == NULL) || (nThreads >= 0))) )
+  { printf("usage: %s [-c <n>] [-s <snapfile>] [-r <snapfile>] "
+           "[-i <infile>] [-n <count>] [-T <seconds>] [-m <file>]\n"
+           "          [-B [-o <outfile>]] [-S <file> [-K <k>]] [-k <costfile>]\n"
+           "          [-g <addr>] <filename>\n",
+           argv[0]);
+    printf("       %s -j <threads> [-v <lanes>] [-n <count>] [-T <seconds>] "
+           "[-m <file>]\n          [-B [-o <suffix>]] [-S <file> [-K <k>]] "
+           "[-k <costfile>] [-g <addr>]\n          <filename> <infile>...\n",
+           argv[0]);
+    printf("       %s -u <socket> [-j <threads>] [-n <count>] [-T <seconds>] "
+           "[-k <costfile>]\n          [-g <addr>] [<filename>]\n",argv[0]);
+    printf("       %s -d [-n <count>] [-T <seconds>] [-k <costfile>] <filename> "
+           "[<infile>...]\n",argv[0]);
+    printf("   -c <n>         checkpoint every n instructions\n");
+    printf("   -s <snapfile>  checkpoint file (default <filename>.snap)\n");
+    printf("   -r <snapfile>  resume from a snapshot\n");
+    printf("   -i <infile>    read IN values from infile\n");
+    printf("   -n <count>     stop a run after count instructions\n");
+    printf("   -T <seconds>   stop a run after seconds of wall-clock time\n");
+    printf("   -m <file>      write a memory access heatmap (CSV, or binary\n"
+           "                  if file ends in .bin); in batch mode each\n"
+           "                  run writes <infile>.<file>\n");
+    printf("   -B             buffered I/O: read all IN values before the run\n"
+           "                  (int32 words if the input file ends in .bin)\n"
+           "                  and write OUT lines in blocks; needs -i\n"
+           "                  unless in batch mode\n");
+    printf("   -o <outfile>   with -B, write OUT to outfile (batch: to\n"
+           "                  <infile>.<outfile>); a name ending in .bin\n"
+           "                  gets the raw int32 values only\n");
+    printf("   -S <file>      write instruction statistics as JSON: opcode\n"
+           "                  counts, branches taken, LD/ST by base register\n"
+           "                  and opcode pairs and triples; in batch mode\n"
+           "                  each run writes <infile>.<file>\n");
+    printf("   -K <k>         list the k most frequent pairs and triples\n"
+           "                  (default 10)\n");
+    printf("   -k <costfile>  estimate cycles with the cost model in\n"
+           "                  costfile (lines '<OPCODE> <n>', 'mem <n>',\n"
+           "                  'taken <n>'); turns on the instruction count\n");
+    printf("   -g <addr>      stop with 'Stack overflow' when the stack goes\n"
+           "                  below addr (rounded down to a page), by\n"
+           "                  protecting the page under it\n");
+    printf("   -j <threads>   run the program once per infile on a pool of\n"
+           "                  threads (0 = one per core), writing the\n"
+           "                  output of each run to <infile>.out\n");
+    printf("   -u <socket>    serve sessions on a Unix socket with -j threads\n"
+           "                  (default 1): each client sends IN values one\n"
+           "                  per line, preceded by the .tm file to run if\n"
+           "                  there is no <filename>, and gets the lines of\n"
+           "                  a batch .out file; -n and -T apply to every\n"
+           "                  session, -T between inputs\n");
+    printf("   -d             run each infile on every engine (single step,\n"
+           "                  run, guarded run, lockstep lanes) and report\n"
+           "                  where they disagree\n");
+    printf("   -v <lanes>     batch mode: run up to lanes infiles in lockstep\n"
+           "                  per thread (default 1 thread; no -m, -S or -g)\n");
+    exit(1);
+  }
+  if (optind < argc)
+  { strncpy(pgmName,argv[optind],LINESIZE-5) ;
+    if (strchr (pgmName, '.') == NULL)
+       strcat(pgmName,".tm");
+
+    /* read the program */
+    prog = tmLoadProgramFile(pgmName, err);
+    if (prog == NULL)
+    { printf("%s\n",err);
+      exit(1);
+    }
+    if (diffflag)
+      return runDiff(&argv[optind+1], argc - optind - 1) ? 1 : 0 ;
+    if ((nThreads >= 0) && (sockName == NULL))
+    { mach = tmNewMachine(prog);
+      if ( (mach == NULL) || ! guardMachine(mach) )
+        exit(1);
+      tmFreeMachine(mach);
+      return runBatch(nThreads, lanes, &argv[optind+1], argc - optind - 1) ? 1 : 0 ;
+    }
+  }
+  if (sockName != NULL)
+    return runServer(sockName, nThreads) ? 0 : 1 ;
+  if (optind == argc) prog = tmLoadProgram("", 0, err);
+  mach = (prog != NULL) ? tmNewMachine(prog) : NULL ;
+  if (mach == NULL)
+  { printf("Out of memory\n");
     exit(1);
   }
-  strcpy(pgmName,argv[1]) ;
-  if (strchr (pgmName, '.') == NULL)
-     strcat(pgmName,".tm");
-  pgm = fopen(pgmName,"r");
-  if (pgm == NULL)
-  { printf("file '%s' not found\n",pgmName);
+  if (bufferflag)
+  { if ( (outName != NULL)
+         && ((machIO.out = fopen(outName, "w")) == NULL) )
+    { printf("Cannot write '%s'\n",outName);
+      exit(1);
+    }
+    if ( ! openBuffers(&machIO, inName,
+                       (outName != NULL) && endsWith(outName, ".bin")) )
+    { printf("Cannot read input file '%s'\n",inName);
+      exit(1);
+    }
+  }
+  tmSetIO(mach, bufferflag ? &bufIO : &fileIO, &machIO);
+  if ( ! guardMachine(mach) )
     exit(1);
+  if (costflag) tmSetCosts(mach, &costs);
+  if (heatName != NULL)
+  { prof = (MEMPROF *) malloc(sizeof(MEMPROF));
+    if (prof != NULL) tmSetProfile(mach, prof);
+  }
+  if (statsName != NULL)
+  { stats = (TM_STATS *) malloc(sizeof(TM_STATS));
+    if (stats != NULL) tmSetStats(mach, stats);
+  }
+  if (snapName[0] == '\0')
+    snprintf(snapName, sizeof snapName, "%s%s",
+             (resumeName != NULL) ? resumeName : pgmName,
+             (resumeName != NULL) ? "" : ".snap");
+  if (resumeName != NULL)
+  { if ( ! loadSnapshot(resumeName) )
+      exit(1) ;
+    printf("Resumed from %s after %ld instructions\n",
+           resumeName, tmInsCount(mach));
   }
+  nextCkpt = tmInsCount(mach) + ckptInterval ;
 
-  /* read the program */
-  if ( ! readInstructions ())
-         exit(1) ;
   /* switch input file to terminal */
   /* reset( input ); */
   /* read-eval-print */
   printf("TM  simulation (enter h for help)...\n");
+  { int lo, hi ;
+    if ( tmGetGuard(mach, &lo, &hi) )
+      printf("Stack guard at dMem[%d..%d]\n", lo, hi);
+  }
   do
      done = ! doCommand ();
   while (! done );
+  if (prof != NULL)
+    writeMemProfile(prof, heatName);
+  if (stats != NULL)
+    writeStats(stats, statsName);
+  if (bufferflag)
+  { closeBuffers(&machIO);
+    if (machIO.out != stdout) fclose(machIO.out);
+  }
   printf("Simulation done.\n");
   return 0;
 }
@@ -0,0 +1,1453 @@
+/****************************************************/
+/* File: libtm.c                                    */
+/* Embeddable TM ("Tiny Machine") simulator         */
+/* Loader, load-time verifier and interpreter of    */
+/* tm.c, with all state kept in TM_PROGRAM and      */
+/* TM_MACHINE objects                               */
+/****************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "libtm.h"
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define   SNAP_MAGIC    0x4e534d54 /* "TMSN" */
+#define   SNAP_VERSION  1
+
+/******* type  *******/
+
+/* iMem has iSize locations plus a HALT sentinel at iMem[iSize] */
+struct TM_PROGRAM {
+      INSTRUCTION * iMem ;
+      unsigned char * iCheck ; /* verifier flags for each iMem location */
+      int iSize ;
+      /* debugger patches: locations holding opBRK with the */
+      /* instructions they replaced, and the watched ranges */
+      int nBrk ;
+      int * brkLoc ;
+      INSTRUCTION * brkSave ;
+      int nWatch ;
+      int * watchLo ;
+      int * watchHi ;
+   };
+
+struct TM_MACHINE {
+      int reg [NO_REGS];
+      int * dMem ;       /* DADDR_SIZE + 1 words, stepTM lets m == DADDR_SIZE */
+                         /* through; mmap'd so that pages can be protected  */
+      TM_PROGRAM * prog ;
+      TM_IO io ;
+      void * user ;      /* handed to the io callbacks */
+      int pcSafe ;       /* reg[PC_REG] was set by a verified instruction */
+      long insCount ;    /* instructions executed since reset */
+      /* limits, only checked when a branch goes backwards */
+      int limited ;      /* fuel or deadline armed */
+      long fuel ;        /* stop once insCount reaches it (0 = none) */
+      struct timespec deadline ; /* stop after it (tv_sec 0 = none) */
+      int ticks ;        /* backward branches since the clock was read */
+      MEMPROF * prof ;   /* memory access profile, NULL when off */
+      TM_STATS * stats ; /* instruction statistics, NULL when off */
+      const TM_COSTS * costs ; /* cycle-cost model, NULL when off */
+      long cycles ;      /* estimated cycles */
+      int brkPc ;        /* breakpoint that may be passed once */
+      int watchAddr ;    /* last srWATCH store and the value it replaced */
+      int watchOld ;
+      int guardLo ;      /* protected dMem words, none when guardLo > guardHi */
+      int guardHi ;
+   };
+
+/******** vars ********/
+static const char * opCodeTab[]
+        = {"HALT","IN","OUT","ADD","SUB","MUL","DIV","????",
+            /* RR opcodes */
+           "LD","ST","????", /* RM opcodes */
+           "LDA","LDC","JLT","JLE","JGT","JGE","JEQ","JNE","????",
+           /* RA opcodes */
+           "BRK"
+          };
+
+static const char * stepResultTab[]
+        = {"OK","Halted","Instruction Memory Fault",
+           "Data Memory Fault","Division by 0",
+           "Input exhausted","Instruction budget exhausted",
+           "Time limit exceeded","Breakpoint","Watchpoint",
+           "Stack overflow"
+          };
+
+/********************************************/
+int tmOpClass ( int c )
+{ if      ( c <= opRRLim) return ( opclRR );
+  else if ( c <= opRMLim) return ( opclRM );
+  else                    return ( opclRA );
+} /* tmOpClass */
+
+/********************************************/
+const char * tmOpName ( int op )
+{ if ((op < opHALT) || (op > opBRK)) op = opRALim ;
+  return opCodeTab[op] ;
+} /* tmOpName */
+
+/********************************************/
+const char * tmResultName ( STEPRESULT result )
+{ return stepResultTab[result] ;
+} /* tmResultName */
+
+/********************************************/
+/* perfect hash of the opcode mnemonics;    */
+/* every opcode gets its own slot in a      */
+/* 32-entry table                           */
+/********************************************/
+#define OPHASH_SIZE 32
+#define OPHASH(w,len) \
+  ( ( (unsigned char)(w)[0] + 12 * (unsigned char)(w)[1] \
+      + 6 * (unsigned char)(w)[(len)-1] + (len) ) & (OPHASH_SIZE-1) )
+
+/* OPHASH of each entry of opCodeTab; recompute when opcodes change */
+static const signed char opHashTab[OPHASH_SIZE]
+        = { -1, -1, -1, -1, -1, opLDA, opOUT, opIN,
+            -1, -1, -1, -1, opADD, -1, -1, opJEQ,
+            opHALT, opLDC, -1, opJNE, opMUL, opJLT, opLD, opDIV,
+            -1, opJGT, -1, opJLE, -1, opST, opSUB, opJGE
+          };
+
+int tmLookupOpcode ( const char * w, int len )
+{ int op;
+  if ((len < 2) || (len > 4)) return -1 ;
+  op = opHashTab[OPHASH(w,len)] ;
+  if ( (op >= 0) && (opCodeTab[op][len] == '\0')
+       && (memcmp(opCodeTab[op], w, len) == 0) )
+    return op ;
+  return -1 ;
+} /* tmLookupOpcode */
+
+/********************************************/
+/* (re)allocate iMem for at least size      */
+/* locations; new locations hold HALT 0,0,0 */
+/********************************************/
+static int setIMemSize ( TM_PROGRAM * prog, int size, char * err )
+{ INSTRUCTION * p;
+  unsigned char * c;
+  int loc;
+  if (size < IADDR_SIZE) size = IADDR_SIZE ;
+  if ((prog->iMem != NULL) && (size <= prog->iSize)) return TRUE;
+  p = (INSTRUCTION *) realloc(prog->iMem, (size + 1) * sizeof(INSTRUCTION));
+  if (p != NULL) prog->iMem = p ;
+  c = (p == NULL) ? NULL
+                  : (unsigned char *) realloc(prog->iCheck, size + 1);
+  if (c == NULL)
+  { snprintf(err, TM_ERRSIZE, "Out of memory for %d instructions", size);
+    return FALSE;
+  }
+  loc = (prog->iCheck == NULL) ? 0 : prog->iSize ;
+  prog->iCheck = c ;
+  prog->iSize = size ;
+  for ( ; loc <= size ; loc++)
+  { p[loc].iop = opHALT ;
+    p[loc].iarg1 = 0 ;
+    p[loc].iarg2 = 0 ;
+    p[loc].iarg3 = 0 ;
+    c[loc] = 0 ;
+  }
+  return TRUE;
+} /* setIMemSize */
+
+/********************************************/
+/* loader error: also shows the column and  */
+/* the offending line                       */
+/********************************************/
+static int loadError ( char * err, const char * msg, int lineNo,
+                       const char * line, const char * at,
+                       const char * end, int instNo )
+{ const char * eol = line;
+  int col = (int) (at - line) ;
+  int len;
+  while ((eol < end) && (*eol != '\n') && (*eol != '\r')) eol++ ;
+  len = snprintf(err, TM_ERRSIZE, "Line %d, column %d", lineNo, col+1);
+  if (instNo >= 0)
+    len += snprintf(err + len, TM_ERRSIZE - len, " (Instruction %d)", instNo);
+  if ((eol - line) > TM_ERRSIZE / 2) eol = line + TM_ERRSIZE / 2 ;
+  if (col > TM_ERRSIZE / 2) col = TM_ERRSIZE / 2 ;
+  snprintf(err + len, TM_ERRSIZE - len, "   %s\n   %.*s\n   %*s^",
+           msg, (int) (eol - line), line, col, "");
+  return FALSE;
+} /* loadError */
+
+/********************************************/
+/* scanner state of the loader              */
+/********************************************/
+typedef struct {
+      const char * p ;      /* current character */
+      const char * end ;    /* end of the text */
+      const char * line ;   /* start of the current line */
+      int lineNo ;
+   } LOADSCAN;
+
+#define LBLANK(c) (((c) == ' ') || ((c) == '\t'))
+
+static void lSkipBlanks ( LOADSCAN * ls )
+{ while ((ls->p < ls->end) && LBLANK(*ls->p)) ls->p++ ;
+} /* lSkipBlanks */
+
+static int lSkipCh ( LOADSCAN * ls, char c )
+{ lSkipBlanks(ls);
+  if ((ls->p < ls->end) && (*ls->p == c))
+  { ls->p++ ;
+    return TRUE;
+  }
+  return FALSE;
+} /* lSkipCh */
+
+/* signed terms that are added up, as typed in the tm REPL */
+static int lGetNum ( LOADSCAN * ls, int * num )
+{ int sign, term;
+  int temp = FALSE;
+  *num = 0 ;
+  do
+  { sign = 1 ;
+    lSkipBlanks(ls);
+    while ((ls->p < ls->end) && ((*ls->p == '+') || (*ls->p == '-')))
+    { temp = FALSE ;
+      if (*ls->p == '-') sign = - sign ;
+      ls->p++ ;
+      lSkipBlanks(ls);
+    }
+    term = 0 ;
+    while ((ls->p < ls->end) && (*ls->p >= '0') && (*ls->p <= '9'))
+    { temp = TRUE ;
+      term = term * 10 + (*ls->p - '0') ;
+      ls->p++ ;
+    }
+    *num += term * sign ;
+    lSkipBlanks(ls);
+  } while ((ls->p < ls->end) && ((*ls->p == '+') || (*ls->p == '-'))) ;
+  return temp;
+} /* lGetNum */
+
+static int lGetReg ( LOADSCAN * ls, int * regNo )
+{ return lGetNum(ls, regNo) && (*regNo >= 0) && (*regNo < NO_REGS) ;
+} /* lGetReg */
+
+/* report a syntax error at at and give up */
+#define LERR(msg,at,loc) \
+  return loadError(err, msg, ls.lineNo, ls.line, at, ls.end, loc)
+
+/********************************************/
+/* parse the whole program text            */
+/********************************************/
+static int parseProgram ( TM_PROGRAM * prog, const char * text, size_t size,
+                          char * err )
+{ LOADSCAN ls;
+  const char * w;
+  const char * at;
+  INSTRUCTION * ins;
+  int op, loc, arg1, arg2, arg3;
+  ls.p = text ;
+  ls.end = text + size ;
+  ls.lineNo = 0 ;
+  while (ls.p < ls.end)
+  { ls.line = ls.p ;
+    ls.lineNo++ ;
+    lSkipBlanks(&ls);
+    if ( (ls.p < ls.end) && (*ls.p != '*') && (*ls.p != '\n')
+         && (*ls.p != '\r') )
+    { at = ls.p ;
+      if (! lGetNum(&ls, &loc)) LERR("Bad location", at, -1);
+      if (loc < 0) LERR("Bad location", at, loc);
+      if (loc >= IADDR_MAX) LERR("Location too large", at, loc);
+      if ((loc >= prog->iSize) && ! setIMemSize(prog, 2 * loc + 1, err))
+        return FALSE;
+      at = ls.p ;
+      if (! lSkipCh(&ls, ':')) LERR("Missing colon", at, loc);
+      lSkipBlanks(&ls);
+      w = ls.p ;
+      while ((ls.p < ls.end) && isalnum((unsigned char) *ls.p)) ls.p++ ;
+      if (ls.p == w) LERR("Missing opcode", w, loc);
+      op = tmLookupOpcode(w, (int) (ls.p - w)) ;
+      if (op < 0) LERR("Illegal opcode", w, loc);
+      lSkipBlanks(&ls);
+      at = ls.p ;
+      if (! lGetReg(&ls, &arg1)) LERR("Bad first register", at, loc);
+      at = ls.p ;
+      if (! lSkipCh(&ls, ',')) LERR("Missing comma", at, loc);
+      lSkipBlanks(&ls);
+      at = ls.p ;
+      if ( tmOpClass(op) == opclRR )
+      { if (! lGetReg(&ls, &arg2)) LERR("Bad second register", at, loc);
+        at = ls.p ;
+        if (! lSkipCh(&ls, ',')) LERR("Missing comma", at, loc);
+        lSkipBlanks(&ls);
+        at = ls.p ;
+        if (! lGetReg(&ls, &arg3)) LERR("Bad third register", at, loc);
+      }
+      else
+      { if (! lGetNum(&ls, &arg2)) LERR("Bad displacement", at, loc);
+        at = ls.p ;
+        if ( ! lSkipCh(&ls, '(') && ! lSkipCh(&ls, ',') )
+          LERR("Missing LParen", at, loc);
+        lSkipBlanks(&ls);
+        at = ls.p ;
+        if (! lGetReg(&ls, &arg3)) LERR("Bad second register", at, loc);
+      }
+      ins = &prog->iMem[loc] ;
+      ins->iop = op;
+      ins->iarg1 = arg1;
+      ins->iarg2 = arg2;
+      ins->iarg3 = arg3;
+    }
+    /* the rest of the line is a comment */
+    w = memchr(ls.p, '\n', ls.end - ls.p) ;
+    ls.p = (w == NULL) ? ls.end : w + 1 ;
+  }
+  return TRUE;
+} /* parseProgram */
+
+/********************************************/
+/* Load-time verifier: marks instructions   */
+/* whose pc and data address checks can be  */
+/* skipped by stepTM. A pc is valid when it */
+/* passes the stepTM test (0 <= pc <= iSize */
+/* where iMem[iSize] is the HALT sentinel); */
+/* likewise for data addresses.             */
+/* gpKnown says the global pointer holds    */
+/* its reset value 0 at the start; it then  */
+/* stays 0 if no instruction writes it.     */
+/********************************************/
+static int writesReg ( INSTRUCTION * ins, int regNo )
+{ switch (ins->iop)
+  { case opIN :  case opADD : case opSUB : case opMUL : case opDIV :
+    case opLD :  case opLDA : case opLDC :
+      return ins->iarg1 == regNo ;
+    default :
+      return FALSE;
+  }
+} /* writesReg */
+
+static void verifyProgram ( TM_PROGRAM * prog, int gpKnown )
+{ INSTRUCTION * ins;
+  int iSize = prog->iSize ;
+  int loc, target, addr, flags;
+  int gpConst = gpKnown ;
+  for (loc = 0 ; (loc < iSize) && gpConst ; loc++)
+    if (writesReg(&prog->iMem[loc], GP_REG)) gpConst = FALSE ;
+  for (loc = 0 ; loc <= iSize ; loc++)
+  { ins = &prog->iMem[loc] ;
+    flags = vfPC_OK ;
+    switch (ins->iop)
+    { case opLD :
+      case opST :
+        if (ins->iarg3 == PC_REG)
+        { addr = loc + 1 + ins->iarg2 ;
+          flags |= vfPC_REL ;
+        }
+        else if ((ins->iarg3 == GP_REG) && gpConst)
+        { addr = ins->iarg2 ;
+          flags |= vfGP_REL ;
+        }
+        else addr = -1 ;
+        if ((addr >= 0) && (addr <= DADDR_SIZE)) flags |= vfMEM_OK ;
+        if (writesReg(ins, PC_REG)) flags &= ~vfPC_OK ;
+        break;
+      case opLDA :
+      case opJLT : case opJLE : case opJGT :
+      case opJGE : case opJEQ : case opJNE :
+        if ((ins->iop != opLDA) || (ins->iarg1 == PC_REG))
+        { target = loc + 1 + ins->iarg2 ;
+          if ( (ins->iarg3 != PC_REG)
+               || (target < 0) || (target > iSize) )
+            flags &= ~vfPC_OK ;
+        }
+        break;
+      case opLDC :
+        if ( (ins->iarg1 == PC_REG)
+             && ((ins->iarg2 < 0) || (ins->iarg2 > iSize)) )
+          flags &= ~vfPC_OK ;
+        break;
+      default :
+        if (writesReg(ins, PC_REG)) flags &= ~vfPC_OK ;
+        break;
+    }
+    prog->iCheck[loc] = flags ;
+  }
+} /* verifyProgram */
+
+/********************************************/
+static TM_PROGRAM * newProgram ( char * err )
+{ TM_PROGRAM * prog;
+  prog = (TM_PROGRAM *) calloc(1, sizeof(TM_PROGRAM));
+  if (prog == NULL)
+  { snprintf(err, TM_ERRSIZE, "Out of memory");
+    return NULL;
+  }
+  if (! setIMemSize(prog, IADDR_SIZE, err))
+  { tmFreeProgram(prog);
+    return NULL;
+  }
+  return prog;
+} /* newProgram */
+
+/********************************************/
+TM_PROGRAM * tmLoadProgram ( const char * text, size_t size, char * err )
+{ TM_PROGRAM * prog = newProgram(err);
+  if (prog == NULL) return NULL;
+  if (! parseProgram(prog, text, size, err))
+  { tmFreeProgram(prog);
+    return NULL;
+  }
+  verifyProgram(prog, TRUE);
+  return prog;
+} /* tmLoadProgram */
+
+/********************************************/
+/* map the program file (or read it, when   */
+/* it cannot be mapped) and parse it        */
+/********************************************/
+TM_PROGRAM * tmLoadProgramFile ( const char * fname, char * err )
+{ struct stat st;
+  TM_PROGRAM * prog;
+  char * text = NULL;
+  size_t size = 0, cap = 0;
+  ssize_t got;
+  int fd, mapped = FALSE;
+  fd = open(fname, O_RDONLY);
+  if (fd < 0)
+  { snprintf(err, TM_ERRSIZE, "file '%s' not found", fname);
+    return NULL;
+  }
+  if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0))
+  { text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (text != MAP_FAILED)
+    { size = st.st_size ;
+      mapped = TRUE ;
+      madvise(text, size, MADV_SEQUENTIAL);
+    }
+    else text = NULL ;
+  }
+  if (! mapped)
+  { do
+    { if (size == cap)
+      { char * more;
+        cap = (cap == 0) ? 65536 : 2 * cap ;
+        more = (char *) realloc(text, cap);
+        if (more == NULL)
+        { snprintf(err, TM_ERRSIZE, "Out of memory reading %s", fname);
+          free(text);
+          close(fd);
+          return NULL;
+        }
+        text = more ;
+      }
+      got = read(fd, text + size, cap - size);
+      if (got > 0) size += got ;
+    } while (got > 0);
+  }
+  close(fd);
+  prog = tmLoadProgram(text, size, err);
+  if (mapped) munmap(text, size);
+  else free(text);
+  return prog;
+} /* tmLoadProgramFile */
+
+/********************************************/
+void tmFreeProgram ( TM_PROGRAM * prog )
+{ if (prog == NULL) return;
+  free(prog->iMem);
+  free(prog->iCheck);
+  free(prog->brkLoc);
+  free(prog->brkSave);
+  free(prog->watchLo);
+  free(prog->watchHi);
+  free(prog);
+} /* tmFreeProgram */
+
+/********************************************/
+int tmProgramSize ( TM_PROGRAM * prog )
+{ return prog->iSize ;
+} /* tmProgramSize */
+
+/********************************************/
+int tmProgramExtent ( TM_PROGRAM * prog )
+{ INSTRUCTION * iMem = prog->iMem ;
+  int iCount = prog->iSize ;
+  while ((iCount > 0) && (iMem[iCount-1].iop == opHALT)
+         && (iMem[iCount-1].iarg1 == 0) && (iMem[iCount-1].iarg2 == 0)
+         && (iMem[iCount-1].iarg3 == 0))
+    iCount-- ;
+  return iCount ;
+} /* tmProgramExtent */
+
+/********************************************/
+int tmGetInstruction ( TM_PROGRAM * prog, int loc, INSTRUCTION * ins )
+{ int i;
+  if ((loc < 0) || (loc > prog->iSize)) return FALSE;
+  *ins = prog->iMem[loc] ;
+  if (ins->iop == opBRK)
+    for (i = 0 ; i < prog->nBrk ; i++)
+      if (prog->brkLoc[i] == loc) *ins = prog->brkSave[i] ;
+  return TRUE;
+} /* tmGetInstruction */
+
+/********************************************/
+int tmCheckFlags ( TM_PROGRAM * prog, int loc )
+{ if ((loc < 0) || (loc > prog->iSize)) return 0;
+  return prog->iCheck[loc] ;
+} /* tmCheckFlags */
+
+/********************************************/
+/* dMem rounded up to whole pages           */
+/********************************************/
+static size_t dMemBytes ( void )
+{ size_t page = (size_t) sysconf(_SC_PAGESIZE) ;
+  return ((DADDR_SIZE + 1) * sizeof(int) + page - 1) / page * page ;
+} /* dMemBytes */
+
+/********************************************/
+TM_MACHINE * tmNewMachine ( TM_PROGRAM * prog )
+{ TM_MACHINE * m;
+  void * d;
+  m = (TM_MACHINE *) calloc(1, sizeof(TM_MACHINE));
+  if (m == NULL) return NULL;
+  d = mmap(NULL, dMemBytes(), PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (d == MAP_FAILED)
+  { free(m);
+    return NULL;
+  }
+  m->dMem = (int *) d ;
+  m->guardLo = 0 ;
+  m->guardHi = -1 ;
+  m->prog = prog ;
+  tmReset(m);
+  return m;
+} /* tmNewMachine */
+
+/********************************************/
+void tmFreeMachine ( TM_MACHINE * m )
+{ munmap(m->dMem, dMemBytes());
+  free(m);
+} /* tmFreeMachine */
+
+/********************************************/
+TM_PROGRAM * tmMachineProgram ( TM_MACHINE * m )
+{ return m->prog ;
+} /* tmMachineProgram */
+
+/********************************************/
+void tmReset ( TM_MACHINE * m )
+{ int regNo, loc;
+  for (regNo = 0 ; regNo < NO_REGS ; regNo++)
+      m->reg[regNo] = 0 ;
+  /* drop the pages rather than clear them: they come back zeroed */
+  /* when touched, so an idle machine holds little memory         */
+  if (madvise(m->dMem, dMemBytes(), MADV_DONTNEED) != 0)
+    for (loc = 1 ; loc < DADDR_SIZE ; loc++)
+      if ((loc < m->guardLo) || (loc > m->guardHi))
+        m->dMem[loc] = 0 ;
+  m->dMem[0] = DADDR_SIZE - 1 ;
+  m->insCount = 0 ;
+  m->cycles = 0 ;
+  m->limited = FALSE ;
+  m->pcSafe = FALSE ;
+  m->brkPc = -1 ;
+  if (m->prof != NULL)
+  { memset(m->prof, 0, sizeof(MEMPROF));
+    m->prof->minSp = DADDR_SIZE - 1 ;
+  }
+  if (m->stats != NULL) tmSetStats(m, m->stats);
+} /* tmReset */
+
+/********************************************/
+void tmSetIO ( TM_MACHINE * m, const TM_IO * io, void * user )
+{ m->io = *io ;
+  m->user = user ;
+} /* tmSetIO */
+
+/********************************************/
+void tmSetCosts ( TM_MACHINE * m, const TM_COSTS * costs )
+{ m->costs = costs ;
+} /* tmSetCosts */
+
+/********************************************/
+void tmSetProfile ( TM_MACHINE * m, MEMPROF * prof )
+{ m->prof = prof ;
+  if (prof != NULL)
+  { memset(prof, 0, sizeof(MEMPROF));
+    prof->minSp = DADDR_SIZE - 1 ;
+  }
+} /* tmSetProfile */
+
+/********************************************/
+void tmSetStats ( TM_MACHINE * m, TM_STATS * stats )
+{ m->stats = stats ;
+  if (stats != NULL)
+  { memset(stats, 0, sizeof(TM_STATS));
+    stats->last[0] = -1 ;
+    stats->last[1] = -1 ;
+  }
+} /* tmSetStats */
+
+/********************************************/
+int tmGetReg ( TM_MACHINE * m, int regNo )
+{ return m->reg[regNo] ;
+} /* tmGetReg */
+
+/********************************************/
+void tmSetReg ( TM_MACHINE * m, int regNo, int value )
+{ m->reg[regNo] = value ;
+  if (regNo == PC_REG) m->pcSafe = FALSE ;
+} /* tmSetReg */
+
+/********************************************/
+int tmGetMem ( TM_MACHINE * m, int addr )
+{ if ((addr >= m->guardLo) && (addr <= m->guardHi)) return 0 ;
+  return m->dMem[addr] ;
+} /* tmGetMem */
+
+/********************************************/
+void tmSetMem ( TM_MACHINE * m, int addr, int value )
+{ if ((addr >= m->guardLo) && (addr <= m->guardHi)) return ;
+  m->dMem[addr] = value ;
+} /* tmSetMem */
+
+/********************************************/
+long tmInsCount ( TM_MACHINE * m )
+{ return m->insCount ;
+} /* tmInsCount */
+
+/********************************************/
+long tmCycles ( TM_MACHINE * m )
+{ return m->cycles ;
+} /* tmCycles */
+
+/********************************************/
+/* deadline = now + seconds (tv_sec 0 if    */
+/* seconds is 0)                            */
+/********************************************/
+static void setDeadline ( struct timespec * deadline, double seconds )
+{ deadline->tv_sec = 0 ;
+  deadline->tv_nsec = 0 ;
+  if (seconds > 0)
+  { clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += (time_t) seconds ;
+    deadline->tv_nsec += (long) ((seconds - (time_t) seconds) * 1e9) ;
+    if (deadline->tv_nsec >= 1000000000L)
+    { deadline->tv_sec++ ;
+      deadline->tv_nsec -= 1000000000L ;
+    }
+  }
+} /* setDeadline */
+
+/********************************************/
+static int pastDeadline ( struct timespec * deadline )
+{ struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec > deadline->tv_sec)
+         || ((now.tv_sec == deadline->tv_sec)
+             && (now.tv_nsec >= deadline->tv_nsec)) ;
+} /* pastDeadline */
+
+/********************************************/
+void tmSetLimits ( TM_MACHINE * m, long fuel, double seconds )
+{ m->fuel = (fuel > 0) ? m->insCount + fuel : 0 ;
+  m->ticks = 0 ;
+  setDeadline(&m->deadline, seconds);
+  m->limited = (m->fuel > 0) || (m->deadline.tv_sec > 0) ;
+} /* tmSetLimits */
+
+/********************************************/
+/* called on backward branches only; the    */
+/* clock is read every 1024 of them         */
+/********************************************/
+static STEPRESULT checkLimits ( TM_MACHINE * mc )
+{ if ( (mc->fuel > 0) && (mc->insCount >= mc->fuel) )
+    return srFUEL ;
+  if ( (mc->deadline.tv_sec > 0) && ((++mc->ticks & 1023) == 0)
+       && pastDeadline(&mc->deadline) )
+    return srTIMEOUT ;
+  return srOKAY ;
+} /* checkLimits */
+
+/********************************************/
+/* Debugger patches. A breakpoint swaps the */
+/* instruction for opBRK and keeps it in    */
+/* brkSave; a watch marks every ST that may */
+/* store into the range with vfWATCH: those */
+/* with a computed address, and those with  */
+/* a verified fixed one inside the range.   */
+/********************************************/
+static INSTRUCTION savedInstruction ( TM_PROGRAM * prog, int loc )
+{ int i;
+  for (i = 0 ; i < prog->nBrk ; i++)
+    if (prog->brkLoc[i] == loc) return prog->brkSave[i] ;
+  return prog->iMem[loc] ;
+} /* savedInstruction */
+
+static int watched ( TM_PROGRAM * prog, int addr )
+{ int i;
+  for (i = 0 ; i < prog->nWatch ; i++)
+    if ((addr >= prog->watchLo[i]) && (addr <= prog->watchHi[i]))
+      return TRUE;
+  return FALSE;
+} /* watched */
+
+static void markWatches ( TM_PROGRAM * prog )
+{ INSTRUCTION ins;
+  int loc, addr, check;
+  for (loc = 0 ; loc <= prog->iSize ; loc++)
+  { check = prog->iCheck[loc] & ~vfWATCH ;
+    ins = savedInstruction(prog, loc) ;
+    if ((ins.iop == opST) && (prog->nWatch > 0))
+    { if (check & vfGP_REL) addr = ins.iarg2 ;
+      else if (check & vfPC_REL) addr = loc + 1 + ins.iarg2 ;
+      else addr = -1 ;
+      if ((addr < 0) || watched(prog, addr)) check |= vfWATCH ;
+    }
+    prog->iCheck[loc] = check ;
+  }
+} /* markWatches */
+
+/********************************************/
+int tmSetBreak ( TM_PROGRAM * prog, int loc )
+{ int * l;
+  INSTRUCTION * i;
+  if ((loc < 0) || (loc > prog->iSize) || tmIsBreak(prog, loc))
+    return FALSE;
+  l = (int *) realloc(prog->brkLoc, (prog->nBrk + 1) * sizeof(int));
+  if (l != NULL) prog->brkLoc = l ;
+  i = (l == NULL) ? NULL : (INSTRUCTION *) realloc(prog->brkSave,
+                             (prog->nBrk + 1) * sizeof(INSTRUCTION));
+  if (i == NULL) return FALSE;
+  prog->brkSave = i ;
+  prog->brkLoc[prog->nBrk] = loc ;
+  prog->brkSave[prog->nBrk] = prog->iMem[loc] ;
+  prog->nBrk++ ;
+  prog->iMem[loc].iop = opBRK ;
+  return TRUE;
+} /* tmSetBreak */
+
+/********************************************/
+int tmClearBreak ( TM_PROGRAM * prog, int loc )
+{ int i;
+  for (i = 0 ; i < prog->nBrk ; i++)
+    if (prog->brkLoc[i] == loc)
+    { prog->iMem[loc] = prog->brkSave[i] ;
+      prog->nBrk-- ;
+      prog->brkLoc[i] = prog->brkLoc[prog->nBrk] ;
+      prog->brkSave[i] = prog->brkSave[prog->nBrk] ;
+      return TRUE;
+    }
+  return FALSE;
+} /* tmClearBreak */
+
+/********************************************/
+int tmIsBreak ( TM_PROGRAM * prog, int loc )
+{ return (loc >= 0) && (loc <= prog->iSize)
+         && (prog->iMem[loc].iop == opBRK) ;
+} /* tmIsBreak */
+
+/********************************************/
+void tmSkipBreak ( TM_MACHINE * m )
+{ m->brkPc = tmIsBreak(m->prog, m->reg[PC_REG]) ? m->reg[PC_REG] : -1 ;
+} /* tmSkipBreak */
+
+/********************************************/
+int tmAddWatch ( TM_PROGRAM * prog, int lo, int hi )
+{ int * l;
+  int * h;
+  if ((lo < 0) || (hi < lo) || (hi > DADDR_SIZE)) return FALSE;
+  l = (int *) realloc(prog->watchLo, (prog->nWatch + 1) * sizeof(int));
+  if (l != NULL) prog->watchLo = l ;
+  h = (l == NULL) ? NULL : (int *) realloc(prog->watchHi,
+                                          (prog->nWatch + 1) * sizeof(int));
+  if (h == NULL) return FALSE;
+  prog->watchHi = h ;
+  prog->watchLo[prog->nWatch] = lo ;
+  prog->watchHi[prog->nWatch] = hi ;
+  prog->nWatch++ ;
+  markWatches(prog);
+  return TRUE;
+} /* tmAddWatch */
+
+/********************************************/
+int tmRemoveWatch ( TM_PROGRAM * prog, int lo, int hi )
+{ int i;
+  for (i = 0 ; i < prog->nWatch ; i++)
+    if ((prog->watchLo[i] == lo) && (prog->watchHi[i] == hi))
+    { prog->nWatch-- ;
+      prog->watchLo[i] = prog->watchLo[prog->nWatch] ;
+      prog->watchHi[i] = prog->watchHi[prog->nWatch] ;
+      markWatches(prog);
+      return TRUE;
+    }
+  return FALSE;
+} /* tmRemoveWatch */
+
+/********************************************/
+int tmGetWatch ( TM_PROGRAM * prog, int i, int * lo, int * hi )
+{ if ((i < 0) || (i >= prog->nWatch)) return FALSE;
+  *lo = prog->watchLo[i] ;
+  *hi = prog->watchHi[i] ;
+  return TRUE;
+} /* tmGetWatch */
+
+/********************************************/
+void tmLastWatch ( TM_MACHINE * m, int * addr, int * oldValue )
+{ *addr = m->watchAddr ;
+  *oldValue = m->watchOld ;
+} /* tmLastWatch */
+
+/********************************************/
+/* statistics of the instruction at pc; a   */
+/* conditional jump before it was taken if  */
+/* pc does not follow it                    */
+/********************************************/
+static void countStep ( TM_STATS * st, int pc, const INSTRUCTION * ins )
+{ int op = ins->iop ;
+  int prev = st->last[0] ;
+  st->ops[op]++ ;
+  if (prev >= 0)
+  { st->pairs[prev][op]++ ;
+    if (st->last[1] >= 0) st->triples[st->last[1]][prev][op]++ ;
+    if ((prev >= opJLT) && (prev <= opJNE) && (pc != st->lastPc + 1))
+      st->taken[prev]++ ;
+  }
+  if (op == opLD) st->reads[ins->iarg3]++ ;
+  else if (op == opST) st->writes[ins->iarg3]++ ;
+  st->last[1] = prev ;
+  st->last[0] = op ;
+  st->lastPc = pc ;
+} /* countStep */
+
+/********************************************/
+/* set the pc to target; a backward transfer is where a run can loop, */
+/* so the limits are checked there and nowhere else                  */
+/* the profile keeps the lowest value loaded into sp */
+#define SP_SEEN(r,v) \
+  { if ( ((r) == SP_REG) && (mc->prof != NULL) && ((v) < mc->prof->minSp) ) \
+      mc->prof->minSp = (v) ; \
+  }
+
+#define JUMP(target) \
+  { reg[PC_REG] = (target) ; \
+    if ( mc->costs != NULL ) mc->cycles += mc->costs->taken ; \
+    if ( mc->limited && ((target) <= pc) ) \
+    { STEPRESULT lim = checkLimits(mc) ; \
+      if (lim != srOKAY) return lim ; \
+    } \
+  }
+
+static STEPRESULT stepTM ( TM_MACHINE * mc )
+{ INSTRUCTION currentinstruction  ;
+  int * reg = mc->reg ;
+  int * dMem = mc->dMem ;
+  int pc  ;
+  int r = 0, s = 0, t = 0, m = 0 ;
+  int check ;
+
+  pc = reg[PC_REG] ;
+  if ( ! mc->pcSafe && ( (pc < 0) || (pc > mc->prog->iSize) ) )
+      return srIMEM_ERR ;
+  reg[PC_REG] = pc + 1 ;
+  currentinstruction = mc->prog->iMem[ pc ] ;
+  check = mc->prog->iCheck[ pc ] ;
+  mc->pcSafe = check & vfPC_OK ;
+decode :
+  if ( mc->costs != NULL ) mc->cycles += mc->costs->op[currentinstruction.iop] ;
+  if ( (mc->stats != NULL) && (currentinstruction.iop != opBRK) )
+    countStep(mc->stats, pc, &currentinstruction) ;
+  switch (tmOpClass(currentinstruction.iop) )
+  { case opclRR :
+    /***********************************/
+      r = currentinstruction.iarg1 ;
+      s = currentinstruction.iarg2 ;
+      t = currentinstruction.iarg3 ;
+      break;
+
+    case opclRM :
+    /***********************************/
+      r = currentinstruction.iarg1 ;
+      s = currentinstruction.iarg3 ;
+      m = currentinstruction.iarg2 + reg[s] ;
+      if ( ! (check & vfMEM_OK) && ( (m < 0) || (m > DADDR_SIZE) ) )
+         return srDMEM_ERR ;
+      break;
+
+    case opclRA :
+    /***********************************/
+      r = currentinstruction.iarg1 ;
+      s = currentinstruction.iarg3 ;
+      m = currentinstruction.iarg2 + reg[s] ;
+      break;
+  } /* case */
+
+  switch ( currentinstruction.iop)
+  { /* RR instructions */
+    case opHALT :
+    /***********************************/
+      if (mc->io.halt != NULL) mc->io.halt(mc->user, r, s, t);
+      return srHALT ;
+      /* break; */
+
+    case opIN :
+    /***********************************/
+      if ( (mc->io.in == NULL) || ! mc->io.in(mc->user, &reg[r]) )
+        return srNOINPUT ;
+      break;
+
+    case opOUT :
+      if (mc->io.out != NULL) mc->io.out(mc->user, reg[r]);
+      break;
+    case opADD :  reg[r] = reg[s] + reg[t] ;  break;
+    case opSUB :  reg[r] = reg[s] - reg[t] ;  break;
+    case opMUL :  reg[r] = reg[s] * reg[t] ;  break;
+
+    case opDIV :
+    /***********************************/
+      if ( reg[t] != 0 ) reg[r] = reg[s] / reg[t];
+      else return srZERODIVIDE ;
+      break;
+
+    /*************** RM instructions ********************/
+    case opLD :
+      if ( mc->prof != NULL ) mc->prof->reads[m]++ ;
+      if ( r == PC_REG ) JUMP(dMem[m])
+      else reg[r] = dMem[m] ;
+      SP_SEEN(r, reg[r])
+      break;
+    case opST :
+      if ( mc->prof != NULL ) mc->prof->writes[m]++ ;
+      if ( (check & vfWATCH) && watched(mc->prog, m) )
+      { mc->watchAddr = m ;
+        mc->watchOld = dMem[m] ;
+        dMem[m] = reg[r] ;
+        return srWATCH ;
+      }
+      dMem[m] = reg[r] ;
+      break;
+
+    /*************** RA instructions ********************/
+    case opLDA :
+      if ( r == PC_REG ) JUMP(m)
+      else reg[r] = m ;
+      SP_SEEN(r, m)
+      break;
+    case opLDC :
+      if ( r == PC_REG ) JUMP(currentinstruction.iarg2)
+      else reg[r] = currentinstruction.iarg2 ;
+      SP_SEEN(r, reg[r])
+      break;
+    case opJLT :    if ( reg[r] <  0 ) JUMP(m) break;
+    case opJLE :    if ( reg[r] <=  0 ) JUMP(m) break;
+    case opJGT :    if ( reg[r] >  0 ) JUMP(m) break;
+    case opJGE :    if ( reg[r] >=  0 ) JUMP(m) break;
+    case opJEQ :    if ( reg[r] == 0 ) JUMP(m) break;
+    case opJNE :    if ( reg[r] != 0 ) JUMP(m) break;
+
+    /* end of legal instructions */
+    case opBRK :
+      if ( mc->brkPc != pc )
+      { reg[PC_REG] = pc ;
+        mc->pcSafe = TRUE ;
+        mc->insCount-- ;   /* nothing was executed */
+        return srBREAK ;
+      }
+      mc->brkPc = -1 ;
+      currentinstruction = savedInstruction(mc->prog, pc) ;
+      goto decode ;
+  } /* case */
+  return srOKAY ;
+} /* stepTM */
+
+/********************************************/
+/* Guard zone. Its pages are PROT_NONE, so  */
+/* a LD/ST into it raises SIGSEGV; while a  */
+/* guarded machine runs, the handler jumps  */
+/* back to guardedRun on its thread. Other  */
+/* faults get the previous action again.    */
+/********************************************/
+static struct sigaction oldSegv ;
+static volatile int segvInstalled = 0 ;
+static __thread sigjmp_buf * guardJmp = NULL ;
+static __thread TM_MACHINE * guardMach = NULL ;
+
+static void segvHandler ( int sig, siginfo_t * info, void * ctx )
+{ TM_MACHINE * m = guardMach ;
+  char * addr = (char *) info->si_addr ;
+  (void) sig ;
+  (void) ctx ;
+  if ( (guardJmp != NULL) && (m != NULL)
+       && (addr >= (char *) &m->dMem[m->guardLo])
+       && (addr <= (char *) &m->dMem[m->guardHi]) )
+    siglongjmp(*guardJmp, 1);
+  sigaction(SIGSEGV, &oldSegv, NULL);
+} /* segvHandler */
+
+static int protectGuard ( TM_MACHINE * m, int prot )
+{ return mprotect(&m->dMem[m->guardLo],
+                  (m->guardHi - m->guardLo + 1) * sizeof(int), prot) ;
+} /* protectGuard */
+
+/********************************************/
+int tmSetGuard ( TM_MACHINE * m, int stackLimit )
+{ int words = (int) (sysconf(_SC_PAGESIZE) / sizeof(int)) ;
+  int hi = stackLimit / words * words - 1 ;
+  int lo = hi + 1 - words ;
+  struct sigaction sa;
+  if (m->guardLo <= m->guardHi)
+    protectGuard(m, PROT_READ | PROT_WRITE);
+  m->guardLo = 0 ;
+  m->guardHi = -1 ;
+  if (stackLimit <= 0) return TRUE;
+  /* dMem[0] holds the top address and is read by the prelude */
+  if ((lo < 1) || (stackLimit > DADDR_SIZE)) return FALSE;
+  if (! __sync_lock_test_and_set(&segvInstalled, 1))
+  { memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = segvHandler ;
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER ;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, &oldSegv);
+  }
+  memset(&m->dMem[lo], 0, (hi - lo + 1) * sizeof(int));
+  m->guardLo = lo ;
+  m->guardHi = hi ;
+  if (protectGuard(m, PROT_NONE) != 0)
+  { m->guardLo = 0 ;
+    m->guardHi = -1 ;
+    return FALSE;
+  }
+  return TRUE;
+} /* tmSetGuard */
+
+/********************************************/
+int tmGetGuard ( TM_MACHINE * m, int * lo, int * hi )
+{ *lo = m->guardLo ;
+  *hi = m->guardHi ;
+  return m->guardLo <= m->guardHi ;
+} /* tmGetGuard */
+
+/********************************************/
+static STEPRESULT runLoop ( TM_MACHINE * m, long maxSteps )
+{ STEPRESULT result = srOKAY;
+  long stop = m->insCount + maxSteps ;
+  if (maxSteps <= 0)
+    do
+    { result = stepTM(m);
+      m->insCount++ ;
+    } while (result == srOKAY);
+  else
+    while ((result == srOKAY) && (m->insCount < stop))
+    { result = stepTM(m);
+      m->insCount++ ;
+    }
+  return result;
+} /* runLoop */
+
+/********************************************/
+/* runLoop with the fault handler armed.    */
+/* The barrier keeps insCount in memory, so */
+/* it is exact when the handler jumps back; */
+/* the instruction that hit the guard       */
+/* counts as executed, like other errors.   */
+/********************************************/
+static STEPRESULT guardedRun ( TM_MACHINE * m, long maxSteps )
+{ sigjmp_buf jb;
+  sigjmp_buf * outerJmp = guardJmp ;
+  TM_MACHINE * outerMach = guardMach ;
+  STEPRESULT result;
+  long stop = m->insCount + maxSteps ;
+  guardJmp = &jb ;
+  guardMach = m ;
+  if (sigsetjmp(jb, 0) == 0)
+    do
+    { result = stepTM(m);
+      m->insCount++ ;
+      __asm__ __volatile__ ("" ::: "memory");
+    } while ( (result == srOKAY)
+              && ((maxSteps <= 0) || (m->insCount < stop)) );
+  else
+  { m->insCount++ ;
+    result = srSTACK ;
+  }
+  guardJmp = outerJmp ;
+  guardMach = outerMach ;
+  return result;
+} /* guardedRun */
+
+/********************************************/
+STEPRESULT tmStep ( TM_MACHINE * m )
+{ STEPRESULT result;
+  if (m->guardLo <= m->guardHi) return guardedRun(m, 1);
+  result = stepTM(m);
+  m->insCount++ ;
+  return result;
+} /* tmStep */
+
+/********************************************/
+STEPRESULT tmRun ( TM_MACHINE * m, long maxSteps )
+{ if (m->guardLo <= m->guardHi) return guardedRun(m, maxSteps);
+  return runLoop(m, maxSteps);
+} /* tmRun */
+
+/********************************************/
+/* Snapshot file layout (native byte order):  */
+/*   magic, version, reg[NO_REGS],            */
+/*   insCount, input position,                */
+/*   iMem extent + instructions,              */
+/*   dMem as runs of non-zero words           */
+/*   (addr, len, values...), ended by len 0   */
+/********************************************/
+int tmSaveSnapshot ( TM_MACHINE * m, const char * fname, long inPos,
+                     char * err )
+{ FILE * f;
+  int hdr[2];
+  int loc, len, iCount;
+  f = fopen(fname,"wb");
+  if (f == NULL)
+  { snprintf(err, TM_ERRSIZE, "Cannot write snapshot '%s'", fname);
+    return FALSE;
+  }
+  hdr[0] = SNAP_MAGIC ;
+  hdr[1] = SNAP_VERSION ;
+  fwrite(hdr, sizeof(int), 2, f);
+  fwrite(m->reg, sizeof(int), NO_REGS, f);
+  fwrite(&m->insCount, sizeof(long), 1, f);
+  fwrite(&inPos, sizeof(long), 1, f);
+  iCount = tmProgramExtent(m->prog);
+  fwrite(&iCount, sizeof(int), 1, f);
+  for (loc = 0 ; loc < iCount ; loc++)
+  { INSTRUCTION ins = savedInstruction(m->prog, loc) ;
+    fwrite(&ins, sizeof(INSTRUCTION), 1, f);
+  }
+  loc = 0 ;
+  while (loc < DADDR_SIZE)
+  { if (tmGetMem(m, loc) == 0) { loc++ ; continue ; }
+    len = 0 ;
+    while ((loc+len < DADDR_SIZE) && (tmGetMem(m, loc+len) != 0)) len++ ;
+    fwrite(&loc, sizeof(int), 1, f);
+    fwrite(&len, sizeof(int), 1, f);
+    fwrite(&m->dMem[loc], sizeof(int), len, f);
+    loc += len ;
+  }
+  len = 0 ;
+  fwrite(&loc, sizeof(int), 1, f);
+  fwrite(&len, sizeof(int), 1, f);
+  if (fclose(f) != 0)
+  { snprintf(err, TM_ERRSIZE, "Error writing snapshot '%s'", fname);
+    return FALSE;
+  }
+  return TRUE;
+} /* tmSaveSnapshot */
+
+/********************************************/
+/* the whole file is read and checked into  */
+/* temporaries first, so a bad snapshot     */
+/* leaves the machine as it was             */
+/********************************************/
+static int readSnapshot ( TM_MACHINE * m, FILE * f, const char * fname,
+                          long * inPos, char * err )
+{ TM_PROGRAM * prog = m->prog ;
+  int hdr[2];
+  int reg[NO_REGS];
+  long insCount, pos;
+  INSTRUCTION * iMem = NULL;
+  int * dMem = NULL;
+  int loc, len, iCount, ok;
+  if ( (fread(hdr, sizeof(int), 2, f) != 2)
+       || (hdr[0] != SNAP_MAGIC) || (hdr[1] != SNAP_VERSION) )
+  { snprintf(err, TM_ERRSIZE, "'%s' is not a TM snapshot", fname);
+    return FALSE;
+  }
+  ok = (fread(reg, sizeof(int), NO_REGS, f) == NO_REGS)
+       && (fread(&insCount, sizeof(long), 1, f) == 1)
+       && (fread(&pos, sizeof(long), 1, f) == 1)
+       && (fread(&iCount, sizeof(int), 1, f) == 1)
+       && (iCount >= 0) ;
+  if (ok)
+  { iMem = (INSTRUCTION *) malloc(((size_t) iCount + 1) * sizeof(INSTRUCTION));
+    dMem = (int *) calloc(DADDR_SIZE, sizeof(int));
+    if ( (iMem == NULL) || (dMem == NULL) )
+    { snprintf(err, TM_ERRSIZE, "Out of memory");
+      free(iMem);
+      free(dMem);
+      return FALSE;
+    }
+    ok = (fread(iMem, sizeof(INSTRUCTION), iCount, f) == (size_t) iCount) ;
+  }
+  len = 0 ;
+  if (ok)
+    do
+      ok = (fread(&loc, sizeof(int), 1, f) == 1)
+           && (fread(&len, sizeof(int), 1, f) == 1)
+           && (loc >= 0) && (len >= 0) && (loc + len <= DADDR_SIZE)
+           && (fread(&dMem[loc], sizeof(int), len, f) == (size_t) len) ;
+    while (ok && (len != 0));
+  if (! ok)
+    snprintf(err, TM_ERRSIZE, "Truncated snapshot '%s'", fname);
+  /* keeps its own message */
+  else ok = setIMemSize(prog, iCount, err) ;
+  if (ok)
+  { memcpy(m->reg, reg, sizeof(reg));
+    m->insCount = insCount ;
+    *inPos = pos ;
+    memcpy(prog->iMem, iMem, iCount * sizeof(INSTRUCTION));
+    for (loc = iCount ; loc <= prog->iSize ; loc++)
+    { prog->iMem[loc].iop = opHALT ;
+      prog->iMem[loc].iarg1 = 0 ;
+      prog->iMem[loc].iarg2 = 0 ;
+      prog->iMem[loc].iarg3 = 0 ;
+    }
+    memcpy(m->dMem, dMem, DADDR_SIZE * sizeof(int));
+    m->pcSafe = FALSE ;
+    verifyProgram(prog, m->reg[GP_REG] == 0);
+  }
+  free(iMem);
+  free(dMem);
+  return ok;
+} /* readSnapshot */
+
+/********************************************/
+/* the breakpoints are lifted while the     */
+/* program is replaced, then set again; the */
+/* guard zone is opened and cleared         */
+/********************************************/
+int tmLoadSnapshot ( TM_MACHINE * m, const char * fname, long * inPos,
+                     char * err )
+{ TM_PROGRAM * prog = m->prog ;
+  FILE * f;
+  int * brks;
+  int i, nBrk = prog->nBrk, ok;
+  f = fopen(fname,"rb");
+  if (f == NULL)
+  { snprintf(err, TM_ERRSIZE, "snapshot '%s' not found", fname);
+    return FALSE;
+  }
+  brks = (int *) malloc((nBrk + 1) * sizeof(int));
+  if (brks == NULL)
+  { snprintf(err, TM_ERRSIZE, "Out of memory");
+    fclose(f);
+    return FALSE;
+  }
+  memcpy(brks, prog->brkLoc, nBrk * sizeof(int));
+  for (i = 0 ; i < nBrk ; i++)
+    tmClearBreak(prog, brks[i]);
+  if (m->guardLo <= m->guardHi) protectGuard(m, PROT_READ | PROT_WRITE);
+  ok = readSnapshot(m, f, fname, inPos, err);
+  fclose(f);
+  if (m->guardLo <= m->guardHi)
+  { memset(&m->dMem[m->guardLo], 0,
+           (m->guardHi - m->guardLo + 1) * sizeof(int));
+    protectGuard(m, PROT_NONE);
+  }
+  for (i = 0 ; i < nBrk ; i++)
+    tmSetBreak(prog, brks[i]);
+  free(brks);
+  markWatches(prog);
+  return ok;
+} /* tmLoadSnapshot */
+
+/********************************************/
+/* Lockstep mode: a group of lanes, each a  */
+/* machine running the program on its own   */
+/* input. State is stored lane-minor        */
+/* (reg[r][lane], dMem[addr][lane]) so one  */
+/* decoded instruction is applied to every  */
+/* lane by a loop the compiler vectorizes.  */
+/* Each step runs the lanes with the lowest */
+/* pc and masks the others; lanes that took */
+/* different paths reconverge where the     */
+/* paths join again.                        */
+/********************************************/
+typedef struct {
+      int n ;                  /* number of lanes */
+      int * reg ;              /* reg[r * n + lane] */
+      int * dMem ;             /* dMem[addr * n + lane] */
+      unsigned char * active ; /* lane is at the pc being run */
+      unsigned char * taken ;  /* lane takes the current jump */
+      STEPRESULT * result ;    /* srOKAY while the lane runs */
+      long * insCount ;
+      long * cycles ;
+      const TM_COSTS * costs ;
+      long fuel ;              /* 0 for none */
+      const TM_IO * io ;
+      void ** users ;
+   } LANES;
+
+/* run stmt for every active lane; all means every lane is active */
+#define LANES_DO(...) \
+  { if (all) { for (l = 0 ; l < n ; l++) { __VA_ARGS__ ; } } \
+    else { for (l = 0 ; l < n ; l++) if (act[l]) { __VA_ARGS__ ; } } }
+
+/********************************************/
+static void stepLanes ( TM_PROGRAM * prog, LANES * g, int pc, int all )
+{ INSTRUCTION ins = savedInstruction(prog, pc) ;
+  const TM_COSTS * costs = g->costs ;
+  const TM_IO * io = g->io ;
+  int n = g->n ;
+  unsigned char * act = g->active ;
+  unsigned char * taken = g->taken ;
+  int * P = g->reg + PC_REG * n ;
+  int * R = g->reg + ins.iarg1 * n ;
+  int * S ;
+  int * T ;
+  int d = ins.iarg2 ;
+  int memOk = prog->iCheck[pc] & vfMEM_OK ;
+  int jump = (ins.iop >= opJLT)
+             || ( (ins.iarg1 == PC_REG)
+                  && ((ins.iop == opLD) || (ins.iop == opLDA) || (ins.iop == opLDC)) ) ;
+  int l, m ;
+
+  LANES_DO( P[l] = pc + 1 ; g->insCount[l]++ )
+  if ( costs != NULL ) LANES_DO( g->cycles[l] += costs->op[ins.iop] )
+  if (tmOpClass(ins.iop) == opclRR)
+  { S = g->reg + ins.iarg2 * n ;
+    T = g->reg + ins.iarg3 * n ;
+  }
+  else
+  { S = g->reg + ins.iarg3 * n ;
+    T = S ;
+  }
+  switch ( ins.iop )
+  { /* RR instructions */
+    case opHALT :
+      LANES_DO( if (io->halt != NULL)
+                  io->halt(g->users[l], ins.iarg1, ins.iarg2, ins.iarg3) ;
+                g->result[l] = srHALT )
+      break;
+    case opIN :
+      LANES_DO( if ( (io->in == NULL) || ! io->in(g->users[l], &R[l]) )
+                  g->result[l] = srNOINPUT )
+      break;
+    case opOUT :
+      if (io->out != NULL) LANES_DO( io->out(g->users[l], R[l]) )
+      break;
+    case opADD :  LANES_DO( R[l] = S[l] + T[l] )  break;
+    case opSUB :  LANES_DO( R[l] = S[l] - T[l] )  break;
+    case opMUL :  LANES_DO( R[l] = S[l] * T[l] )  break;
+    case opDIV :
+      LANES_DO( if ( T[l] != 0 ) R[l] = S[l] / T[l] ;
+                else g->result[l] = srZERODIVIDE )
+      break;
+
+    /*************** RM instructions ********************/
+    case opLD :
+      LANES_DO( m = d + S[l] ;
+                if ( ! memOk && ( (m < 0) || (m > DADDR_SIZE) ) )
+                  g->result[l] = srDMEM_ERR ;
+                else R[l] = g->dMem[m * n + l] )
+      break;
+    case opST :
+      LANES_DO( m = d + S[l] ;
+                if ( ! memOk && ( (m < 0) || (m > DADDR_SIZE) ) )
+                  g->result[l] = srDMEM_ERR ;
+                else g->dMem[m * n + l] = R[l] )
+      break;
+
+    /*************** RA instructions ********************/
+    case opLDA :  LANES_DO( R[l] = d + S[l] )  break;
+    case opLDC :  LANES_DO( R[l] = d )  break;
+    case opJLT :  LANES_DO( taken[l] = (R[l] <  0) )  break;
+    case opJLE :  LANES_DO( taken[l] = (R[l] <= 0) )  break;
+    case opJGT :  LANES_DO( taken[l] = (R[l] >  0) )  break;
+    case opJGE :  LANES_DO( taken[l] = (R[l] >= 0) )  break;
+    case opJEQ :  LANES_DO( taken[l] = (R[l] == 0) )  break;
+    case opJNE :  LANES_DO( taken[l] = (R[l] != 0) )  break;
+  } /* case */
+
+  /* conditional jumps: lanes that do not take it are now behind */
+  if ( ins.iop >= opJLT )
+  { LANES_DO( P[l] = taken[l] ? d + S[l] : P[l] )
+    if ( costs != NULL ) LANES_DO( g->cycles[l] += taken[l] * costs->taken )
+  }
+  else if ( (costs != NULL) && jump )
+    LANES_DO( g->cycles[l] += costs->taken )
+  /* fuel is checked where JUMP checks it on a machine: on a jump
+     back, with insCount not yet counting the jump */
+  if ( (g->fuel > 0) && jump )
+    LANES_DO( if ( (g->result[l] == srOKAY) && (P[l] <= pc)
+                   && (g->insCount[l] - 1 >= g->fuel) )
+                g->result[l] = srFUEL )
+} /* stepLanes */
+
+/********************************************/
+void tmRunLanes ( TM_PROGRAM * prog, int n, const TM_IO * io, void ** users,
+                  const TM_COSTS * costs, long fuel, double seconds,
+                  STEPRESULT * results, long * counts, long * cycles )
+{ LANES g;
+  struct timespec deadline;
+  long steps = 0;
+  int * P;
+  int l, pc, all, running;
+  g.n = n ;
+  g.reg = (int *) calloc(NO_REGS * n, sizeof(int));
+  g.dMem = (int *) calloc((DADDR_SIZE + 1) * n, sizeof(int));
+  g.active = (unsigned char *) calloc(n, 1);
+  g.taken = (unsigned char *) calloc(n, 1);
+  g.result = results ;
+  g.insCount = counts ;
+  g.cycles = cycles ;
+  g.costs = costs ;
+  g.fuel = fuel ;
+  g.io = io ;
+  g.users = users ;
+  for (l = 0 ; l < n ; l++)
+  { counts[l] = 0 ;
+    cycles[l] = 0 ;
+  }
+  if ( (g.reg == NULL) || (g.dMem == NULL) || (g.active == NULL)
+       || (g.taken == NULL) )
+  { for (l = 0 ; l < n ; l++)
+      if (results[l] == srOKAY) results[l] = srNOINPUT ;
+    n = 0 ;
+  }
+  for (l = 0 ; l < n ; l++)
+    g.dMem[l] = DADDR_SIZE - 1 ;
+  setDeadline(&deadline, seconds);
+  P = g.reg + PC_REG * n ;
+  for (;;)
+  { pc = INT_MAX ;
+    running = 0 ;
+    for (l = 0 ; l < n ; l++)
+      if (results[l] == srOKAY)
+      { running++ ;
+        if (P[l] < pc) pc = P[l] ;
+      }
+    if (running == 0) break;
+    all = TRUE ;
+    for (l = 0 ; l < n ; l++)
+    { g.active[l] = (results[l] == srOKAY) && (P[l] == pc) ;
+      all &= g.active[l] ;
+    }
+    if ( (pc < 0) || (pc > prog->iSize) )
+    { for (l = 0 ; l < n ; l++)
+        if (g.active[l])
+        { results[l] = srIMEM_ERR ;
+          counts[l]++ ;
+        }
+      continue;
+    }
+    stepLanes(prog, &g, pc, all);
+    if ( (deadline.tv_sec > 0) && ((++steps & 1023) == 0)
+         && pastDeadline(&deadline) )
+      for (l = 0 ; l < n ; l++)
+        if (results[l] == srOKAY) results[l] = srTIMEOUT ;
+  }
+  free(g.reg);
+  free(g.dMem);
+  free(g.active);
+  free(g.taken);
+} /* tmRunLanes */
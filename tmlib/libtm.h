@@ -0,0 +1,244 @@
+/****************************************************/
+/* File: libtm.h                                    */
+/* Embeddable TM ("Tiny Machine") simulator         */
+/* A program is loaded once and can be shared by    */
+/* any number of machines; each machine is an       */
+/* opaque handle with its own registers, data       */
+/* memory, limits and IN/OUT callbacks. Nothing is  */
+/* global, so machines may run on separate threads. */
+/****************************************************/
+
+#ifndef _LIBTM_H_
+#define _LIBTM_H_
+
+#include <stddef.h>
+
+#define   IADDR_SIZE  1024 /* minimum; iMem grows to fit the program */
+#define   IADDR_MAX   (1 << 24)
+#define   DADDR_SIZE  8192 /* increase for large programs */
+#define   NO_REGS 8
+#define   PC_REG  7
+/* global, frame and stack pointers of the C- code generator */
+#define   GP_REG  5
+#define   FP_REG  2
+#define   SP_REG  3
+
+/* load-time verifier results, see tmCheckFlags */
+#define   vfPC_OK   0x1  /* every successor is a valid pc */
+#define   vfMEM_OK  0x2  /* LD/ST address is always in range */
+#define   vfGP_REL  0x4  /* LD/ST is gp-relative with constant offset */
+#define   vfPC_REL  0x8  /* LD/ST is pc-relative */
+#define   vfWATCH   0x10 /* ST may write a watched address */
+
+typedef enum {
+   opclRR,     /* reg operands r,s,t */
+   opclRM,     /* reg r, mem d+s */
+   opclRA      /* reg r, int d+s */
+   } OPCLASS;
+
+typedef enum {
+   /* RR instructions */
+   opHALT,    /* RR     halt, operands are ignored */
+   opIN,      /* RR     read into reg(r); s and t are ignored */
+   opOUT,     /* RR     write from reg(r), s and t are ignored */
+   opADD,    /* RR     reg(r) = reg(s)+reg(t) */
+   opSUB,    /* RR     reg(r) = reg(s)-reg(t) */
+   opMUL,    /* RR     reg(r) = reg(s)*reg(t) */
+   opDIV,    /* RR     reg(r) = reg(s)/reg(t) */
+   opRRLim,   /* limit of RR opcodes */
+
+   /* RM instructions */
+   opLD,      /* RM     reg(r) = mem(d+reg(s)) */
+   opST,      /* RM     mem(d+reg(s)) = reg(r) */
+   opRMLim,   /* Limit of RM opcodes */
+
+   /* RA instructions */
+   opLDA,     /* RA     reg(r) = d+reg(s) */
+   opLDC,     /* RA     reg(r) = d ; reg(s) is ignored */
+   opJLT,     /* RA     if reg(r)<0 then reg(7) = d+reg(s) */
+   opJLE,     /* RA     if reg(r)<=0 then reg(7) = d+reg(s) */
+   opJGT,     /* RA     if reg(r)>0 then reg(7) = d+reg(s) */
+   opJGE,     /* RA     if reg(r)>=0 then reg(7) = d+reg(s) */
+   opJEQ,     /* RA     if reg(r)==0 then reg(7) = d+reg(s) */
+   opJNE,     /* RA     if reg(r)!=0 then reg(7) = d+reg(s) */
+   opRALim,   /* Limit of RA opcodes */
+
+   /* patched in by tmSetBreak, never loaded from a program */
+   opBRK      /* breakpoint; the instruction it hides is kept aside */
+   } OPCODE;
+
+typedef enum {
+   srOKAY,
+   srHALT,
+   srIMEM_ERR,
+   srDMEM_ERR,
+   srZERODIVIDE,
+   srNOINPUT,
+   srFUEL,
+   srTIMEOUT,
+   srBREAK,   /* stopped before a breakpoint, pc is at it */
+   srWATCH,   /* stopped after a ST into a watched range */
+   srSTACK    /* LD/ST into the guard zone, see tmSetGuard */
+   } STEPRESULT;
+
+typedef struct {
+      int iop  ;
+      int iarg1  ;
+      int iarg2  ;
+      int iarg3  ;
+   } INSTRUCTION;
+
+/* per-address access counts of one machine */
+typedef struct {
+      unsigned long reads [DADDR_SIZE + 1];
+      unsigned long writes [DADDR_SIZE + 1];
+      int minSp ;        /* lowest sp set by LD, LDA or LDC, */
+                         /* from DADDR_SIZE-1 at reset */
+   } MEMPROF;
+
+/* dynamic instruction statistics of one machine; a conditional */
+/* jump counts as taken when the next pc is not the following one */
+typedef struct {
+      unsigned long ops [opRALim];    /* executions of each opcode */
+      unsigned long taken [opRALim];  /* conditional jumps taken */
+      unsigned long reads [NO_REGS];  /* LD by base register */
+      unsigned long writes [NO_REGS]; /* ST by base register */
+      unsigned long pairs [opRALim][opRALim];  /* consecutive opcodes */
+      unsigned long triples [opRALim][opRALim][opRALim];
+      int last [2] ;     /* the previous two opcodes, -1 for none */
+      int lastPc ;
+   } TM_STATS;
+
+/* cycle-cost model: cycles per opcode (any memory */
+/* cost already added to LD/ST) plus an extra for  */
+/* every taken jump; op[opBRK] is added on top of  */
+/* the instruction under a breakpoint              */
+typedef struct {
+      int op [opBRK + 1];
+      int taken ;
+   } TM_COSTS;
+
+/* I/O callbacks; user is the pointer given with them */
+typedef struct {
+      /* store the next IN value, return 0 when input is exhausted */
+      int (* in) ( void * user, int * value );
+      /* value printed by OUT */
+      void (* out) ( void * user, int value );
+      /* operands of the HALT that stopped the machine; may be NULL */
+      void (* halt) ( void * user, int r, int s, int t );
+   } TM_IO;
+
+typedef struct TM_PROGRAM TM_PROGRAM;
+typedef struct TM_MACHINE TM_MACHINE;
+
+/* room for any message put in an err buffer below */
+#define TM_ERRSIZE 512
+
+/**************** opcodes *******************/
+int tmOpClass ( int op );
+const char * tmOpName ( int op );
+/* opcode of a mnemonic of len characters, -1 if there is none */
+int tmLookupOpcode ( const char * w, int len );
+const char * tmResultName ( STEPRESULT result );
+
+/**************** programs ******************/
+/* On failure these return NULL and put the */
+/* reason (with line, column and a caret    */
+/* for syntax errors) in err                */
+TM_PROGRAM * tmLoadProgram ( const char * text, size_t size, char * err );
+TM_PROGRAM * tmLoadProgramFile ( const char * fname, char * err );
+void tmFreeProgram ( TM_PROGRAM * prog );
+/* locations 0 .. tmProgramSize-1; tmProgramSize holds a HALT */
+int tmProgramSize ( TM_PROGRAM * prog );
+/* locations up to the last one that is not HALT 0,0,0 */
+int tmProgramExtent ( TM_PROGRAM * prog );
+/* FALSE if loc is outside 0 .. tmProgramSize */
+int tmGetInstruction ( TM_PROGRAM * prog, int loc, INSTRUCTION * ins );
+/* vf* flags of loc */
+int tmCheckFlags ( TM_PROGRAM * prog, int loc );
+
+/**************** machines ******************/
+TM_MACHINE * tmNewMachine ( TM_PROGRAM * prog );
+void tmFreeMachine ( TM_MACHINE * m );
+TM_PROGRAM * tmMachineProgram ( TM_MACHINE * m );
+/* registers, data memory, counters, profile and statistics back */
+/* to the start                                                   */
+void tmReset ( TM_MACHINE * m );
+void tmSetIO ( TM_MACHINE * m, const TM_IO * io, void * user );
+/* stop after fuel more instructions and after seconds of wall-clock */
+/* time from now (0 = no limit); only checked on backward jumps      */
+void tmSetLimits ( TM_MACHINE * m, long fuel, double seconds );
+/* costs is not copied; NULL turns cycle counting off */
+void tmSetCosts ( TM_MACHINE * m, const TM_COSTS * costs );
+/* prof is not copied; NULL turns profiling off */
+void tmSetProfile ( TM_MACHINE * m, MEMPROF * prof );
+/* stats is not copied; NULL turns the statistics off */
+void tmSetStats ( TM_MACHINE * m, TM_STATS * stats );
+
+int tmGetReg ( TM_MACHINE * m, int regNo );
+void tmSetReg ( TM_MACHINE * m, int regNo, int value );
+/* addresses 0 .. DADDR_SIZE-1 */
+int tmGetMem ( TM_MACHINE * m, int addr );
+void tmSetMem ( TM_MACHINE * m, int addr, int value );
+/* Guard zone: protect the dMem page just below stackLimit (rounded */
+/* down to a page boundary), so that a LD/ST the stack makes into  */
+/* it stops the machine with srSTACK instead of overwriting the    */
+/* globals. The check is the MMU's, not the simulator's. The zone  */
+/* reads as 0; calling again moves it, a limit of 0 removes it.    */
+/* FALSE if it would not fit between dMem[0] and DADDR_SIZE.       */
+int tmSetGuard ( TM_MACHINE * m, int stackLimit );
+/* the guarded words, FALSE when there is no guard */
+int tmGetGuard ( TM_MACHINE * m, int * lo, int * hi );
+/* instructions executed and estimated cycles since the reset */
+long tmInsCount ( TM_MACHINE * m );
+long tmCycles ( TM_MACHINE * m );
+
+/* execute one instruction */
+STEPRESULT tmStep ( TM_MACHINE * m );
+/* execute until a result other than srOKAY, or until maxSteps */
+/* instructions ran (srOKAY is returned then; 0 = no maximum)  */
+STEPRESULT tmRun ( TM_MACHINE * m, long maxSteps );
+
+/* Snapshots hold the registers, the instruction count, inPos (an  */
+/* input position kept for the caller), the program and data      */
+/* memory. Loading one replaces the program of m, which must not  */
+/* be shared with other machines at that time; breakpoints and    */
+/* watches are carried over to the new program.                   */
+int tmSaveSnapshot ( TM_MACHINE * m, const char * fname, long inPos,
+                     char * err );
+int tmLoadSnapshot ( TM_MACHINE * m, const char * fname, long * inPos,
+                     char * err );
+
+/**************** debugging ***************/
+/* Breakpoints replace the instruction at loc by opBRK, so they */
+/* cost nothing until one is reached; tmGetInstruction still   */
+/* returns the original. A machine stops at a breakpoint with  */
+/* srBREAK before executing it.                                */
+int tmSetBreak ( TM_PROGRAM * prog, int loc );
+int tmClearBreak ( TM_PROGRAM * prog, int loc );
+int tmIsBreak ( TM_PROGRAM * prog, int loc );
+/* the next instruction of m runs even if it has a breakpoint; */
+/* call this before resuming from srBREAK                      */
+void tmSkipBreak ( TM_MACHINE * m );
+/* Watch stores into dMem[lo..hi]: ST instructions that may     */
+/* write there get vfWATCH and stop the machine with srWATCH    */
+/* after such a store; the others run unchecked.                */
+int tmAddWatch ( TM_PROGRAM * prog, int lo, int hi );
+int tmRemoveWatch ( TM_PROGRAM * prog, int lo, int hi );
+/* range i, FALSE when there are no more */
+int tmGetWatch ( TM_PROGRAM * prog, int i, int * lo, int * hi );
+/* address and previous value of the store that caused srWATCH */
+void tmLastWatch ( TM_MACHINE * m, int * addr, int * oldValue );
+
+/**************** lockstep ******************/
+/* Run prog on n lanes at once, lane l using io with users[l], */
+/* until every lane stops; the result, instruction count and  */
+/* cycles of lane l are left in results[l], counts[l] and     */
+/* cycles[l]. Only lanes that enter with results[l] srOKAY    */
+/* run. costs, fuel and seconds are as for machines; lanes    */
+/* ignore breakpoints, watches, guards and statistics.        */
+void tmRunLanes ( TM_PROGRAM * prog, int n, const TM_IO * io, void ** users,
+                  const TM_COSTS * costs, long fuel, double seconds,
+                  STEPRESULT * results, long * counts, long * cycles );
+
+#endif